@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace interpreter {
+    using namespace std;
+
+    // The loops behind the bulk array opcodes. Each one uses AVX2 when the CPU
+    // has it and a plain loop otherwise, which optimized builds vectorize for
+    // SSE2. Integer elements wrap around like ADD_INT32, integer sums and dot
+    // products are taken in 64 bits. Double sums are reassociated, so they may
+    // round differently from adding the elements in order.
+    namespace kernels {
+        void Add(const int32_t* a, const int32_t* b, int32_t* out, size_t length);
+        void Add(const double* a, const double* b, double* out, size_t length);
+        void Multiply(const int32_t* a, const int32_t* b, int32_t* out, size_t length);
+        void Multiply(const double* a, const double* b, double* out, size_t length);
+
+        int64_t Sum(const int32_t* values, size_t length);
+        double Sum(const double* values, size_t length);
+        // Of at least one element.
+        int32_t Min(const int32_t* values, size_t length);
+        double Min(const double* values, size_t length);
+        int32_t Max(const int32_t* values, size_t length);
+        double Max(const double* values, size_t length);
+
+        int64_t Dot(const int32_t* a, const int32_t* b, size_t length);
+        double Dot(const double* a, const double* b, size_t length);
+
+        // Whether the AVX2 versions run, for the benchmark.
+        bool UsesAvx2();
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ManagedHeap.h"
+#include <cstdint>
+#include <cstddef>
+
+namespace interpreter {
+    using namespace std;
+
+    enum class ElementType: uint8_t {
+        INT32,
+        DOUBLE
+    };
+
+    // A fixed-length array of int32_t or double elements, an object of the
+    // managed heap with the elements right after it. Its length is whatever
+    // NEW_ARRAY popped, so it can be decided at run time.
+    struct Array : ObjectHeader {
+        ElementType _type;
+        uint64_t _length;
+
+        int32_t* Ints() { return reinterpret_cast<int32_t*>(this + 1); }
+        double* Doubles() { return reinterpret_cast<double*>(this + 1); }
+        const int32_t* Ints() const { return reinterpret_cast<const int32_t*>(this + 1); }
+        const double* Doubles() const { return reinterpret_cast<const double*>(this + 1); }
+        size_t Length() const { return size_t(_length); }
+    };
+
+    static constexpr size_t MAX_ARRAY_LENGTH = size_t(1) << 31;
+
+    // A slot refers to an array by its address, so a zeroed slot refers to none.
+    // The elements are zeroed.
+    int64_t NewArray(ManagedHeap& heap, ElementType type, int64_t length);
+    // Throws for a value that doesn't refer to an array of heap.
+    Array& ArrayAt(const ManagedHeap& heap, int64_t value);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "ThreadedCode.h"
+#include "WorkStealingPool.h"
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Runs the function at entry once per argument set, spread over pool with
+    // one VM per worker, and returns the results in the order of argumentSets.
+    // With printed, what each run prints is collected into the entry with its
+    // index. Otherwise it goes to the output sink of the worker thread.
+    vector<int16_t> RunBatch(const ThreadedCode& code, size_t entry, span<const vector<int16_t>> argumentSets,
+                             WorkStealingPool& pool, vector<vector<int64_t>>* printed = nullptr);
+}
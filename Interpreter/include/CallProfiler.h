@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Instruction.h"
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Attributes the instructions the reference interpreter executes to the
+    // script function running them and to the chain of calls that led there.
+    // Counting instructions instead of time makes profiles reproducible and
+    // costs no clock reads.
+    class CallProfiler {
+    public:
+        struct FunctionProfile {
+            uint64_t _calls = 0;
+            uint64_t _inclusiveInstructions = 0; // including callees, recursive calls counted once
+            uint64_t _exclusiveInstructions = 0;
+        };
+
+        // functionNames maps entry offsets into code to names, as functionToInstruction does.
+        CallProfiler(const Instruction* code, map<size_t, string> functionNames);
+
+        // Hooks of the dispatch loop.
+        void Start(const Instruction* entry) {
+            _current = 0;
+            Call(entry);
+        }
+        void Call(const Instruction* entry);
+        void Return() {
+            if(_current != 0)
+                _current = _nodes[_current]._parent;
+        }
+        void CountInstruction() { ++_nodes[_current]._instructions; }
+
+        map<string, FunctionProfile> Functions() const;
+
+        // One line per call stack, "main;foo 123", with the instructions executed
+        // in the innermost function. flamegraph.pl and speedscope read this as is.
+        void PrintFolded(ostream& out) const;
+
+        // Functions by inclusive instruction count.
+        void Print(ostream& out) const;
+
+    private:
+        // A node of the calling context tree.
+        struct Node {
+            size_t _function;
+            uint32_t _parent;
+            uint64_t _calls = 0;
+            uint64_t _instructions = 0;
+            map<size_t, uint32_t> _children;
+        };
+
+        string NameOf(size_t function) const;
+        void Accumulate(map<size_t, FunctionProfile>& functions) const;
+
+        const Instruction* _code;
+        map<size_t, string> _functionNames;
+        vector<Node> _nodes;
+        uint32_t _current = 0;
+    };
+}
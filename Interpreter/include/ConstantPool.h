@@ -0,0 +1,32 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // The values of a program that don't fit an instruction's 16-bit operand,
+    // wide integers and doubles, which are kept as their bits. PUSH_CONST pushes
+    // the entry its p2 indexes, read as unsigned, so a program has up to 65536
+    // of them. Equal values share an entry.
+    class ConstantPool {
+    public:
+        static constexpr size_t MAX_ENTRIES = 65536;
+
+        // Index of value, added unless it's already there.
+        uint16_t Add(int64_t value);
+        uint16_t AddDouble(double value) { return Add(bit_cast<int64_t>(value)); }
+
+        int64_t At(uint16_t index) const { return _values[index]; }
+        const int64_t* Data() const { return _values.data(); }
+        size_t Size() const { return _values.size(); }
+
+    private:
+        vector<int64_t> _values;
+        unordered_map<int64_t, uint16_t> _indices;
+    };
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Page-aligned memory holding generated machine code. It is written while
+    // still read/write and only then made executable, so it is never both.
+    class ExecutableMemory {
+    public:
+        ExecutableMemory() = default;
+        explicit ExecutableMemory(const vector<uint8_t>& code);
+        ExecutableMemory(ExecutableMemory&& other) noexcept;
+        ExecutableMemory& operator=(ExecutableMemory&& other) noexcept;
+        ExecutableMemory(const ExecutableMemory&) = delete;
+        ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+        ~ExecutableMemory();
+
+        const uint8_t* Data() const { return _data; }
+        size_t Size() const { return _size; }
+
+    private:
+        uint8_t* _data = nullptr;
+        size_t _size = 0;
+        size_t _mappedSize = 0;
+    };
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Instruction.h"
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <unordered_map>
+
+namespace interpreter {
+    using namespace std;
+
+    // Execution counts of the reference interpreter per opcode, per pair of
+    // opcodes executed back to back, and per instruction address. Only runs
+    // given counters pay for counting; the others use the plain dispatch loop.
+    class ExecutionCounters {
+    public:
+        // The instruction is copied so the counts can be printed after the code is gone.
+        struct AddressCount {
+            Instruction _instruction;
+            uint64_t _count;
+        };
+
+        // With dumpAtExit, Print() goes there when the counters are destroyed,
+        // which for a counter object in main or a static is at exit.
+        explicit ExecutionCounters(ostream* dumpAtExit = nullptr) : _dumpAtExit(dumpAtExit) {}
+        ExecutionCounters(const ExecutionCounters&) = delete;
+        ExecutionCounters& operator=(const ExecutionCounters&) = delete;
+        ~ExecutionCounters();
+
+        // previous is the opcode executed just before in the same run, or NUM_INSTRUCTIONS.
+        void Count(const Instruction* instruction, Opcode previous) {
+            ++_opcodes[instruction->_opcode];
+            if(previous != NUM_INSTRUCTIONS)
+                ++_pairs[previous][instruction->_opcode];
+            AddressCount& addressCount = _addresses[instruction];
+            addressCount._instruction = *instruction;
+            ++addressCount._count;
+        }
+
+        uint64_t OpcodeCount(Opcode opcode) const { return _opcodes[opcode]; }
+        uint64_t PairCount(Opcode first, Opcode second) const { return _pairs[first][second]; }
+        const unordered_map<const Instruction*, AddressCount>& AddressCounts() const { return _addresses; }
+
+        void Reset();
+
+        // Prints every executed opcode, then the most frequent pairs and addresses.
+        void Print(ostream& out, size_t maxEntries = 20) const;
+
+    private:
+        ostream* _dumpAtExit;
+        uint64_t _opcodes[NUM_INSTRUCTIONS] = {};
+        uint64_t _pairs[NUM_INSTRUCTIONS][NUM_INSTRUCTIONS] = {};
+        unordered_map<const Instruction*, AddressCount> _addresses;
+    };
+}
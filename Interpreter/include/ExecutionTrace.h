@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Instruction.h"
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Records the control flow of reference interpreter runs into a compact
+    // binary file, to be analyzed offline with TraceAnalysis. Only control
+    // transfers are written: every conditional branch with its direction, every
+    // JUMP_BY, CALL and RETURN, each with its offset, target and operand stack
+    // depth as varint deltas from the previous event, so straight-line code
+    // costs nothing and a loop iteration takes a few bytes. Every recording
+    // thread writes to its own lock-free ring, which a writer thread drains to
+    // the file.
+    class TraceRecorder {
+    public:
+        // The events of one thread. Only that thread writes to it.
+        class Stream {
+        public:
+            // Hooks of the dispatch loop: the start of a run, and every control
+            // transfer after it executed, with the instruction it continues at.
+            void Start(const Instruction* entry, size_t depth);
+            void Record(const Instruction* executed, const Instruction* next, size_t depth);
+
+        private:
+            friend class TraceRecorder;
+            Stream(const Instruction* code, size_t capacity);
+
+            void Write(const uint8_t* bytes, size_t size);
+            size_t Drain(vector<uint8_t>& out);
+
+            const Instruction* _code;
+            vector<uint8_t> _ring;
+            size_t _mask;
+            atomic<uint64_t> _head = 0; // written by the recording thread
+            atomic<uint64_t> _tail = 0; // written by the writer thread
+            size_t _resume = 0;         // where straight-line code continued after the last event
+            size_t _depth = 0;
+        };
+
+        // Offsets in the trace are relative to code. functionNames maps entry
+        // offsets to names for the analysis, as functionToInstruction does.
+        TraceRecorder(const string& path, const Instruction* code, map<size_t, string> functionNames = {},
+                      size_t ringCapacity = 1 << 20);
+        TraceRecorder(const TraceRecorder&) = delete;
+        TraceRecorder& operator=(const TraceRecorder&) = delete;
+        // Writes everything recorded so far and closes the file.
+        ~TraceRecorder();
+
+        Stream& StreamOfThisThread();
+
+    private:
+        void WriteChunks(bool final);
+
+        const Instruction* _code;
+        size_t _ringCapacity;
+        uint64_t _id;
+        ofstream _file;
+        mutex _streamsMutex;
+        vector<unique_ptr<Stream>> _streams; // the index is the thread number in the file
+        atomic<bool> _stopping = false;
+        thread _writer;
+    };
+
+    // Reads a trace written by TraceRecorder and derives what optimizations are
+    // decided on from it.
+    class TraceAnalysis {
+    public:
+        // A straight-line run of instructions that ends in a control transfer.
+        struct Path {
+            size_t _start;
+            size_t _end; // the control transfer, inclusive
+            uint64_t _count;
+        };
+
+        struct BranchBias {
+            uint64_t _taken = 0;
+            uint64_t _notTaken = 0;
+        };
+
+        explicit TraceAnalysis(istream& trace);
+
+        uint64_t Runs() const { return _runs; }
+        uint64_t Instructions() const { return _instructions; }
+        size_t MaxDepth() const { return _maxDepth; }
+
+        // By instructions executed, the most first.
+        vector<Path> HotPaths() const;
+        // Conditional branches by offset.
+        const map<size_t, BranchBias>& Branches() const { return _branches; }
+        // Calls by caller and callee name.
+        const map<pair<string, string>, uint64_t>& CallGraph() const { return _callGraph; }
+
+        void Print(ostream& out, size_t maxEntries = 10) const;
+
+    private:
+        void Analyze(const vector<uint8_t>& events);
+        string NameOf(size_t function) const;
+
+        map<size_t, string> _functionNames;
+        map<pair<size_t, size_t>, uint64_t> _paths;
+        map<size_t, BranchBias> _branches;
+        map<pair<size_t, size_t>, uint64_t> _calls; // by call site and target
+        map<pair<string, string>, uint64_t> _callGraph;
+        uint64_t _runs = 0;
+        uint64_t _instructions = 0;
+        size_t _maxDepth = 0;
+    };
+}
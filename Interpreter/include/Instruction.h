@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 
 namespace interpreter {
     enum Opcode: uint8_t {
@@ -18,13 +19,67 @@ namespace interpreter {
         STORE_INT_BASEPOINTER_RELATIVE,
         CALL,
         RETURN,
+        // Superinstructions, only produced by OptimizePeephole.
+        INC_INT_BASEPOINTER_RELATIVE,   // frame slot p2 += int8_t(p1)
+        ADD_INT_IMMEDIATE,              // top of stack += p2
+        JUMP_BY_IF_NOT_LESS,            // pop b, pop a, jump by p2 unless a < b
+        POP_INT_N,                      // pop p2 values
+        // Integers wider than 16 bits, doubles and arrays. Only the reference interpreter,
+        // whose stack slots are 64 bits wide, runs them, the other engines reject them.
+        PUSH_CONST,                     // push constant pool entry uint16_t(p2)
+        ADD_INT32,
+        COMP_INT32_LT,
+        ADD_INT64,
+        COMP_INT64_LT,
+        // A double occupies one slot as its bits, unboxed.
+        ADD_DOUBLE,
+        SUB_DOUBLE,
+        MUL_DOUBLE,
+        DIV_DOUBLE,
+        COMP_DOUBLE_LT,                 // pushes an int
+        INT_TO_DOUBLE,
+        DOUBLE_TO_INT,                  // toward zero, saturated to 32 bits, NaN becomes 0
+        PRINT_DOUBLE,
+        // Arrays, which a slot refers to by a handle. A bulk operation runs a
+        // whole loop of ArrayKernels in one instruction.
+        NEW_ARRAY,                      // pop length, push a zeroed array of length * max(p2, 1) ElementType(p1)
+        ARRAY_LENGTH,                   // pop array, push its length / max(p1, 1)
+        // Element index * p1 + p2 with p1 > 0, for fields of interleaved structs.
+        ARRAY_LOAD_INT,                 // pop index, pop array, push the element converted to an int
+        ARRAY_LOAD_DOUBLE,
+        ARRAY_STORE_INT,                // pop an int, pop index, pop array, store it converted to the element type
+        ARRAY_STORE_DOUBLE,
+        ARRAY_ADD,                      // pop b, pop a, pop out, out[i] = a[i] + b[i]
+        ARRAY_MUL,
+        ARRAY_SUM,                      // pop array, push a double
+        ARRAY_MIN,
+        ARRAY_MAX,
+        ARRAY_DOT,                      // pop b, pop a, push a double
+        // Strings, held in a slot as Strings.h describes.
+        CONCAT_STRING,                  // pop b, pop a, push a + b
+        COMP_STRING_LT,                 // pushes an int, comparing bytes
+        EQUAL_STRING,                   // pushes an int
+        PRINT_VALUES,                   // pop p1 values and print them as one line, PrintedKind per 2 bits of p2
+        // For narrow code, whose ints are 16 bits, after an instruction that pushes a 32-bit int.
+        SATURATE_INT16,                 // top of stack clamped to int16_t
         NUM_INSTRUCTIONS
     };
 
+    // The opcodes before PUSH_CONST, which every engine runs.
+    static constexpr size_t NUM_NARROW_OPCODES = PUSH_CONST;
+
+    inline bool IsWideOpcode(Opcode opcode) {
+        return opcode >= NUM_NARROW_OPCODES && opcode < NUM_INSTRUCTIONS;
+    }
+
     class Instruction {
     public:
         Opcode _opcode;
         uint8_t p1;
         int16_t p2;
     };
+
+    // Throws unless code only uses 16-bit integers, for the engines that don't
+    // have other values.
+    void RequireNarrowCode(const Instruction* code, size_t numInstructions);
 }
\ No newline at end of file
@@ -8,13 +8,26 @@
 namespace interpreter {
     using namespace std;
 
+    class ManagedHeap;
+    class StringHeap;
+
+    // Stack slots are 64 bits wide so every integer type and a double fit one.
+    // The 16-bit instructions work on the low 16 bits and sign-extend their
+    // results, doubles are stored as their bits.
     struct InterpreterRegisters {
-        vector<int16_t> _stack;
+        vector<int64_t> _stack;
         vector<Instruction*> _returnAdressStack;
         Instruction* _currInstruction;
         size_t _baseIdx;
+        const int64_t* _constants = nullptr; // what PUSH_CONST indexes
+        size_t _numConstants = 0;
+        ManagedHeap* _heap = nullptr;        // where arrays and strings are made, collected at safepoints
+        StringHeap* _strings = nullptr;      // what string values refer to
     };
 
+    class ExecutionCounters;
+    class TraceRecorder;
+
     typedef void (*InstructionFunc)(InterpreterRegisters& registers);
 
     void ExitInstruction(InterpreterRegisters& registers);
@@ -31,11 +44,49 @@ namespace interpreter {
     void StoreIntBasePointerRelativeInstruction(InterpreterRegisters& registers);
     void CallInstruction(InterpreterRegisters& registers);
     void ReturnInstruction(InterpreterRegisters& registers);
+    void IncIntBasePointerRelativeInstruction(InterpreterRegisters& registers);
+    void AddIntImmediateInstruction(InterpreterRegisters& registers);
+    void JumpByIfNotLessInstruction(InterpreterRegisters& registers);
+    void PopIntNInstruction(InterpreterRegisters& registers);
+    void PushConstInstruction(InterpreterRegisters& registers);
+    void AddInt32Instruction(InterpreterRegisters& registers);
+    void CompareInt32LessInstruction(InterpreterRegisters& registers);
+    void AddInt64Instruction(InterpreterRegisters& registers);
+    void CompareInt64LessInstruction(InterpreterRegisters& registers);
+    void AddDoubleInstruction(InterpreterRegisters& registers);
+    void SubtractDoubleInstruction(InterpreterRegisters& registers);
+    void MultiplyDoubleInstruction(InterpreterRegisters& registers);
+    void DivideDoubleInstruction(InterpreterRegisters& registers);
+    void CompareDoubleLessInstruction(InterpreterRegisters& registers);
+    void IntToDoubleInstruction(InterpreterRegisters& registers);
+    void DoubleToIntInstruction(InterpreterRegisters& registers);
+    void PrintDoubleInstruction(InterpreterRegisters& registers);
+    void NewArrayInstruction(InterpreterRegisters& registers);
+    void ArrayLengthInstruction(InterpreterRegisters& registers);
+    void ArrayLoadIntInstruction(InterpreterRegisters& registers);
+    void ArrayLoadDoubleInstruction(InterpreterRegisters& registers);
+    void ArrayStoreIntInstruction(InterpreterRegisters& registers);
+    void ArrayStoreDoubleInstruction(InterpreterRegisters& registers);
+    void ArrayAddInstruction(InterpreterRegisters& registers);
+    void ArrayMultiplyInstruction(InterpreterRegisters& registers);
+    void ArraySumInstruction(InterpreterRegisters& registers);
+    void ArrayMinInstruction(InterpreterRegisters& registers);
+    void ArrayMaxInstruction(InterpreterRegisters& registers);
+    void ArrayDotInstruction(InterpreterRegisters& registers);
+    void ConcatStringInstruction(InterpreterRegisters& registers);
+    void CompareStringLessInstruction(InterpreterRegisters& registers);
+    void EqualStringInstruction(InterpreterRegisters& registers);
+    void PrintValuesInstruction(InterpreterRegisters& registers);
+    void SaturateInt16Instruction(InterpreterRegisters& registers);
 
     extern InstructionFunc gInstructionFunctions[NUM_INSTRUCTIONS];
+    extern const char* gOpcodeNames[NUM_INSTRUCTIONS];
 
     class Interpreter {
     public:
-        static void Run(Instruction* code, vector<int16_t> args, int16_t* result = nullptr);
+        // With counters, every executed instruction is counted there. With a
+        // recorder, the run's control flow is recorded to its trace.
+        static void Run(Instruction* code, vector<int16_t> args, int16_t* result = nullptr,
+                        ExecutionCounters* counters = nullptr, TraceRecorder* recorder = nullptr);
     };
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Instruction.h"
+#include "OperandStack.h"
+#include "ExecutableMemory.h"
+#include <map>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Baseline template JIT: every instruction becomes a fixed x86-64 sequence
+    // working on the same operand stack layout the interpreters use, so frames,
+    // arguments and results are laid out exactly as for Interpreter::Run.
+    // CALL and RETURN become native call and ret.
+    class JitCode {
+    public:
+        // functionNames, by entry offset, name the code for perf when JitSymbols are current.
+        JitCode(const Instruction* code, size_t numInstructions, const map<size_t, string>& functionNames = {});
+
+        // Machine code for the instruction at offset in the original code.
+        const uint8_t* At(size_t offset) const { return _memory.Data() + _offsets[offset]; }
+        size_t Size() const { return _offsets.size(); }
+        size_t FrameSize(size_t entry) const { return interpreter::FrameSize(_source.data(), _source.size(), entry); }
+
+        // Runs the code at target with sp as the top of stack and the frame just
+        // above it. Returns false if a CALL ran out of stack.
+        bool Enter(int16_t* sp, OperandStack& stack, const uint8_t* target) const;
+
+    private:
+        vector<Instruction> _source;
+        vector<uint32_t> _offsets;
+        ExecutableMemory _memory;
+    };
+
+    class JitExecutor {
+    public:
+        // Same contract as Interpreter::Run, starting at entry.
+        static void Run(const JitCode& code, size_t entry, vector<int16_t> args, int16_t* result = nullptr);
+    };
+}
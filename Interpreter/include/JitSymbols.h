@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ThreadedCode.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Names generated machine code for Linux perf, which otherwise only sees
+    // anonymous addresses. perf report reads /tmp/perf-<pid>.map as is. The
+    // jitdump file also carries the code bytes and load times; perf inject --jit
+    // turns it into code objects perf annotate can disassemble, for recordings
+    // made with perf record -k mono. The JITs describe their code to the
+    // current instance when they finish compiling it.
+    class JitSymbols {
+    public:
+        explicit JitSymbols(bool perfMap = true, bool jitdump = false, const string& jitdumpDirectory = "/tmp");
+        JitSymbols(const JitSymbols&) = delete;
+        JitSymbols& operator=(const JitSymbols&) = delete;
+        ~JitSymbols();
+
+        void AddCode(const string& name, const void* start, size_t size);
+
+        // One symbol per script function in code where the native code of every
+        // instruction starts at nativeOffsets[instruction]. functionNames maps
+        // entry offsets to names, as functionToInstruction does.
+        void AddFunctions(const uint8_t* code, size_t codeSize, const vector<uint32_t>& nativeOffsets,
+                          const map<size_t, string>& functionNames, const string& suffix = "");
+
+        // Labels the opcode handlers of the threaded interpreter, so samples inside
+        // its dispatch loop are attributed per opcode. That code belongs to the
+        // executable, where perf ignores the perf map, so they only go to the
+        // jitdump, whose code objects perf inject maps over it. A handler is taken
+        // to extend to the next one, and the last one isn't labelled.
+        void AddThreadedHandlers(StackCaching caching);
+
+    private:
+        void WriteJitdump(const void* data, size_t size);
+        void WriteCodeLoad(const string& name, const void* start, size_t size);
+
+        mutex _mutex;
+        FILE* _perfMap = nullptr;
+        FILE* _jitdump = nullptr;
+        void* _jitdumpMarker = nullptr; // mapping of the jitdump, how perf record notices it
+        size_t _jitdumpMarkerSize = 0;
+        uint64_t _codeIndex = 0;
+    };
+
+    // Name of the function whose code contains offset, "function@<offset>" before the first one.
+    string FunctionName(const map<size_t, string>& functionNames, size_t offset);
+
+    // The instance every JIT reports to, nullptr while nothing should be written.
+    JitSymbols* CurrentJitSymbols();
+
+    // Makes symbols current, process-wide. Returns the previous instance.
+    JitSymbols* SetJitSymbols(JitSymbols* symbols);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Instruction.h"
+#include "X86Emitter.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Register assignment of all generated code. They are callee-saved in the
+    // System V ABI, so helper calls leave them alone.
+    static constexpr X86Register STACK_POINTER = RBX;   // top of the operand stack
+    static constexpr X86Register FRAME_POINTER = R12;   // first local of the current frame
+    static constexpr X86Register STACK_BASE = R13;      // OperandStack::Base()
+    static constexpr X86Register STACK_LIMIT = R14;     // OperandStack::Limit()
+    static constexpr X86Register HELPER_SAVED_RSP = RBP;
+
+    // Interpreter state for generated code that is entered as
+    // int (*)(JitState* state, ...) and returns the index of the exit it took.
+    struct JitState {
+        int16_t* _sp;
+        int16_t* _fp;
+        int16_t* _base;
+        int16_t* _limit;
+    };
+
+    static constexpr X86Register JIT_STATE = R15;
+
+    constexpr int32_t JitSlot(int32_t index) { return index * int32_t(sizeof(int16_t)); }
+
+    // Pushes and pops rbx, rbp and r12-r15.
+    void EmitSaveCalleeSaved(X86Emitter& emitter);
+    void EmitRestoreCalleeSaved(X86Emitter& emitter);
+
+    // Saves callee-saved registers and loads the stack registers from the JitState in rdi.
+    void EmitLoadState(X86Emitter& emitter);
+
+    // One stub per exit that loads its index into eax, then the common tail that
+    // writes sp and fp back into the JitState and returns. Returns the stubs' offsets.
+    vector<size_t> EmitExitStubs(X86Emitter& emitter, size_t numExits);
+
+    // Emits the template of an instruction that neither jumps, calls nor returns.
+    // Returns false for those.
+    bool EmitStraightLineTemplate(X86Emitter& emitter, const Instruction& instruction);
+
+    // The stack checking and frame switching halves of CALL and RETURN, without
+    // the transfer of control. The check returns the rel32 field of the branch
+    // taken when frameSize slots plus the saved base don't fit.
+    size_t EmitFrameCheck(X86Emitter& emitter, size_t frameSize);
+    void EmitEnterFrame(X86Emitter& emitter);
+    void EmitLeaveFrame(X86Emitter& emitter);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Instruction.h"
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Runs one function for many argument sets at once. Every stack slot is a
+    // vector of NUM_LANES int16_t values, one per instance, so ADD_INT or
+    // COMP_INT_LT is a single AVX2 instruction for all of them. Each lane has
+    // its own program counter. The lanes at the lowest one execute together
+    // under a lane mask, and lanes that took the other way of a branch wait
+    // until the group reaches their instruction. Functions that make calls,
+    // and CPUs without AVX2, fall back to running the instances one by one.
+    class LockstepInterpreter {
+    public:
+        static constexpr size_t NUM_LANES = 16;
+
+        LockstepInterpreter(const Instruction* code, size_t numInstructions, size_t entry);
+
+        // Returns the results in the order of argumentSets, which all have the
+        // same number of arguments. Lanes print in lane order whenever their
+        // group executes PRINT_INT.
+        vector<int16_t> Run(span<const vector<int16_t>> argumentSets);
+
+        bool Vectorized() const { return _vectorized; }
+
+    private:
+        vector<Instruction> _source;
+        size_t _entry;
+        vector<ptrdiff_t> _depths; // operand slots above the frame pointer on entry of each instruction
+        size_t _frameSize;
+        bool _vectorized;
+    };
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Instruction.h"
+#include "StackMaps.h"
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    struct InterpreterRegisters;
+
+    enum class ObjectKind: uint8_t {
+        ARRAY,
+        STRING
+    };
+
+    // Every object of the managed heap starts with one. A slot refers to an
+    // object by its address, so objects are 8-byte aligned, which leaves the
+    // low bits of a reference to tag it, as strings do.
+    struct ObjectHeader {
+        uint64_t _size;   // of the whole object, a multiple of 8; the address of its copy once it moved
+        ObjectKind _kind;
+        uint8_t _flags;   // ManagedHeap's, during a collection
+    };
+
+    struct HeapStatistics {
+        uint64_t _minorCollections = 0;
+        uint64_t _majorCollections = 0;
+        uint64_t _promotedBytes = 0;
+        chrono::nanoseconds _totalPause{0};
+        chrono::nanoseconds _maxPause{0};
+
+        void Print(ostream& out) const;
+    };
+
+    // The arrays and strings of the reference interpreter. Objects are bump
+    // allocated in a nursery. Objects that are still referenced when it fills
+    // up are promoted to the old generation, bump allocated in chunks as well,
+    // so a collection costs what survives, not what was allocated. When the
+    // old generation has doubled since the last major collection, its live
+    // objects are copied into fresh chunks too. Objects too large to copy
+    // cheaply are allocated on their own and belong to the old generation from
+    // the start, a major collection frees them unless they're referenced.
+    //
+    // Objects don't refer to each other, so the roots, the slots of the
+    // interpreter's stack that StackMaps describes, are all there is to trace,
+    // and no write barrier is needed. Collections only happen at safepoints:
+    // a full nursery takes another chunk until the next CALL or loop back-edge
+    // collects. Without stack maps the heap only grows until it's cleared.
+    class ManagedHeap {
+    public:
+        static constexpr size_t CHUNK_SIZE = 256 * 1024; // also the size of the nursery
+        static constexpr size_t MAX_SMALL_OBJECT_SIZE = CHUNK_SIZE / 4;
+        static constexpr size_t MIN_MAJOR_THRESHOLD = 4 * 1024 * 1024;
+        static constexpr size_t MAX_FREE_CHUNKS = 64;
+
+        ManagedHeap() = default;
+        ManagedHeap(const ManagedHeap&) = delete;
+        ManagedHeap& operator=(const ManagedHeap&) = delete;
+
+        // An object of size bytes, the header included, whose header is set.
+        // The rest isn't initialized.
+        ObjectHeader* Allocate(ObjectKind kind, size_t size) {
+            size = (size + 7) & ~size_t(7);
+            if(size > size_t(_nurseryEnd - _nurseryTop))
+                return AllocateSlow(kind, size);
+            auto object = reinterpret_cast<ObjectHeader*>(_nurseryTop);
+            _nurseryTop += size;
+            *object = ObjectHeader{size, kind, 0};
+            return object;
+        }
+
+        // The maps collections find the roots of code in with, offsets relative to code.
+        void SetStackMaps(const StackMaps* maps, const Instruction* code);
+
+        bool CollectionRequested() const { return _collectionRequested; }
+        // Collects at the safepoint registers are at, if it has a stack map,
+        // and updates the references on the stack.
+        void Collect(InterpreterRegisters& registers);
+
+        // Frees every object, which VM does at the start of every run.
+        void Clear();
+
+        // The bytes from address to the end of the chunk or large object it is
+        // in, 0 outside the heap. Values are checked with it before they are
+        // read as objects.
+        size_t BytesFrom(const void* address) const;
+
+        // Of every collection since the heap was made, Clear() keeps them.
+        const HeapStatistics& Statistics() const { return _statistics; }
+        size_t OldBytes() const { return _oldBytes; }
+
+    private:
+        using Chunk = unique_ptr<uint8_t[]>;
+
+        ObjectHeader* AllocateSlow(ObjectKind kind, size_t size);
+        ObjectHeader* AllocateOld(size_t size);
+        Chunk TakeChunk();
+        void RecycleChunk(Chunk chunk);
+
+        bool InNursery(const ObjectHeader* object) const;
+        void EvacuateSlot(int64_t& slot, SlotKind kind, bool major);
+        ObjectHeader* Evacuate(ObjectHeader* object, bool major);
+        void SweepLargeObjects();
+
+        const StackMaps* _maps = nullptr;
+        const Instruction* _code = nullptr;
+
+        vector<Chunk> _nursery; // the first is the nursery proper, the others held what didn't fit until a safepoint
+        uint8_t* _nurseryTop = nullptr;
+        uint8_t* _nurseryEnd = nullptr;
+        vector<Chunk> _old;
+        uint8_t* _oldTop = nullptr;
+        uint8_t* _oldEnd = nullptr;
+        vector<Chunk> _largeObjects;
+        vector<Chunk> _freeChunks;
+        map<const uint8_t*, size_t> _ranges; // the sizes of the chunks and large objects in use, by address
+
+        size_t _oldBytes = 0; // large objects included
+        size_t _majorThreshold = MIN_MAJOR_THRESHOLD;
+        bool _collectionRequested = false;
+        HeapStatistics _statistics;
+    };
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Instruction.h"
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <span>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    struct InterpreterRegisters;
+    class VM;
+
+    // Dynamic frequencies of opcode sequences, used to decide which
+    // superinstructions are worth adding.
+    class OpcodeNgrams {
+    public:
+        explicit OpcodeNgrams(size_t maxLength = 4) : _maxLength(maxLength) {}
+
+        // Runs code from entry like Interpreter::Run does and counts every sequence of 2 to
+        // maxLength opcodes executed back to back. A sequence only counts if its
+        // instructions are adjacent in the code and none but the first is a jump
+        // target, since only those could be fused.
+        void Record(Instruction* code, size_t numInstructions, size_t entry, vector<int16_t> args,
+                    int16_t* result = nullptr);
+        // The same for wide code, like VM::Run with vm's constant pool, strings
+        // and stack maps, in vm's heap.
+        void Record(VM& vm, Instruction* code, size_t numInstructions, size_t entry, span<const int64_t> args,
+                    int64_t* result = nullptr);
+
+        const map<vector<Opcode>, uint64_t>& Counts() const { return _counts; }
+
+        // Prints the most frequent sequences, weighted by the dispatches fusing
+        // them would save.
+        void Print(ostream& out, size_t maxEntries = 20) const;
+
+    private:
+        // Runs from registers, which are set up for a run of code, until it exits.
+        void Record(InterpreterRegisters& registers, Instruction* code, size_t numInstructions);
+
+        size_t _maxLength;
+        map<vector<Opcode>, uint64_t> _counts;
+    };
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Instruction.h"
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    class StackOverflow : public runtime_error {
+    public:
+        StackOverflow() : runtime_error("Interpreter stack overflow") {}
+    };
+
+    // Preallocated contiguous memory for the operand stack and the return-address
+    // stack. Engines keep raw stack and frame pointers into it in locals and check
+    // for overflow once per call frame, never per push.
+    class OperandStack {
+    public:
+        // Saved frame pointers are stored in 16-bit slots as indices from Base().
+        static constexpr size_t MAX_NUM_SLOTS = 32768;
+        static constexpr size_t DEFAULT_NUM_SLOTS = MAX_NUM_SLOTS;
+
+        explicit OperandStack(size_t numSlots = DEFAULT_NUM_SLOTS);
+
+        int16_t* Base() { return _slots.get(); }
+        int16_t* Limit() { return _slots.get() + _numSlots; }
+        size_t NumSlots() const { return _numSlots; }
+
+        // Every frame takes at least one operand slot, so this never runs out first.
+        const void** ReturnAddresses() { return _returnAddresses.get(); }
+
+    private:
+        unique_ptr<int16_t[]> _slots;
+        unique_ptr<const void*[]> _returnAddresses;
+        size_t _numSlots;
+    };
+
+    static constexpr ptrdiff_t UNKNOWN_DEPTH = PTRDIFF_MIN;
+
+    // Fills in the stack depth relative to the frame pointer on entry of every
+    // instruction reachable from entry that is still UNKNOWN_DEPTH in depths.
+    void ComputeStackDepths(const Instruction* code, size_t numInstructions, size_t entry,
+                            vector<ptrdiff_t>& depths);
+
+    // Highest number of operand slots the function starting at entry occupies above
+    // its frame pointer, which is what a call has to reserve before entering it.
+    size_t FrameSize(const Instruction* code, size_t numInstructions, size_t entry);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Longest text FormatInt produces, for a sign and the digits of INT64_MIN.
+    static constexpr size_t MAX_FORMATTED_INT_LENGTH = 20;
+
+    // Writes the decimal text of number to buffer, which needs room for
+    // MAX_FORMATTED_INT_LENGTH characters. Returns the number of characters written.
+    size_t FormatInt(int64_t number, char* buffer);
+
+    // Longest text FormatDouble produces, like -2.2250738585072014e-308.
+    static constexpr size_t MAX_FORMATTED_DOUBLE_LENGTH = 24;
+
+    // The shortest decimal text that reads back as number, for PRINT_DOUBLE.
+    size_t FormatDouble(double number, char* buffer);
+
+    // What PRINT_VALUES prints, two bits per value in p2, the first value lowest.
+    enum class PrintedKind: uint8_t {
+        INT,
+        DOUBLE,
+        STRING
+    };
+
+    static constexpr size_t MAX_PRINTED_VALUES = 8;
+
+    // Where PRINT_INT goes. Every engine prints through the sink that is current
+    // on its thread.
+    class OutputSink {
+    public:
+        virtual ~OutputSink() = default;
+
+        virtual void PrintInt(int64_t number) = 0;
+        virtual void PrintDouble(double number) = 0;
+        // A line PRINT_VALUES formatted, as is.
+        virtual void PrintText(string_view text) = 0;
+        virtual void Flush() {}
+    };
+
+    enum class FlushPolicy: uint8_t {
+        EVERY_PRINT, // each line is visible as soon as it's printed, like endl
+        WHEN_FULL    // only when the buffer fills up, on Flush() and on destruction
+    };
+
+    // Formats "Number printed: <number>\n" into a buffer and writes it to a stream in blocks.
+    class BufferedOutput : public OutputSink {
+    public:
+        explicit BufferedOutput(ostream& stream, FlushPolicy policy = FlushPolicy::WHEN_FULL,
+                                size_t capacity = 64 * 1024);
+        BufferedOutput(const BufferedOutput&) = delete;
+        BufferedOutput& operator=(const BufferedOutput&) = delete;
+        ~BufferedOutput() override;
+
+        void PrintInt(int64_t number) override;
+        void PrintDouble(double number) override;
+        void PrintText(string_view text) override;
+        void Flush() override;
+
+    private:
+
+        ostream& _stream;
+        FlushPolicy _policy;
+        vector<char> _buffer;
+        size_t _used = 0;
+    };
+
+    // Appends the printed values to vectors of the caller's, without formatting
+    // them. Printing a double or text throws without a vector for them.
+    class CollectingOutput : public OutputSink {
+    public:
+        explicit CollectingOutput(vector<int64_t>& values, vector<double>* doubles = nullptr,
+                                  vector<string>* texts = nullptr)
+            : _values(values), _doubles(doubles), _texts(texts) {}
+
+        void PrintInt(int64_t number) override { _values.push_back(number); }
+        void PrintDouble(double number) override;
+        void PrintText(string_view text) override;
+
+    private:
+        vector<int64_t>& _values;
+        vector<double>* _doubles;
+        vector<string>* _texts;
+    };
+
+    // The sink of the calling thread. Until one is set this prints to cout,
+    // flushing each line.
+    OutputSink& CurrentOutput();
+
+    // Makes sink current on the calling thread, or restores the default for
+    // nullptr. Returns the previous sink. The sink must outlive its use.
+    OutputSink* SetOutputSink(OutputSink* sink);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Instruction.h"
+#include <cstddef>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Rewrites the fixed sequences generateCodeForStatement emits into
+    // superinstructions:
+    //   LOAD_INT_BASEPOINTER_RELATIVE a; PUSH_INT k; ADD_INT; STORE_INT_BASEPOINTER_RELATIVE a
+    //       -> INC_INT_BASEPOINTER_RELATIVE a, k   (k fits in int8_t)
+    //   COMP_INT_LT; JUMP_BY_IF_ZERO -> JUMP_BY_IF_NOT_LESS
+    //   PUSH_INT k; ADD_INT -> ADD_INT_IMMEDIATE k
+    //   POP_INT; POP_INT ... -> POP_INT_N
+    // Only the first instruction of a fused sequence may be a jump target. Relative
+    // jumps and calls are re-aimed at the new offsets. If newOffsets is given it
+    // receives the new offset of every old one, plus one past the end, so callers
+    // can move function entry points along.
+    vector<Instruction> OptimizePeephole(const vector<Instruction>& code, vector<size_t>* newOffsets = nullptr);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    enum PerfEvent: uint8_t {
+        PERF_CYCLES,
+        PERF_INSTRUCTIONS,
+        PERF_BRANCH_MISSES,
+        PERF_L1I_MISSES,
+        PERF_L1D_MISSES,
+        NUM_PERF_EVENTS
+    };
+
+    extern const char* gPerfEventNames[NUM_PERF_EVENTS];
+
+    struct PerfCounts {
+        uint64_t _values[NUM_PERF_EVENTS] = {};
+        uint64_t _runs = 0;
+    };
+
+    // An event as read from the kernel, unscaled. While the kernel multiplexes
+    // events, the value only grows in the time it's running.
+    struct PerfReading {
+        uint64_t _value = 0;
+        uint64_t _timeEnabled = 0;
+        uint64_t _timeRunning = 0;
+    };
+
+    // Hardware counters of the calling thread from perf_event_open, in user
+    // mode, attributed to named phases. Events the kernel or CPU doesn't offer,
+    // such as in a VM or with a high perf_event_paranoid, are left out, and
+    // nothing is counted on other systems.
+    class PerfCounters {
+    public:
+        // Counts between its construction and destruction into its phase.
+        class Scope {
+        public:
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+            ~Scope();
+
+        private:
+            friend class PerfCounters;
+            Scope(PerfCounters* counters, PerfCounts* counts);
+
+            PerfCounters* _counters;
+            PerfCounts* _counts;
+            PerfReading _start[NUM_PERF_EVENTS];
+        };
+
+        // Disabled counters open nothing, so their scopes make no system calls. With
+        // dumpAtExit, Print() goes there on destruction.
+        explicit PerfCounters(bool enabled = true, ostream* dumpAtExit = nullptr);
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+        ~PerfCounters();
+
+        bool Available(PerfEvent event) const { return _fds[event] >= 0; }
+
+        // Scopes of one phase add up. Nested phases are counted in both.
+        Scope Measure(const string& phase);
+
+        const map<string, PerfCounts>& Phases() const { return _phases; }
+
+        // One line per phase in the order they were first measured.
+        void Print(ostream& out) const;
+
+    private:
+        void Read(PerfReading readings[NUM_PERF_EVENTS]) const;
+
+        int _fds[NUM_PERF_EVENTS];
+        map<string, PerfCounts> _phases;
+        vector<string> _order;
+        ostream* _dumpAtExit;
+    };
+}
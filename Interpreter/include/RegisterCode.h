@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Instruction.h"
+#include "OperandStack.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Registers are the frame's own stack slots: r[i] is the slot at offset i from
+    // the frame pointer, so locals are r0, r1, ... and parameters are negative
+    // registers, exactly as LOAD_INT_BASEPOINTER_RELATIVE addresses them.
+    enum RegisterOpcode: uint8_t {
+        R_EXIT,
+        R_MOVE,                     // r[a] = r[b]
+        R_LOAD_IMM,                 // r[a] = c
+        R_ADD,                      // r[a] = r[b] + r[c]
+        R_ADD_IMM,                  // r[a] = r[b] + c
+        R_LESS,                     // r[a] = r[b] < r[c]
+        R_LESS_IMM,                 // r[a] = r[b] < c
+        R_PRINT,                    // print r[a]
+        R_LOAD_ABSOLUTE,            // r[a] = stack[c]
+        R_STORE_ABSOLUTE,           // stack[c] = r[a]
+        R_JUMP,                     // ip += c
+        R_JUMP_IF_ZERO,             // if r[a] == 0: ip += c
+        R_JUMP_IF_NOT_LESS,         // if !(r[a] < r[b]): ip += c
+        R_JUMP_IF_NOT_LESS_IMM,     // if !(r[a] < b): ip += c
+        R_CALL,                     // save the frame in r[a], callee frame size b, ip += c
+        R_RETURN,
+        NUM_REGISTER_INSTRUCTIONS
+    };
+
+    class RegisterInstruction {
+    public:
+        RegisterOpcode _opcode;
+        int16_t a;
+        int16_t b;
+        int16_t c;
+    };
+
+    class RegisterCode {
+    public:
+        // Translates stack code into register code. Values only move between
+        // registers when a statement needs them to, so LOAD/PUSH/ADD/STORE runs
+        // collapse into single instructions.
+        RegisterCode(const Instruction* code, size_t numInstructions);
+
+        // Register instruction for the instruction at offset in the original code.
+        const RegisterInstruction* At(size_t offset) const { return _instructions.data() + _indexOf[offset]; }
+        size_t Size() const { return _indexOf.size(); }
+        size_t FrameSize(size_t entry) const { return interpreter::FrameSize(_source.data(), _source.size(), entry); }
+
+        const vector<RegisterInstruction>& Instructions() const { return _instructions; }
+
+    private:
+        vector<Instruction> _source;
+        vector<uint32_t> _indexOf;
+        vector<RegisterInstruction> _instructions;
+    };
+
+    class RegisterInterpreter {
+    public:
+        static void Run(const RegisterCode& code, size_t entry, vector<int16_t> args, int16_t* result = nullptr);
+    };
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Instruction.h"
+#include "SourceLineTable.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <map>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Samples which instruction the reference interpreter is at, from a SIGPROF
+    // handler driven by a CPU-time timer. The handler reads the instruction
+    // pointer the VM keeps in memory anyway, so the dispatch loop does no work
+    // for it. Only one profiler can sample at a time.
+    class SamplingProfiler {
+    public:
+        SamplingProfiler(const Instruction* code, size_t codeSize,
+                         chrono::microseconds interval = chrono::microseconds(1000));
+        SamplingProfiler(const SamplingProfiler&) = delete;
+        SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+        ~SamplingProfiler();
+
+        // Samples the CPU time of the calling thread on Linux, of the whole process elsewhere.
+        void Start();
+        void Stop();
+
+        // The instruction pointer samples read, nullptr when no script runs. Set by VM.
+        void Watch(Instruction* const* instructionPointer) {
+            _watched.store(instructionPointer, memory_order_release);
+        }
+
+        uint64_t Samples() const;
+        // Samples taken while no instruction of code was running.
+        uint64_t OtherSamples() const { return _otherSamples.load(memory_order_relaxed); }
+        // Samples by instruction offset.
+        vector<uint64_t> Hits() const;
+        map<uint32_t, uint64_t> HitsByLine(const SourceLineTable& lines) const;
+
+        // The hottest lines, with their text from source.
+        void Print(ostream& out, const SourceLineTable& lines, string_view source, size_t maxLines = 20) const;
+
+    private:
+        static void OnSample(int);
+
+        const Instruction* _code;
+        chrono::microseconds _interval;
+        vector<atomic<uint64_t>> _hits;
+        atomic<uint64_t> _otherSamples = 0;
+        atomic<Instruction* const volatile*> _watched = nullptr;
+        bool _running = false;
+#if defined(__linux__)
+        timer_t _timer{};
+#endif
+    };
+}
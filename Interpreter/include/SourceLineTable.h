@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Maps instruction offsets to the source lines they were generated from.
+    // Only the offsets where the line changes are stored, and nothing of it is
+    // consulted while code runs.
+    class SourceLineTable {
+    public:
+        // The instructions from offset on come from line, up to the next mark.
+        // Offsets have to be marked in increasing order, a later mark of the
+        // same offset replaces the earlier one.
+        void Mark(size_t offset, uint32_t line);
+
+        // 0 for offsets before the first mark.
+        uint32_t LineAt(size_t offset) const;
+
+        size_t NumEntries() const { return _entries.size(); }
+
+    private:
+        struct Entry {
+            uint32_t _offset;
+            uint32_t _line;
+        };
+
+        vector<Entry> _entries;
+    };
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Instruction.h"
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // What a slot of the reference interpreter's stack holds, for the garbage
+    // collector. A zeroed ARRAY slot refers to no array, a STRING slot only
+    // refers to the heap when Strings.h says so.
+    enum class SlotKind: uint8_t {
+        VALUE,
+        ARRAY,
+        STRING
+    };
+
+    // The slots of a frame at a safepoint, relative to its base pointer. The
+    // frame is every slot from there up to the top of the stack, or up to the
+    // saved base slot of the frame it called.
+    struct StackMap {
+        size_t _frameSize;
+        vector<pair<uint32_t, SlotKind>> _references;
+    };
+
+    // What a call leaves in the slot the caller reserved for the result.
+    struct CalleeShape {
+        size_t _numParameterSlots;
+        bool _returnsSmth;
+        SlotKind _result;
+    };
+
+    // Stack maps for the safepoints of a program, the instructions the reference
+    // interpreter may collect at: every CALL, where the caller's frame is
+    // described for as long as the callee runs, and every backward JUMP_BY, so
+    // a loop that only allocates still gets to collect.
+    class StackMaps {
+    public:
+        // Derives the maps of the function starting at entry from its code,
+        // following every path with the kind of every slot of the frame. The
+        // parameters are the kinds of its parameter slots, callees the shapes
+        // of the functions it may call, by their entry.
+        void AddFunction(const Instruction* code, size_t numInstructions, size_t entry,
+                         const vector<SlotKind>& parameters, const map<size_t, CalleeShape>& callees);
+
+        // The map of the safepoint at offset, nullptr if it isn't one.
+        const StackMap* At(size_t offset) const {
+            auto found = _maps.find(offset);
+            return found == _maps.end() ? nullptr : &found->second;
+        }
+
+        // Moves the maps along with the code, newOffsets as OptimizePeephole fills it in.
+        void Relocate(const vector<size_t>& newOffsets);
+
+        size_t Size() const { return _maps.size(); }
+
+    private:
+        unordered_map<size_t, StackMap> _maps;
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ManagedHeap.h"
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace interpreter {
+    using namespace std;
+
+    // A string is a value of one slot. Up to MAX_INLINE_STRING_LENGTH bytes are
+    // held in the value itself: its lowest byte is twice the length and the
+    // text follows, zero padded, so a zeroed slot is the empty string and equal
+    // short strings are equal values. Longer ones have the lowest bit set and
+    // refer by index to an interned literal of the program's StringPool, or,
+    // with the next bit set as well, are the address of a string a run made,
+    // an object of the managed heap.
+    static constexpr size_t MAX_INLINE_STRING_LENGTH = 7;
+
+    static_assert(endian::native == endian::little, "Inline strings follow the length byte in memory");
+
+    int64_t InlineString(string_view text);
+
+    inline bool IsInlineString(int64_t value) {
+        return (value & 1) == 0;
+    }
+
+    // The literals of a program, each stored once. PUSH_CONST pushes their values.
+    class StringPool {
+    public:
+        // The value of text, interned unless it fits inline.
+        int64_t Add(string_view text);
+
+        string_view At(size_t index) const { return _strings[index]; }
+        size_t Size() const { return _strings.size(); }
+
+    private:
+        deque<string> _strings; // a deque doesn't move what views refer to
+        unordered_map<string_view, int64_t> _values;
+    };
+
+    // The strings the reference interpreter makes while running, like the
+    // results of CONCAT_STRING, and the way to read any string value. They
+    // are allocated in a ManagedHeap, whose collections move them.
+    class StringHeap {
+    public:
+        explicit StringHeap(ManagedHeap& heap) : _heap(heap) {}
+
+        // The pool the values of literals refer to. It must outlive the heap's use.
+        void SetPool(const StringPool* pool) { _pool = pool; }
+
+        // The value of text, stored in the heap unless it fits inline.
+        int64_t Make(string_view text);
+        int64_t Concatenate(int64_t first, int64_t second);
+
+        // The text of value. An inline string is read from value itself, which
+        // has to outlive the view. Throws for a value that isn't a string.
+        string_view View(const int64_t& value) const;
+
+        bool Equal(int64_t first, int64_t second) const;
+
+    private:
+        // Room for length bytes of text, which the caller fills in.
+        int64_t Allocate(size_t length, char*& text);
+
+        ManagedHeap& _heap;
+        const StringPool* _pool = nullptr;
+    };
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Instruction.h"
+#include "OperandStack.h"
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // One pre-decoded instruction: the address of its handler inside the
+    // threaded dispatch loop plus its operands, already unpacked. With stack
+    // caching the translator may add instructions that only spill the cache.
+    struct ThreadedInstruction {
+        const void* _handler;
+        const ThreadedInstruction* _target; // destination of JUMP_BY, JUMP_BY_IF_ZERO and CALL
+        int16_t _operand;
+        Opcode _opcode;
+        uint8_t _p1;
+        uint32_t _frameSize; // CALL only: operand slots the callee's frame can occupy
+    };
+
+    enum class StackCaching {
+        NONE,
+        TOP_OF_STACK    // up to two top stack values stay in registers across dispatches
+    };
+
+    // Cache states of the TOP_OF_STACK handlers: empty, top value, top two values.
+    static constexpr int NUM_CACHE_STATES = 3;
+
+    class ThreadedCode {
+    public:
+        ThreadedCode(const Instruction* code, size_t numInstructions,
+                     StackCaching caching = StackCaching::NONE);
+
+        // Decoded instruction for the instruction at offset in the original code.
+        const ThreadedInstruction* At(size_t offset) const { return _instructions.data() + _indexOf[offset]; }
+        size_t Size() const { return _indexOf.size(); }
+        StackCaching Caching() const { return _caching; }
+
+        // Looked up for offset 0 and call targets, computed for other entry points.
+        size_t FrameSize(size_t entry) const;
+
+    private:
+        StackCaching _caching;
+        vector<Instruction> _source;
+        vector<uint32_t> _indexOf;
+        vector<ThreadedInstruction> _instructions;
+        map<size_t, uint32_t> _frameSizes;
+    };
+
+    class ThreadedInterpreter {
+    public:
+        static void Run(const ThreadedCode& code, size_t entry, vector<int16_t> args, int16_t* result = nullptr);
+        // Runs on a stack the caller keeps between runs.
+        static void Run(const ThreadedCode& code, size_t entry, span<const int16_t> args, OperandStack& stack,
+                        int16_t* result = nullptr);
+
+        static const void* const* HandlerTable(StackCaching caching);
+        static size_t NumHandlers(StackCaching caching);
+        // Opcode name of a handler, with its cache state when caching.
+        static string HandlerName(StackCaching caching, size_t handler);
+    };
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Instruction.h"
+#include "OperandStack.h"
+#include "ExecutableMemory.h"
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    struct JitState;
+
+    enum class Tier: uint8_t {
+        INTERPRETER,        // profiles calls, loop iterations and branch directions
+        OPTIMIZED_BYTECODE, // peephole optimized code, same interpreter loop
+        NATIVE              // templates of the optimized code, speculating on branches that never went one way
+    };
+
+    struct TieringPolicy {
+        // Calls plus loop iterations after which a function moves up a tier.
+        uint32_t _optimizedBytecodeThreshold = 2;
+        uint32_t _nativeThreshold = 1000;
+        // Native code stops speculating after this many failed assumptions.
+        uint32_t _maxDeoptimizations = 4;
+        // Lets a hot loop move its running frame up a tier at the back-edge
+        // instead of waiting for the next call of the function.
+        bool _onStackReplacement = true;
+    };
+
+    // Runs every function in the cheapest tier that suits how hot it is. All
+    // tiers use the same frame layout on one operand stack and call and return
+    // through the manager, which keeps return addresses as bytecode offsets, so a
+    // function can change tiers while it has activations on the stack, and a hot
+    // loop can continue its running frame in the next tier from the loop header
+    // (on-stack replacement). When an assumption of native code fails, it is
+    // thrown away and the function resumes in the interpreter at the equivalent
+    // bytecode offset.
+    class TieredExecution {
+    public:
+        // functionStarts are the entry points of all functions, as in functionToInstruction.
+        // functionNames, by entry offset, name native code for perf when JitSymbols are current.
+        TieredExecution(const Instruction* code, size_t numInstructions, const vector<size_t>& functionStarts,
+                        TieringPolicy policy = TieringPolicy(), map<size_t, string> functionNames = {});
+        ~TieredExecution();
+
+        // Same contract as Interpreter::Run, starting at entry.
+        void Run(size_t entry, vector<int16_t> args, int16_t* result = nullptr);
+
+        Tier TierOf(size_t functionStart) const;
+        uint32_t Deoptimizations(size_t functionStart) const;
+
+    private:
+        enum class TransferKind: uint8_t { CALL, RETURN, EXIT, DEOPTIMIZE, OVERFLOW, ON_STACK_REPLACEMENT };
+
+        // Why a tier handed control back, and the bytecode offset it concerns.
+        struct Transfer {
+            TransferKind _kind;
+            size_t _offset;
+        };
+
+        struct BranchProfile {
+            uint64_t _jumped = 0;
+            uint64_t _fellThrough = 0;
+        };
+
+        struct NativeFunction;
+
+        struct Function {
+            size_t _start;
+            size_t _end;
+            size_t _frameSize;
+            Tier _tier = Tier::INTERPRETER;
+            uint64_t _calls = 0;
+            uint64_t _loopIterations = 0;
+            uint32_t _deoptimizations = 0;
+            bool _compilable = true;
+            unique_ptr<NativeFunction> _native;
+        };
+
+        void Enter(Function& function);
+        void TierUp(Function& function);
+        void Deoptimize(Function& function);
+        Transfer Interpret(Function& function, size_t offset, JitState& state);
+        Transfer RunNative(Function& function, size_t offset, JitState& state);
+        bool CompileNative(Function& function);
+        const Function& FunctionStartingAt(size_t functionStart) const;
+
+        vector<Instruction> _source;
+        TieringPolicy _policy;
+        vector<Function> _functions;
+        vector<uint32_t> _functionAt;          // function index by offset
+        vector<BranchProfile> _branchProfiles; // by offset of the conditional jump
+
+        // Peephole optimized code of the whole program, built when the first
+        // function reaches that tier, and offset maps in both directions.
+        vector<Instruction> _optimized;
+        vector<size_t> _optimizedOffsets;
+        vector<size_t> _sourceOffsets;
+
+        map<size_t, string> _functionNames;
+    };
+}
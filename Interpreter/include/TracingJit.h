@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Instruction.h"
+#include "OperandStack.h"
+#include "ExecutableMemory.h"
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // Interprets code and counts how often every backward JUMP_BY, the back-edge
+    // of a WHILE_LOOP, is taken. Once a loop header gets hot, the instructions of
+    // the next iteration are recorded, with calls inlined, and compiled to a
+    // native loop. Every conditional jump in the trace becomes a guard that leaves
+    // it, back into the interpreter, if it goes the other way than recorded.
+    // Traces survive between runs.
+    class TracingJit {
+    public:
+        static constexpr uint32_t DEFAULT_HOT_LOOP_THRESHOLD = 50;
+        static constexpr size_t MAX_TRACE_LENGTH = 1024;
+
+        // functionNames, by entry offset, name traces for perf when JitSymbols are current.
+        TracingJit(const Instruction* code, size_t numInstructions,
+                   uint32_t hotLoopThreshold = DEFAULT_HOT_LOOP_THRESHOLD,
+                   map<size_t, string> functionNames = {});
+        ~TracingJit();
+
+        // Same contract as Interpreter::Run, starting at entry.
+        void Run(size_t entry, vector<int16_t> args, int16_t* result = nullptr);
+
+        size_t NumTraces() const { return _numTraces; }
+
+    private:
+        struct TraceStep {
+            size_t _offset;
+            bool _jumped; // for conditional jumps, whether the jump was taken
+        };
+        struct Trace;
+
+        bool CompileTrace(size_t header, const vector<TraceStep>& steps);
+        size_t CalleeFrameSize(size_t target);
+
+        vector<Instruction> _source;
+        uint32_t _hotLoopThreshold;
+        vector<uint32_t> _backEdgeCounts;   // by loop header
+        vector<bool> _blacklisted;          // loop headers whose recording failed
+        vector<size_t> _frameSizes;         // by call target, SIZE_MAX until needed
+        vector<unique_ptr<Trace>> _traces;  // by loop header
+        size_t _numTraces = 0;
+        map<size_t, string> _functionNames;
+    };
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Instruction.h"
+#include "Interpreter.h"
+#include "ExecutionCounters.h"
+#include "CallProfiler.h"
+#include "SamplingProfiler.h"
+#include "ExecutionTrace.h"
+#include "ConstantPool.h"
+#include "Arrays.h"
+#include "Strings.h"
+#include "ManagedHeap.h"
+#include "StackMaps.h"
+#include "OperandStack.h"
+#include "ThreadedCode.h"
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <span>
+
+namespace interpreter {
+    using namespace std;
+
+    // A long-lived interpreter instance for calling script functions many times.
+    // Its stacks stay allocated between invocations, arguments are read in place
+    // and results come back by value, so an invocation doesn't allocate.
+    class VM {
+    public:
+        // Capacity reserved up front for the reference interpreter's stacks.
+        explicit VM(size_t reservedSlots = 1024, size_t reservedCallDepth = 64);
+
+        // Same as Interpreter::Run and ThreadedInterpreter::Run, returning the
+        // result slot of the called function.
+        int16_t Call(Instruction* code, span<const int16_t> args);
+        int16_t Call(const ThreadedCode& code, size_t entry, span<const int16_t> args);
+
+        // For code that doesn't reserve a result slot.
+        void Run(Instruction* code, span<const int16_t> args, int16_t* result = nullptr);
+        void Run(const ThreadedCode& code, size_t entry, span<const int16_t> args, int16_t* result = nullptr);
+
+        // The reference interpreter with 64-bit arguments and result, for code
+        // using the wide integer instructions. The 16-bit overloads above
+        // truncate the result slot.
+        int64_t Call(Instruction* code, span<const int64_t> args);
+        void Run(Instruction* code, span<const int64_t> args, int64_t* result = nullptr);
+
+        // Counts what later runs of the reference interpreter execute, or stops counting for nullptr.
+        void SetCounters(ExecutionCounters* counters) { _counters = counters; }
+        // Same for the call profiler, whose code has to contain the code later runs start in.
+        void SetProfiler(CallProfiler* profiler) { _profiler = profiler; }
+        // Lets the sampling profiler see where later runs of the reference interpreter are.
+        void SetSampler(SamplingProfiler* sampler) { _sampler = sampler; }
+        // Records the control flow of later runs of the reference interpreter.
+        void SetRecorder(TraceRecorder* recorder) { _recorder = recorder; }
+        // The pool PUSH_CONST reads in later runs of the reference interpreter. It must outlive them.
+        void SetConstants(const ConstantPool* constants) { _constants = constants; }
+        const ConstantPool* Constants() const { return _constants; }
+        // The literals the string values of those constants refer to. It must outlive later runs too.
+        void SetStrings(const StringPool* strings) { _strings.SetPool(strings); }
+        // The stack maps of the code later runs of the reference interpreter start
+        // in, code being what their offsets are relative to. Without them the
+        // heap never collects during a run. They must outlive later runs too.
+        void SetStackMaps(const StackMaps* maps, const Instruction* code) { _heap.SetStackMaps(maps, code); }
+
+        // The arrays and strings of the last run of the reference interpreter,
+        // for reading one it returned, see ArrayAt. Every run starts with an empty heap.
+        ManagedHeap& Heap() { return _heap; }
+        // The way to read a string value it returned.
+        StringHeap& Strings() { return _strings; }
+
+    private:
+        template<typename Value>
+        void Run(Instruction* code, span<const Value> args, bool withResult);
+
+        InterpreterRegisters _registers;
+        ExecutionCounters* _counters = nullptr;
+        CallProfiler* _profiler = nullptr;
+        SamplingProfiler* _sampler = nullptr;
+        TraceRecorder* _recorder = nullptr;
+        const ConstantPool* _constants = nullptr;
+        ManagedHeap _heap;
+        StringHeap _strings{_heap};
+        unique_ptr<OperandStack> _operandStack; // created by the first threaded run
+    };
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    // A fixed set of worker threads. Each has its own deque of index ranges. It
+    // takes work from the back of its own deque, and once that is empty it
+    // steals from the front of the others', so uneven tasks still keep every
+    // core busy.
+    class WorkStealingPool {
+    public:
+        // Zero workers means one per hardware thread.
+        explicit WorkStealingPool(size_t numWorkers = 0);
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+        ~WorkStealingPool();
+
+        size_t NumWorkers() const { return _workers.size(); }
+
+        // Calls body(index, worker) for every index below count and returns when
+        // all calls are done. worker identifies the calling worker, below
+        // NumWorkers(). Rethrows the first exception a call threw.
+        void ParallelFor(size_t count, const function<void(size_t index, size_t worker)>& body);
+
+    private:
+        // Ranges per worker a ParallelFor is split into, so there is something left to steal.
+        static constexpr size_t RANGES_PER_WORKER = 8;
+
+        struct Worker {
+            mutex _mutex;
+            deque<pair<size_t, size_t>> _ranges;
+            thread _thread;
+        };
+
+        void WorkerLoop(size_t worker);
+        bool TakeRange(size_t worker, pair<size_t, size_t>& range);
+
+        vector<unique_ptr<Worker>> _workers;
+        mutex _parallelForMutex; // one ParallelFor at a time
+        mutex _mutex;
+        condition_variable _wake;
+        condition_variable _done;
+        const function<void(size_t, size_t)>* _body = nullptr;
+        atomic<size_t> _remainingRanges = 0;
+        uint64_t _generation = 0;
+        bool _stopping = false;
+        exception_ptr _error;
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace interpreter {
+    using namespace std;
+
+    enum X86Register: uint8_t {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    enum X86Condition: uint8_t {
+        BELOW = 0x2,
+        EQUAL = 0x4,
+        NOT_EQUAL = 0x5,
+        LESS = 0xC,
+        NOT_LESS = 0xD,
+    };
+
+    // Just enough of an x86-64 assembler for the JITs. Memory operands are always
+    // [base + disp32]; 16-bit forms operate on stack slots, 64-bit forms on pointers.
+    class X86Emitter {
+    public:
+        size_t Size() const { return _bytes.size(); }
+        const vector<uint8_t>& Bytes() const { return _bytes; }
+
+        void LoadInt16(X86Register dst, X86Register base, int32_t disp);           // mov dst16, [base + disp]
+        void LoadSignExtendInt16(X86Register dst, X86Register base, int32_t disp); // movsx dst64, word [base + disp]
+        void StoreInt16(X86Register base, int32_t disp, X86Register src);          // mov [base + disp], src16
+        void StoreImmediateInt16(X86Register base, int32_t disp, int16_t value);   // mov word [base + disp], value
+        void AddInt16(X86Register base, int32_t disp, X86Register src);            // add [base + disp], src16
+        void AddImmediateInt16(X86Register base, int32_t disp, int16_t value);     // add word [base + disp], value
+        void CompareInt16(X86Register lhs, X86Register base, int32_t disp);        // cmp lhs16, [base + disp]
+        void TestInt16(X86Register reg);                                           // test reg16, reg16
+        void SetLessZeroExtend(X86Register reg);                                   // setl reg8; movzx reg32, reg8
+
+        void Move(X86Register dst, X86Register src);                               // mov dst, src
+        void MoveImmediate(X86Register dst, uint64_t value);                       // mov dst, value
+        void MoveImmediate32(X86Register dst, uint32_t value);                     // mov dst32, value
+        void Load(X86Register dst, X86Register base, int32_t disp);                // mov dst, [base + disp]
+        void Store(X86Register base, int32_t disp, X86Register src);               // mov [base + disp], src
+        void LoadEffectiveAddress(X86Register dst, X86Register base, int32_t disp);
+        void LoadEffectiveAddress(X86Register dst, X86Register base, X86Register index, uint8_t scale);
+        void Add(X86Register dst, X86Register src);
+        void Sub(X86Register dst, X86Register src);
+        void AddImmediate(X86Register dst, int32_t value);
+        void SubImmediate(X86Register dst, int32_t value);
+        void AndImmediate(X86Register dst, int32_t value);
+        void CompareImmediate(X86Register lhs, int32_t value);
+        void ShiftRightArithmetic(X86Register reg, uint8_t count);
+        void Xor32(X86Register dst, X86Register src);
+
+        void Push(X86Register reg);
+        void Pop(X86Register reg);
+        void Return();
+        void CallIndirect(X86Register reg);
+        void JumpIndirect(X86Register reg);
+
+        // Relative jumps and calls. They return the offset of their rel32 field,
+        // which PatchRelative points at the target once it is known.
+        size_t Jump();
+        size_t JumpIf(X86Condition condition);
+        size_t Call();
+        void PatchRelative(size_t field, size_t target);
+
+    private:
+        void Emit(uint8_t byte) { _bytes.push_back(byte); }
+        void Emit16(uint16_t value);
+        void Emit32(uint32_t value);
+        void Rex(bool wide, uint8_t reg, uint8_t base, bool force = false);
+        void MemoryOperand(uint8_t reg, X86Register base, int32_t disp);
+        void RegisterOperand(uint8_t reg, X86Register rm);
+        void ArithmeticImmediate(uint8_t extension, X86Register dst, int32_t value);
+
+        vector<uint8_t> _bytes;
+    };
+}
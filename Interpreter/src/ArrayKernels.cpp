@@ -0,0 +1,229 @@
+#include "../include/ArrayKernels.h"
+#include <algorithm>
+#include <immintrin.h>
+
+#define KERNEL_TARGET __attribute__((target("avx2")))
+
+namespace interpreter::kernels {
+
+    using namespace std;
+
+    // Static initialization may come before the runtime's own CPU detection.
+    static const bool gHasAvx2 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+
+    bool UsesAvx2() {
+        return gHasAvx2;
+    }
+
+    // Every AVX2 kernel handles whole vectors and leaves the rest to the plain loop.
+
+    KERNEL_TARGET static size_t AddAvx2(const int32_t* a, const int32_t* b, int32_t* out, size_t length) {
+        size_t x = 0;
+        for(; x + 8 <= length; x += 8) {
+            __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(a + x)),
+                                           _mm256_loadu_si256((const __m256i*)(b + x)));
+            _mm256_storeu_si256((__m256i*)(out + x), sum);
+        }
+        return x;
+    }
+
+    KERNEL_TARGET static size_t AddAvx2(const double* a, const double* b, double* out, size_t length) {
+        size_t x = 0;
+        for(; x + 4 <= length; x += 4)
+            _mm256_storeu_pd(out + x, _mm256_add_pd(_mm256_loadu_pd(a + x), _mm256_loadu_pd(b + x)));
+        return x;
+    }
+
+    KERNEL_TARGET static size_t MultiplyAvx2(const int32_t* a, const int32_t* b, int32_t* out, size_t length) {
+        size_t x = 0;
+        for(; x + 8 <= length; x += 8) {
+            __m256i product = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(a + x)),
+                                                 _mm256_loadu_si256((const __m256i*)(b + x)));
+            _mm256_storeu_si256((__m256i*)(out + x), product);
+        }
+        return x;
+    }
+
+    KERNEL_TARGET static size_t MultiplyAvx2(const double* a, const double* b, double* out, size_t length) {
+        size_t x = 0;
+        for(; x + 4 <= length; x += 4)
+            _mm256_storeu_pd(out + x, _mm256_mul_pd(_mm256_loadu_pd(a + x), _mm256_loadu_pd(b + x)));
+        return x;
+    }
+
+    KERNEL_TARGET static int64_t HorizontalSum(__m256i sums) {
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        return _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+    }
+
+    KERNEL_TARGET static double HorizontalSum(__m256d sums) {
+        __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sums), _mm256_extractf128_pd(sums, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    }
+
+    // The elements are sign-extended to 64 bits four at a time.
+    KERNEL_TARGET static size_t SumAvx2(const int32_t* values, size_t length, int64_t& sum) {
+        __m256i sums = _mm256_setzero_si256();
+        size_t x = 0;
+        for(; x + 4 <= length; x += 4)
+            sums = _mm256_add_epi64(sums, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(values + x))));
+        sum = HorizontalSum(sums);
+        return x;
+    }
+
+    KERNEL_TARGET static size_t SumAvx2(const double* values, size_t length, double& sum) {
+        __m256d sums = _mm256_setzero_pd();
+        size_t x = 0;
+        for(; x + 4 <= length; x += 4)
+            sums = _mm256_add_pd(sums, _mm256_loadu_pd(values + x));
+        sum = HorizontalSum(sums);
+        return x;
+    }
+
+    KERNEL_TARGET static size_t MinMaxAvx2(const int32_t* values, size_t length, bool max, int32_t& result) {
+        if(length < 8)
+            return 0;
+        __m256i extremes = _mm256_loadu_si256((const __m256i*)values);
+        size_t x = 8;
+        for(; x + 8 <= length; x += 8) {
+            __m256i next = _mm256_loadu_si256((const __m256i*)(values + x));
+            extremes = max ? _mm256_max_epi32(extremes, next) : _mm256_min_epi32(extremes, next);
+        }
+        alignas(32) int32_t lanes[8];
+        _mm256_store_si256((__m256i*)lanes, extremes);
+        result = max ? *max_element(lanes, lanes + 8) : *min_element(lanes, lanes + 8);
+        return x;
+    }
+
+    KERNEL_TARGET static size_t MinMaxAvx2(const double* values, size_t length, bool max, double& result) {
+        if(length < 4)
+            return 0;
+        __m256d extremes = _mm256_loadu_pd(values);
+        size_t x = 4;
+        for(; x + 4 <= length; x += 4) {
+            __m256d next = _mm256_loadu_pd(values + x);
+            extremes = max ? _mm256_max_pd(extremes, next) : _mm256_min_pd(extremes, next);
+        }
+        alignas(32) double lanes[4];
+        _mm256_store_pd(lanes, extremes);
+        result = lanes[0];
+        for(size_t lane = 1; lane < 4; ++lane)
+            result = max ? (result > lanes[lane] ? result : lanes[lane]) : (result < lanes[lane] ? result : lanes[lane]);
+        return x;
+    }
+
+    // _mm256_mul_epi32 multiplies the low halves of the 64-bit lanes, which hold the sign-extended elements.
+    KERNEL_TARGET static size_t DotAvx2(const int32_t* a, const int32_t* b, size_t length, int64_t& dot) {
+        __m256i sums = _mm256_setzero_si256();
+        size_t x = 0;
+        for(; x + 4 <= length; x += 4) {
+            __m256i left = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(a + x)));
+            __m256i right = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(b + x)));
+            sums = _mm256_add_epi64(sums, _mm256_mul_epi32(left, right));
+        }
+        dot = HorizontalSum(sums);
+        return x;
+    }
+
+    KERNEL_TARGET static size_t DotAvx2(const double* a, const double* b, size_t length, double& dot) {
+        __m256d sums = _mm256_setzero_pd();
+        size_t x = 0;
+        for(; x + 4 <= length; x += 4)
+            sums = _mm256_add_pd(sums, _mm256_mul_pd(_mm256_loadu_pd(a + x), _mm256_loadu_pd(b + x)));
+        dot = HorizontalSum(sums);
+        return x;
+    }
+
+    void Add(const int32_t* a, const int32_t* b, int32_t* out, size_t length) {
+        size_t x = gHasAvx2 ? AddAvx2(a, b, out, length) : 0;
+        for(; x < length; ++x)
+            out[x] = int32_t(uint32_t(a[x]) + uint32_t(b[x]));
+    }
+
+    void Add(const double* a, const double* b, double* out, size_t length) {
+        size_t x = gHasAvx2 ? AddAvx2(a, b, out, length) : 0;
+        for(; x < length; ++x)
+            out[x] = a[x] + b[x];
+    }
+
+    void Multiply(const int32_t* a, const int32_t* b, int32_t* out, size_t length) {
+        size_t x = gHasAvx2 ? MultiplyAvx2(a, b, out, length) : 0;
+        for(; x < length; ++x)
+            out[x] = int32_t(uint32_t(a[x]) * uint32_t(b[x]));
+    }
+
+    void Multiply(const double* a, const double* b, double* out, size_t length) {
+        size_t x = gHasAvx2 ? MultiplyAvx2(a, b, out, length) : 0;
+        for(; x < length; ++x)
+            out[x] = a[x] * b[x];
+    }
+
+    int64_t Sum(const int32_t* values, size_t length) {
+        int64_t sum = 0;
+        size_t x = gHasAvx2 ? SumAvx2(values, length, sum) : 0;
+        for(; x < length; ++x)
+            sum += values[x];
+        return sum;
+    }
+
+    double Sum(const double* values, size_t length) {
+        double sum = 0;
+        size_t x = gHasAvx2 ? SumAvx2(values, length, sum) : 0;
+        for(; x < length; ++x)
+            sum += values[x];
+        return sum;
+    }
+
+    int32_t Min(const int32_t* values, size_t length) {
+        int32_t result = values[0];
+        size_t x = gHasAvx2 ? MinMaxAvx2(values, length, false, result) : 0;
+        for(; x < length; ++x)
+            result = min(result, values[x]);
+        return result;
+    }
+
+    // Like _mm256_min_pd, the second operand wins when either is NaN.
+    double Min(const double* values, size_t length) {
+        double result = values[0];
+        size_t x = gHasAvx2 ? MinMaxAvx2(values, length, false, result) : 0;
+        for(; x < length; ++x)
+            result = result < values[x] ? result : values[x];
+        return result;
+    }
+
+    int32_t Max(const int32_t* values, size_t length) {
+        int32_t result = values[0];
+        size_t x = gHasAvx2 ? MinMaxAvx2(values, length, true, result) : 0;
+        for(; x < length; ++x)
+            result = max(result, values[x]);
+        return result;
+    }
+
+    double Max(const double* values, size_t length) {
+        double result = values[0];
+        size_t x = gHasAvx2 ? MinMaxAvx2(values, length, true, result) : 0;
+        for(; x < length; ++x)
+            result = result > values[x] ? result : values[x];
+        return result;
+    }
+
+    int64_t Dot(const int32_t* a, const int32_t* b, size_t length) {
+        int64_t dot = 0;
+        size_t x = gHasAvx2 ? DotAvx2(a, b, length, dot) : 0;
+        for(; x < length; ++x)
+            dot += int64_t(a[x]) * b[x];
+        return dot;
+    }
+
+    double Dot(const double* a, const double* b, size_t length) {
+        double dot = 0;
+        size_t x = gHasAvx2 ? DotAvx2(a, b, length, dot) : 0;
+        for(; x < length; ++x)
+            dot += a[x] * b[x];
+        return dot;
+    }
+
+}
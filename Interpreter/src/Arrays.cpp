@@ -0,0 +1,37 @@
+#include "../include/Arrays.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace interpreter {
+
+    using namespace std;
+
+    int64_t NewArray(ManagedHeap& heap, ElementType type, int64_t length) {
+        if(length < 0 || uint64_t(length) > MAX_ARRAY_LENGTH)
+            throw runtime_error("Invalid array length " + to_string(length));
+
+        size_t elementSize = type == ElementType::INT32 ? sizeof(int32_t) : sizeof(double);
+        size_t bytes = size_t(length) * elementSize;
+        auto array = static_cast<Array*>(heap.Allocate(ObjectKind::ARRAY, sizeof(Array) + bytes));
+        array->_type = type;
+        array->_length = uint64_t(length);
+        memset(array + 1, 0, bytes);
+        return reinterpret_cast<int64_t>(array);
+    }
+
+    Array& ArrayAt(const ManagedHeap& heap, int64_t value) {
+        auto array = reinterpret_cast<Array*>(value);
+        if(value == 0 || (value & 7) != 0)
+            throw runtime_error("Not an array: " + to_string(value));
+        // Any integer may be pushed, so the header is only trusted as far as the heap goes.
+        size_t bytes = heap.BytesFrom(array);
+        if(bytes < sizeof(Array) || array->_kind != ObjectKind::ARRAY || array->_length > MAX_ARRAY_LENGTH)
+            throw runtime_error("Not an array: " + to_string(value));
+        size_t elementSize = array->_type == ElementType::INT32 ? sizeof(int32_t) : sizeof(double);
+        if(bytes - sizeof(Array) < size_t(array->_length) * elementSize)
+            throw runtime_error("Not an array: " + to_string(value));
+        return *array;
+    }
+
+}
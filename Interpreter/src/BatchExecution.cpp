@@ -0,0 +1,34 @@
+#include "../include/BatchExecution.h"
+#include "../include/OutputSink.h"
+#include "../include/VM.h"
+
+namespace interpreter {
+
+    using namespace std;
+
+    vector<int16_t> RunBatch(const ThreadedCode& code, size_t entry, span<const vector<int16_t>> argumentSets,
+                             WorkStealingPool& pool, vector<vector<int64_t>>* printed) {
+        vector<int16_t> results(argumentSets.size());
+        vector<VM> vms(pool.NumWorkers());
+        if(printed)
+            printed->assign(argumentSets.size(), {});
+
+        pool.ParallelFor(argumentSets.size(), [&](size_t index, size_t worker) {
+            if(printed) {
+                CollectingOutput output((*printed)[index]);
+                OutputSink* previous = SetOutputSink(&output);
+                try {
+                    results[index] = vms[worker].Call(code, entry, argumentSets[index]);
+                } catch(...) {
+                    SetOutputSink(previous);
+                    throw;
+                }
+                SetOutputSink(previous);
+            } else {
+                results[index] = vms[worker].Call(code, entry, argumentSets[index]);
+            }
+        });
+        return results;
+    }
+
+}
@@ -0,0 +1,133 @@
+#include "../include/CallProfiler.h"
+#include <algorithm>
+
+namespace interpreter {
+
+    using namespace std;
+
+    CallProfiler::CallProfiler(const Instruction* code, map<size_t, string> functionNames)
+        : _code(code), _functionNames(std::move(functionNames)) {
+        // The root stands for the caller of the entry function.
+        _nodes.push_back(Node{SIZE_MAX, 0, 0, 0, {}});
+    }
+
+    void CallProfiler::Call(const Instruction* entry) {
+        size_t function = size_t(entry - _code);
+        auto foundChild = _nodes[_current]._children.find(function);
+        if(foundChild == _nodes[_current]._children.end()) {
+            uint32_t child = uint32_t(_nodes.size());
+            _nodes.push_back(Node{function, _current, 0, 0, {}});
+            foundChild = _nodes[_current]._children.emplace(function, child).first;
+        }
+        _current = foundChild->second;
+        ++_nodes[_current]._calls;
+    }
+
+    string CallProfiler::NameOf(size_t function) const {
+        auto foundName = _functionNames.find(function);
+        if(foundName != _functionNames.end())
+            return foundName->second;
+        return "function@" + to_string(function);
+    }
+
+    // Recursive scripts make a node per level of recursion, so the tree is walked
+    // with a stack of its own rather than the native one.
+    void CallProfiler::Accumulate(map<size_t, FunctionProfile>& functions) const {
+        struct Visit {
+            uint32_t _node;
+            map<size_t, uint32_t>::const_iterator _nextChild;
+            uint64_t _inclusive;
+        };
+        vector<Visit> path;
+        map<size_t, size_t> onPath;
+        auto enter = [&](uint32_t node) {
+            const Node& current = _nodes[node];
+            path.push_back(Visit{node, current._children.begin(), current._instructions});
+            ++onPath[current._function];
+        };
+
+        for(auto& [_, root] : _nodes[0]._children) {
+            enter(root);
+            while(!path.empty()) {
+                Visit& visit = path.back();
+                const Node& current = _nodes[visit._node];
+                if(visit._nextChild != current._children.end()) {
+                    enter((visit._nextChild++)->second);
+                    continue;
+                }
+
+                uint64_t inclusive = visit._inclusive;
+                path.pop_back();
+                --onPath[current._function];
+                if(!path.empty())
+                    path.back()._inclusive += inclusive;
+
+                FunctionProfile& profile = functions[current._function];
+                profile._calls += current._calls;
+                profile._exclusiveInstructions += current._instructions;
+                // An activation inside another one of the same function is already part of the outer one.
+                if(onPath[current._function] == 0)
+                    profile._inclusiveInstructions += inclusive;
+            }
+        }
+    }
+
+    map<string, CallProfiler::FunctionProfile> CallProfiler::Functions() const {
+        map<size_t, FunctionProfile> byOffset;
+        Accumulate(byOffset);
+
+        map<string, FunctionProfile> functions;
+        for(auto& [function, profile] : byOffset)
+            functions[NameOf(function)] = profile;
+        return functions;
+    }
+
+    void CallProfiler::PrintFolded(ostream& out) const {
+        // One path string grows and shrinks along with the walk, like in Accumulate.
+        struct Visit {
+            uint32_t _node;
+            map<size_t, uint32_t>::const_iterator _nextChild;
+            size_t _pathLength; // before the node's name was appended
+        };
+        vector<Visit> stack;
+        string path;
+        auto enter = [&](size_t function, uint32_t node) {
+            stack.push_back(Visit{node, _nodes[node]._children.begin(), path.size()});
+            if(!path.empty())
+                path += ';';
+            path += NameOf(function);
+            if(_nodes[node]._instructions)
+                out << path << " " << _nodes[node]._instructions << "\n";
+        };
+
+        for(auto& [function, root] : _nodes[0]._children) {
+            enter(function, root);
+            while(!stack.empty()) {
+                Visit& visit = stack.back();
+                if(visit._nextChild != _nodes[visit._node]._children.end()) {
+                    auto [childFunction, child] = *visit._nextChild++;
+                    enter(childFunction, child);
+                    continue;
+                }
+                path.resize(visit._pathLength);
+                stack.pop_back();
+            }
+        }
+        out.flush();
+    }
+
+    void CallProfiler::Print(ostream& out) const {
+        map<string, FunctionProfile> functions = Functions();
+        vector<pair<string, FunctionProfile>> ranked(functions.begin(), functions.end());
+        sort(ranked.begin(), ranked.end(), [](auto& a, auto& b) {
+            return a.second._inclusiveInstructions > b.second._inclusiveInstructions;
+        });
+
+        for(auto& [name, profile] : ranked) {
+            out << name << ": " << profile._calls << " calls, " << profile._inclusiveInstructions
+                << " instructions inclusive, " << profile._exclusiveInstructions << " exclusive\n";
+        }
+        out.flush();
+    }
+
+}
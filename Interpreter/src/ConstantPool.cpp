@@ -0,0 +1,22 @@
+#include "../include/ConstantPool.h"
+#include <stdexcept>
+#include <string>
+
+namespace interpreter {
+
+    using namespace std;
+
+    uint16_t ConstantPool::Add(int64_t value) {
+        auto found = _indices.find(value);
+        if(found != _indices.end())
+            return found->second;
+
+        if(_values.size() == MAX_ENTRIES)
+            throw runtime_error("Constant pool is full, " + to_string(MAX_ENTRIES) + " entries at most");
+        uint16_t index = uint16_t(_values.size());
+        _values.push_back(value);
+        _indices.emplace(value, index);
+        return index;
+    }
+
+}
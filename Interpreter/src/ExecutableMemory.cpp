@@ -0,0 +1,49 @@
+#include "../include/ExecutableMemory.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace interpreter {
+
+    using namespace std;
+
+    ExecutableMemory::ExecutableMemory(const vector<uint8_t>& code) : _size(code.size()) {
+        size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+        _mappedSize = (max<size_t>(code.size(), 1) + pageSize - 1) / pageSize * pageSize;
+
+        void* mapped = mmap(nullptr, _mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapped == MAP_FAILED)
+            throw runtime_error("Couldn't allocate memory for generated code");
+        _data = static_cast<uint8_t*>(mapped);
+
+        memcpy(_data, code.data(), code.size());
+        if(mprotect(_data, _mappedSize, PROT_READ | PROT_EXEC) != 0) {
+            munmap(_data, _mappedSize);
+            throw runtime_error("Couldn't make generated code executable");
+        }
+    }
+
+    ExecutableMemory::ExecutableMemory(ExecutableMemory&& other) noexcept
+        : _data(exchange(other._data, nullptr)), _size(exchange(other._size, 0)),
+          _mappedSize(exchange(other._mappedSize, 0)) {}
+
+    ExecutableMemory& ExecutableMemory::operator=(ExecutableMemory&& other) noexcept {
+        if(this != &other) {
+            if(_data)
+                munmap(_data, _mappedSize);
+            _data = exchange(other._data, nullptr);
+            _size = exchange(other._size, 0);
+            _mappedSize = exchange(other._mappedSize, 0);
+        }
+        return *this;
+    }
+
+    ExecutableMemory::~ExecutableMemory() {
+        if(_data)
+            munmap(_data, _mappedSize);
+    }
+
+}
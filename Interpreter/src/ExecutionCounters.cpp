@@ -0,0 +1,64 @@
+#include "../include/ExecutionCounters.h"
+#include "../include/Interpreter.h"
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <vector>
+
+namespace interpreter {
+
+    using namespace std;
+
+    ExecutionCounters::~ExecutionCounters() {
+        if(_dumpAtExit)
+            Print(*_dumpAtExit);
+    }
+
+    void ExecutionCounters::Reset() {
+        memset(_opcodes, 0, sizeof(_opcodes));
+        memset(_pairs, 0, sizeof(_pairs));
+        _addresses.clear();
+    }
+
+    void ExecutionCounters::Print(ostream& out, size_t maxEntries) const {
+        uint64_t total = 0;
+        vector<pair<uint64_t, Opcode>> opcodes;
+        for(size_t x = 0; x < NUM_INSTRUCTIONS; ++x) {
+            total += _opcodes[x];
+            if(_opcodes[x])
+                opcodes.emplace_back(_opcodes[x], Opcode(x));
+        }
+        sort(opcodes.begin(), opcodes.end(), [](auto& a, auto& b) { return a.first > b.first; });
+
+        out << total << " instructions executed\n";
+        for(auto& [count, opcode] : opcodes)
+            out << count << "x " << gOpcodeNames[opcode] << "\n";
+
+        vector<tuple<uint64_t, Opcode, Opcode>> pairs;
+        for(size_t first = 0; first < NUM_INSTRUCTIONS; ++first) {
+            for(size_t second = 0; second < NUM_INSTRUCTIONS; ++second) {
+                if(_pairs[first][second])
+                    pairs.emplace_back(_pairs[first][second], Opcode(first), Opcode(second));
+            }
+        }
+        sort(pairs.begin(), pairs.end(), [](auto& a, auto& b) { return get<0>(a) > get<0>(b); });
+        if(pairs.size() > maxEntries)
+            pairs.resize(maxEntries);
+
+        out << "\nMost frequent opcode pairs:\n";
+        for(auto& [count, first, second] : pairs)
+            out << count << "x " << gOpcodeNames[first] << " " << gOpcodeNames[second] << "\n";
+
+        vector<pair<const Instruction*, AddressCount>> addresses(_addresses.begin(), _addresses.end());
+        sort(addresses.begin(), addresses.end(), [](auto& a, auto& b) { return a.second._count > b.second._count; });
+        if(addresses.size() > maxEntries)
+            addresses.resize(maxEntries);
+
+        out << "\nHottest instructions:\n";
+        for(auto& [address, counted] : addresses)
+            out << counted._count << "x " << static_cast<const void*>(address) << " "
+                << gOpcodeNames[counted._instruction._opcode] << " " << counted._instruction.p2 << "\n";
+        out.flush();
+    }
+
+}
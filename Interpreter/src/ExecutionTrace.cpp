@@ -0,0 +1,384 @@
+#include "../include/ExecutionTrace.h"
+#include "../include/JitSymbols.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <set>
+#include <stdexcept>
+
+namespace interpreter {
+
+    using namespace std;
+
+    // File layout: the magic and version, the function names as a count and
+    // (offset, length, bytes) each, then chunks of (thread number, length, bytes)
+    // in the order the writer drained them. All numbers are LEB128 varints.
+    //
+    // An event starts with (offset - resume) << 3 | kind, where resume is where
+    // the previous event continued, so a straight-line run is just its length.
+    // Taken branches, jumps and calls add the zigzag target - offset. Every event
+    // ends with the zigzag change of the operand stack depth. A run starts with
+    // the absolute entry offset and depth instead.
+    static const char gTraceMagic[4] = {'I', 'V', 'T', 'R'};
+    static constexpr uint8_t TRACE_VERSION = 1;
+
+    enum TraceEvent: uint8_t {
+        RUN_START,
+        BRANCH_NOT_TAKEN,
+        BRANCH_TAKEN,
+        JUMP,
+        CALL_EVENT,
+        RETURN_EVENT,
+        END
+    };
+
+    static constexpr size_t MAX_EVENT_SIZE = 3 * 10;
+
+    static atomic<uint64_t> gNextRecorderId = 1;
+
+    // The stream of this thread for the recorder with that id.
+    static thread_local uint64_t gStreamRecorderId = 0;
+    static thread_local TraceRecorder::Stream* gStream = nullptr;
+
+    static uint8_t* PutVarint(uint8_t* out, uint64_t value) {
+        while(value >= 0x80) {
+            *out++ = uint8_t(value) | 0x80;
+            value >>= 7;
+        }
+        *out++ = uint8_t(value);
+        return out;
+    }
+
+    static uint64_t ZigZag(int64_t value) {
+        return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    }
+
+    static int64_t UnZigZag(uint64_t value) {
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+
+    static void PutVarint(vector<uint8_t>& out, uint64_t value) {
+        uint8_t bytes[10];
+        out.insert(out.end(), bytes, PutVarint(bytes, value));
+    }
+
+    static uint64_t GetVarint(const uint8_t*& in, const uint8_t* end) {
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            if(in == end)
+                throw runtime_error("Trace ends in the middle of a number");
+            uint8_t byte = *in++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                return value;
+        }
+        throw runtime_error("Malformed number in trace");
+    }
+
+    static uint64_t GetVarint(istream& in) {
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            int byte = in.get();
+            if(byte == EOF)
+                throw runtime_error("Trace ends in the middle of a number");
+            value |= uint64_t(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                return value;
+        }
+        throw runtime_error("Malformed number in trace");
+    }
+
+    TraceRecorder::Stream::Stream(const Instruction* code, size_t capacity)
+        : _code(code), _ring(capacity), _mask(capacity - 1) {
+    }
+
+    void TraceRecorder::Stream::Start(const Instruction* entry, size_t depth) {
+        uint8_t event[MAX_EVENT_SIZE];
+        _resume = size_t(entry - _code);
+        _depth = depth;
+        uint8_t* end = PutVarint(event, uint64_t(_resume) << 3 | RUN_START);
+        end = PutVarint(end, depth);
+        Write(event, size_t(end - event));
+    }
+
+    void TraceRecorder::Stream::Record(const Instruction* executed, const Instruction* next, size_t depth) {
+        size_t offset = size_t(executed - _code);
+        TraceEvent kind;
+        switch(executed->_opcode) {
+            case JUMP_BY_IF_ZERO:
+            case JUMP_BY_IF_NOT_LESS:
+                kind = next == executed + 1 ? BRANCH_NOT_TAKEN : BRANCH_TAKEN;
+                break;
+            case JUMP_BY:
+                kind = JUMP;
+                break;
+            case CALL:
+                kind = CALL_EVENT;
+                break;
+            case RETURN:
+                kind = next ? RETURN_EVENT : END;
+                break;
+            default:
+                kind = END;
+                break;
+        }
+
+        uint8_t event[MAX_EVENT_SIZE];
+        uint8_t* end = PutVarint(event, uint64_t(offset - _resume) << 3 | kind);
+        if(kind == BRANCH_TAKEN || kind == JUMP || kind == CALL_EVENT)
+            end = PutVarint(end, ZigZag(int64_t(next - executed)));
+        end = PutVarint(end, ZigZag(int64_t(depth) - int64_t(_depth)));
+        Write(event, size_t(end - event));
+
+        _resume = next ? size_t(next - _code) : offset;
+        _depth = depth;
+    }
+
+    void TraceRecorder::Stream::Write(const uint8_t* bytes, size_t size) {
+        uint64_t head = _head.load(memory_order_relaxed);
+        // A full ring waits for the writer rather than losing events.
+        while(head + size - _tail.load(memory_order_acquire) > _ring.size())
+            this_thread::yield();
+
+        size_t at = size_t(head) & _mask;
+        size_t first = min(size, _ring.size() - at);
+        memcpy(_ring.data() + at, bytes, first);
+        memcpy(_ring.data(), bytes + first, size - first);
+        _head.store(head + size, memory_order_release);
+    }
+
+    size_t TraceRecorder::Stream::Drain(vector<uint8_t>& out) {
+        uint64_t tail = _tail.load(memory_order_relaxed);
+        uint64_t head = _head.load(memory_order_acquire);
+        size_t size = size_t(head - tail);
+        size_t at = size_t(tail) & _mask;
+        size_t first = min(size, _ring.size() - at);
+        out.insert(out.end(), _ring.begin() + at, _ring.begin() + at + first);
+        out.insert(out.end(), _ring.begin(), _ring.begin() + (size - first));
+        _tail.store(head, memory_order_release);
+        return size;
+    }
+
+    TraceRecorder::TraceRecorder(const string& path, const Instruction* code, map<size_t, string> functionNames,
+                                 size_t ringCapacity)
+        : _code(code), _ringCapacity(max<size_t>(ringCapacity, MAX_EVENT_SIZE)), _id(gNextRecorderId++),
+          _file(path, ios::binary) {
+        if(!_file)
+            throw runtime_error("Can't write " + path);
+        // A power of two, so positions wrap with a mask.
+        while(_ringCapacity & (_ringCapacity - 1))
+            _ringCapacity += _ringCapacity & -_ringCapacity;
+
+        vector<uint8_t> header(gTraceMagic, gTraceMagic + sizeof(gTraceMagic));
+        header.push_back(TRACE_VERSION);
+        PutVarint(header, functionNames.size());
+        for(auto& [offset, name] : functionNames) {
+            PutVarint(header, offset);
+            PutVarint(header, name.size());
+            header.insert(header.end(), name.begin(), name.end());
+        }
+        _file.write(reinterpret_cast<const char*>(header.data()), streamsize(header.size()));
+
+        _writer = thread([this]() {
+            while(!_stopping.load(memory_order_acquire)) {
+                WriteChunks(false);
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        });
+    }
+
+    TraceRecorder::~TraceRecorder() {
+        _stopping.store(true, memory_order_release);
+        _writer.join();
+        WriteChunks(true);
+        _file.flush();
+    }
+
+    TraceRecorder::Stream& TraceRecorder::StreamOfThisThread() {
+        if(gStreamRecorderId != _id) {
+            lock_guard<mutex> lock(_streamsMutex);
+            _streams.push_back(unique_ptr<Stream>(new Stream(_code, _ringCapacity)));
+            gStream = _streams.back().get();
+            gStreamRecorderId = _id;
+        }
+        return *gStream;
+    }
+
+    void TraceRecorder::WriteChunks(bool final) {
+        vector<Stream*> streams;
+        {
+            lock_guard<mutex> lock(_streamsMutex);
+            for(auto& stream : _streams)
+                streams.push_back(stream.get());
+        }
+
+        vector<uint8_t> bytes;
+        vector<uint8_t> chunk;
+        for(size_t x = 0; x < streams.size(); ++x) {
+            bytes.clear();
+            if(streams[x]->Drain(bytes) == 0)
+                continue;
+            chunk.clear();
+            PutVarint(chunk, x);
+            PutVarint(chunk, bytes.size());
+            chunk.insert(chunk.end(), bytes.begin(), bytes.end());
+            _file.write(reinterpret_cast<const char*>(chunk.data()), streamsize(chunk.size()));
+        }
+        if(final)
+            _file.flush();
+    }
+
+    TraceAnalysis::TraceAnalysis(istream& trace) {
+        char magic[sizeof(gTraceMagic)];
+        if(!trace.read(magic, sizeof(magic)) || memcmp(magic, gTraceMagic, sizeof(magic)) != 0)
+            throw runtime_error("Not an execution trace");
+        if(trace.get() != TRACE_VERSION)
+            throw runtime_error("Unsupported execution trace version");
+
+        uint64_t numNames = GetVarint(trace);
+        for(uint64_t x = 0; x < numNames; ++x) {
+            size_t offset = size_t(GetVarint(trace));
+            string name(size_t(GetVarint(trace)), ' ');
+            if(!trace.read(name.data(), streamsize(name.size())))
+                throw runtime_error("Trace ends in a function name");
+            _functionNames[offset] = name;
+        }
+
+        // A thread's events can be split anywhere between chunks.
+        map<uint64_t, vector<uint8_t>> threads;
+        while(trace.peek() != EOF) {
+            vector<uint8_t>& events = threads[GetVarint(trace)];
+            size_t size = size_t(GetVarint(trace));
+            size_t at = events.size();
+            events.resize(at + size);
+            if(!trace.read(reinterpret_cast<char*>(events.data() + at), streamsize(size)))
+                throw runtime_error("Trace ends in the middle of a chunk");
+        }
+        for(auto& [_, events] : threads)
+            Analyze(events);
+
+        // Callers are the functions containing the call site: the named ones and those seen called.
+        for(auto& [site, _] : _calls)
+            _functionNames.emplace(site.second, "function@" + to_string(site.second));
+        for(auto& [site, count] : _calls)
+            _callGraph[{FunctionName(_functionNames, site.first), NameOf(site.second)}] += count;
+    }
+
+    void TraceAnalysis::Analyze(const vector<uint8_t>& events) {
+        const uint8_t* in = events.data();
+        const uint8_t* end = in + events.size();
+        size_t resume = 0;
+        size_t depth = 0;
+        vector<size_t> returnOffsets;
+
+        while(in != end) {
+            uint64_t head = GetVarint(in, end);
+            auto kind = TraceEvent(head & 7);
+            if(kind == RUN_START) {
+                resume = size_t(head >> 3);
+                depth = size_t(GetVarint(in, end));
+                returnOffsets.clear();
+                _functionNames.emplace(resume, "function@" + to_string(resume));
+                ++_runs;
+                _maxDepth = max(_maxDepth, depth);
+                continue;
+            }
+
+            size_t offset = resume + size_t(head >> 3);
+            ++_paths[{resume, offset}];
+            _instructions += offset - resume + 1;
+
+            size_t target = offset + 1;
+            if(kind == BRANCH_TAKEN || kind == JUMP || kind == CALL_EVENT)
+                target = size_t(int64_t(offset) + UnZigZag(GetVarint(in, end)));
+            depth = size_t(int64_t(depth) + UnZigZag(GetVarint(in, end)));
+            _maxDepth = max(_maxDepth, depth);
+
+            switch(kind) {
+                case BRANCH_NOT_TAKEN:
+                    ++_branches[offset]._notTaken;
+                    break;
+                case BRANCH_TAKEN:
+                    ++_branches[offset]._taken;
+                    break;
+                case CALL_EVENT:
+                    ++_calls[{offset, target}];
+                    returnOffsets.push_back(offset + 1);
+                    break;
+                case RETURN_EVENT:
+                    if(returnOffsets.empty())
+                        throw runtime_error("Trace returns more often than it calls");
+                    target = returnOffsets.back();
+                    returnOffsets.pop_back();
+                    break;
+                case END:
+                    target = offset;
+                    break;
+                default:
+                    if(kind != JUMP)
+                        throw runtime_error("Unknown event in trace");
+                    break;
+            }
+            resume = target;
+        }
+    }
+
+    string TraceAnalysis::NameOf(size_t function) const {
+        auto foundName = _functionNames.find(function);
+        if(foundName != _functionNames.end())
+            return foundName->second;
+        return "function@" + to_string(function);
+    }
+
+    vector<TraceAnalysis::Path> TraceAnalysis::HotPaths() const {
+        vector<Path> paths;
+        for(auto& [range, count] : _paths)
+            paths.push_back(Path{range.first, range.second, count});
+        sort(paths.begin(), paths.end(), [](const Path& a, const Path& b) {
+            uint64_t aInstructions = a._count * (a._end - a._start + 1);
+            uint64_t bInstructions = b._count * (b._end - b._start + 1);
+            return aInstructions != bInstructions ? aInstructions > bInstructions : a._start < b._start;
+        });
+        return paths;
+    }
+
+    void TraceAnalysis::Print(ostream& out, size_t maxEntries) const {
+        out << _runs << " runs, " << _instructions << " instructions, operand stack up to " << _maxDepth
+            << " slots\n";
+
+        out << "\nHot paths:\n";
+        vector<Path> paths = HotPaths();
+        for(size_t x = 0; x < paths.size() && x < maxEntries; ++x) {
+            const Path& path = paths[x];
+            out << "  " << FunctionName(_functionNames, path._start) << " " << path._start << "-" << path._end
+                << ": " << path._count << "x, " << path._count * (path._end - path._start + 1)
+                << " instructions\n";
+        }
+
+        // The most executed branches first, the ones worth laying out for their likely direction.
+        vector<pair<size_t, BranchBias>> branches(_branches.begin(), _branches.end());
+        sort(branches.begin(), branches.end(), [](auto& a, auto& b) {
+            uint64_t aCount = a.second._taken + a.second._notTaken;
+            uint64_t bCount = b.second._taken + b.second._notTaken;
+            return aCount != bCount ? aCount > bCount : a.first < b.first;
+        });
+        out << "\nBranch bias:\n";
+        ios_base::fmtflags flags = out.flags();
+        streamsize precision = out.precision();
+        for(size_t x = 0; x < branches.size() && x < maxEntries; ++x) {
+            auto& [offset, bias] = branches[x];
+            uint64_t count = bias._taken + bias._notTaken;
+            out << "  " << FunctionName(_functionNames, offset) << " " << offset << ": taken " << bias._taken
+                << " of " << count << " (" << fixed << setprecision(1)
+                << 100.0 * double(bias._taken) / double(count) << "%)\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+
+        out << "\nCall graph:\n";
+        for(auto& [edge, count] : _callGraph)
+            out << "  " << edge.first << " -> " << edge.second << ": " << count << "\n";
+    }
+
+}
@@ -1,5 +1,13 @@
 #include "../include/Interpreter.h"
-#include <iostream>
+#include "../include/VM.h"
+#include "../include/OutputSink.h"
+#include "../include/Arrays.h"
+#include "../include/ArrayKernels.h"
+#include "../include/Strings.h"
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <string>
 
 namespace interpreter {
 
@@ -20,32 +28,159 @@ namespace interpreter {
             StoreIntBasePointerRelativeInstruction,
             CallInstruction,
             ReturnInstruction,
+            IncIntBasePointerRelativeInstruction,
+            AddIntImmediateInstruction,
+            JumpByIfNotLessInstruction,
+            PopIntNInstruction,
+            PushConstInstruction,
+            AddInt32Instruction,
+            CompareInt32LessInstruction,
+            AddInt64Instruction,
+            CompareInt64LessInstruction,
+            AddDoubleInstruction,
+            SubtractDoubleInstruction,
+            MultiplyDoubleInstruction,
+            DivideDoubleInstruction,
+            CompareDoubleLessInstruction,
+            IntToDoubleInstruction,
+            DoubleToIntInstruction,
+            PrintDoubleInstruction,
+            NewArrayInstruction,
+            ArrayLengthInstruction,
+            ArrayLoadIntInstruction,
+            ArrayLoadDoubleInstruction,
+            ArrayStoreIntInstruction,
+            ArrayStoreDoubleInstruction,
+            ArrayAddInstruction,
+            ArrayMultiplyInstruction,
+            ArraySumInstruction,
+            ArrayMinInstruction,
+            ArrayMaxInstruction,
+            ArrayDotInstruction,
+            ConcatStringInstruction,
+            CompareStringLessInstruction,
+            EqualStringInstruction,
+            PrintValuesInstruction,
+            SaturateInt16Instruction,
     };
 
-    void Interpreter::Run(Instruction *code, vector<int16_t> args, int16_t *result) {
-        InterpreterRegisters registers{._currInstruction = code};
+    const char* gOpcodeNames[NUM_INSTRUCTIONS] = {
+            "EXIT",
+            "ADD_INT",
+            "PUSH_INT",
+            "POP_INT",
+            "PRINT_INT",
+            "COMP_INT_LT",
+            "LOAD_INT",
+            "STORE_INT",
+            "JUMP_BY_IF_ZERO",
+            "JUMP_BY",
+            "LOAD_INT_BASEPOINTER_RELATIVE",
+            "STORE_INT_BASEPOINTER_RELATIVE",
+            "CALL",
+            "RETURN",
+            "INC_INT_BASEPOINTER_RELATIVE",
+            "ADD_INT_IMMEDIATE",
+            "JUMP_BY_IF_NOT_LESS",
+            "POP_INT_N",
+            "PUSH_CONST",
+            "ADD_INT32",
+            "COMP_INT32_LT",
+            "ADD_INT64",
+            "COMP_INT64_LT",
+            "ADD_DOUBLE",
+            "SUB_DOUBLE",
+            "MUL_DOUBLE",
+            "DIV_DOUBLE",
+            "COMP_DOUBLE_LT",
+            "INT_TO_DOUBLE",
+            "DOUBLE_TO_INT",
+            "PRINT_DOUBLE",
+            "NEW_ARRAY",
+            "ARRAY_LENGTH",
+            "ARRAY_LOAD_INT",
+            "ARRAY_LOAD_DOUBLE",
+            "ARRAY_STORE_INT",
+            "ARRAY_STORE_DOUBLE",
+            "ARRAY_ADD",
+            "ARRAY_MUL",
+            "ARRAY_SUM",
+            "ARRAY_MIN",
+            "ARRAY_MAX",
+            "ARRAY_DOT",
+            "CONCAT_STRING",
+            "COMP_STRING_LT",
+            "EQUAL_STRING",
+            "PRINT_VALUES",
+            "SATURATE_INT16",
+    };
 
-        if(result) {
-            registers._stack.push_back(0);
-        }
-        registers._stack.insert(registers._stack.end(), args.begin(), args.end());
+    static double PopDouble(InterpreterRegisters& registers) {
+        double number = bit_cast<double>(registers._stack.back());
+        registers._stack.pop_back();
+        return number;
+    }
 
-        registers._stack.push_back(0);
-        registers._returnAdressStack.push_back(nullptr);
-        registers._baseIdx = registers._stack.size();
+    static void PushDouble(InterpreterRegisters& registers, double number) {
+        registers._stack.push_back(bit_cast<int64_t>(number));
+    }
 
-        while(registers._currInstruction != nullptr) {
-            gInstructionFunctions[registers._currInstruction->_opcode](registers);
-        }
+    // Toward zero, saturated, NaN becomes 0.
+    static int32_t DoubleToInt32(double number) {
+        if(number >= double(INT32_MAX))
+            return INT32_MAX;
+        if(number <= double(INT32_MIN))
+            return INT32_MIN;
+        if(number != number)
+            return 0;
+        return int32_t(number);
+    }
+
+    static Array& PopArray(InterpreterRegisters& registers) {
+        int64_t value = registers._stack.back();
+        registers._stack.pop_back();
+        if(!registers._heap)
+            throw runtime_error("Not an array: " + to_string(value));
+        return ArrayAt(*registers._heap, value);
+    }
+
+    // The element an index refers to, with the stride and offset of a field of interleaved structs.
+    static size_t CheckedIndex(int64_t index, const Array& array, const Instruction& instruction) {
+        int64_t element = index;
+        if(instruction.p1 > 0 && index >= 0 && index <= INT32_MAX)
+            element = index * instruction.p1 + instruction.p2;
+        if(index < 0 || element < 0 || uint64_t(element) >= array.Length())
+            throw runtime_error("Index " + to_string(index) + " out of range for an array of "
+                                + to_string(array.Length()));
+        return size_t(element);
+    }
+
+    static StringHeap& StringsOf(InterpreterRegisters& registers) {
+        if(!registers._strings)
+            throw runtime_error("Strings without a string heap");
+        return *registers._strings;
+    }
 
-        size_t numArgs = args.size();
+    static void RequireAlike(const Array& array, const Array& other) {
+        if(array._type != other._type || array.Length() != other.Length())
+            throw runtime_error("Arrays of different types or lengths");
+    }
 
-        while(numArgs--) {
-            registers._stack.pop_back();
+    void RequireNarrowCode(const Instruction* code, size_t numInstructions) {
+        for(size_t x = 0; x < numInstructions; ++x) {
+            if(IsWideOpcode(code[x]._opcode))
+                throw runtime_error(string("Only the reference interpreter runs ") + gOpcodeNames[code[x]._opcode] +
+                                    ", found at " + to_string(x));
         }
+    }
 
-        if(result)
-            *result = registers._stack[0];
+    void Interpreter::Run(Instruction *code, vector<int16_t> args, int16_t *result, ExecutionCounters* counters,
+                          TraceRecorder* recorder) {
+        // Every thread keeps one VM, so a run reuses the stacks and heap of the last.
+        thread_local VM vm;
+        vm.SetCounters(counters);
+        vm.SetRecorder(recorder);
+        vm.Run(code, args, result);
     }
 
     void ExitInstruction(InterpreterRegisters& registers) {
@@ -57,7 +192,7 @@ namespace interpreter {
         registers._stack.pop_back();
         int16_t leftHandSide = registers._stack.back();
         registers._stack.pop_back();
-        registers._stack.push_back(leftHandSide + rightHandSide);
+        registers._stack.push_back(int16_t(leftHandSide + rightHandSide));
         ++registers._currInstruction;
     }
 
@@ -72,9 +207,9 @@ namespace interpreter {
     }
 
     void PrintIntInstruction(InterpreterRegisters& registers) {
-        int16_t number = registers._stack.back();
+        int64_t number = registers._stack.back();
         registers._stack.pop_back();
-        cout << "Number printed: " << number << endl;
+        CurrentOutput().PrintInt(number);
         ++registers._currInstruction;
     }
 
@@ -100,7 +235,7 @@ namespace interpreter {
     }
 
     void JumpByIfZeroInstruction(InterpreterRegisters& registers) {
-        int16_t condition = registers._stack.back();
+        int64_t condition = registers._stack.back();
         registers._stack.pop_back();
         if(condition == 0)
             registers._currInstruction += registers._currInstruction->p2;
@@ -108,7 +243,16 @@ namespace interpreter {
             registers._currInstruction++;
     }
 
+    // Calls and loop back-edges are where the managed heap collects, the frames
+    // are all described by stack maps there.
+    static void Safepoint(InterpreterRegisters& registers) {
+        if(registers._heap && registers._heap->CollectionRequested())
+            registers._heap->Collect(registers);
+    }
+
     void JumpByInstruction(InterpreterRegisters& registers) {
+        if(registers._currInstruction->p2 < 0)
+            Safepoint(registers);
         registers._currInstruction += registers._currInstruction->p2;
     }
 
@@ -124,7 +268,8 @@ namespace interpreter {
     }
 
     void CallInstruction(InterpreterRegisters& registers) {
-        registers._stack.push_back((int16_t(registers._baseIdx)));
+        Safepoint(registers);
+        registers._stack.push_back(int64_t(registers._baseIdx));
         registers._returnAdressStack.push_back(registers._currInstruction+1);
         registers._baseIdx = registers._stack.size();
         registers._currInstruction += registers._currInstruction->p2;
@@ -138,4 +283,325 @@ namespace interpreter {
         registers._currInstruction = returnAdress;
     }
 
-}
\ No newline at end of file
+    void IncIntBasePointerRelativeInstruction(InterpreterRegisters& registers) {
+        int64_t& slot = registers._stack[registers._currInstruction->p2 + registers._baseIdx];
+        slot = int16_t(slot + int8_t(registers._currInstruction->p1));
+        ++registers._currInstruction;
+    }
+
+    void AddIntImmediateInstruction(InterpreterRegisters& registers) {
+        int64_t& top = registers._stack.back();
+        top = int16_t(top + registers._currInstruction->p2);
+        ++registers._currInstruction;
+    }
+
+    void JumpByIfNotLessInstruction(InterpreterRegisters& registers) {
+        int16_t rightHandSide = registers._stack.back();
+        registers._stack.pop_back();
+        int16_t leftHandSide = registers._stack.back();
+        registers._stack.pop_back();
+        if(leftHandSide < rightHandSide)
+            registers._currInstruction++;
+        else
+            registers._currInstruction += registers._currInstruction->p2;
+    }
+
+    void PopIntNInstruction(InterpreterRegisters& registers) {
+        registers._stack.resize(registers._stack.size() - registers._currInstruction->p2);
+        ++registers._currInstruction;
+    }
+
+    void PushConstInstruction(InterpreterRegisters& registers) {
+        if(!registers._constants)
+            throw runtime_error("PUSH_CONST without a constant pool");
+        uint16_t index = uint16_t(registers._currInstruction->p2);
+        if(index >= registers._numConstants)
+            throw runtime_error("Constant " + to_string(index) + " out of range for a pool of "
+                                + to_string(registers._numConstants));
+        registers._stack.push_back(registers._constants[index]);
+        ++registers._currInstruction;
+    }
+
+    void AddInt32Instruction(InterpreterRegisters& registers) {
+        int32_t rightHandSide = int32_t(registers._stack.back());
+        registers._stack.pop_back();
+        int32_t leftHandSide = int32_t(registers._stack.back());
+        registers._stack.pop_back();
+        // Wraps around like the 16-bit ADD_INT, without signed overflow.
+        registers._stack.push_back(int32_t(uint32_t(leftHandSide) + uint32_t(rightHandSide)));
+        ++registers._currInstruction;
+    }
+
+    void CompareInt32LessInstruction(InterpreterRegisters& registers) {
+        int32_t rightHandSide = int32_t(registers._stack.back());
+        registers._stack.pop_back();
+        int32_t leftHandSide = int32_t(registers._stack.back());
+        registers._stack.pop_back();
+        registers._stack.push_back(leftHandSide < rightHandSide);
+        ++registers._currInstruction;
+    }
+
+    void AddInt64Instruction(InterpreterRegisters& registers) {
+        int64_t rightHandSide = registers._stack.back();
+        registers._stack.pop_back();
+        int64_t leftHandSide = registers._stack.back();
+        registers._stack.pop_back();
+        registers._stack.push_back(int64_t(uint64_t(leftHandSide) + uint64_t(rightHandSide)));
+        ++registers._currInstruction;
+    }
+
+    void CompareInt64LessInstruction(InterpreterRegisters& registers) {
+        int64_t rightHandSide = registers._stack.back();
+        registers._stack.pop_back();
+        int64_t leftHandSide = registers._stack.back();
+        registers._stack.pop_back();
+        registers._stack.push_back(leftHandSide < rightHandSide);
+        ++registers._currInstruction;
+    }
+
+    void AddDoubleInstruction(InterpreterRegisters& registers) {
+        double rightHandSide = PopDouble(registers);
+        double leftHandSide = PopDouble(registers);
+        PushDouble(registers, leftHandSide + rightHandSide);
+        ++registers._currInstruction;
+    }
+
+    void SubtractDoubleInstruction(InterpreterRegisters& registers) {
+        double rightHandSide = PopDouble(registers);
+        double leftHandSide = PopDouble(registers);
+        PushDouble(registers, leftHandSide - rightHandSide);
+        ++registers._currInstruction;
+    }
+
+    void MultiplyDoubleInstruction(InterpreterRegisters& registers) {
+        double rightHandSide = PopDouble(registers);
+        double leftHandSide = PopDouble(registers);
+        PushDouble(registers, leftHandSide * rightHandSide);
+        ++registers._currInstruction;
+    }
+
+    void DivideDoubleInstruction(InterpreterRegisters& registers) {
+        double rightHandSide = PopDouble(registers);
+        double leftHandSide = PopDouble(registers);
+        PushDouble(registers, leftHandSide / rightHandSide);
+        ++registers._currInstruction;
+    }
+
+    void CompareDoubleLessInstruction(InterpreterRegisters& registers) {
+        double rightHandSide = PopDouble(registers);
+        double leftHandSide = PopDouble(registers);
+        registers._stack.push_back(leftHandSide < rightHandSide);
+        ++registers._currInstruction;
+    }
+
+    void IntToDoubleInstruction(InterpreterRegisters& registers) {
+        int64_t& top = registers._stack.back();
+        top = bit_cast<int64_t>(double(top));
+        ++registers._currInstruction;
+    }
+
+    void DoubleToIntInstruction(InterpreterRegisters& registers) {
+        registers._stack.push_back(DoubleToInt32(PopDouble(registers)));
+        ++registers._currInstruction;
+    }
+
+    void PrintDoubleInstruction(InterpreterRegisters& registers) {
+        CurrentOutput().PrintDouble(PopDouble(registers));
+        ++registers._currInstruction;
+    }
+
+    void NewArrayInstruction(InterpreterRegisters& registers) {
+        if(!registers._heap)
+            throw runtime_error("Arrays without a managed heap");
+        int64_t& top = registers._stack.back();
+        int64_t perEntry = max<int64_t>(registers._currInstruction->p2, 1);
+        if(top > 0 && top > int64_t(MAX_ARRAY_LENGTH) / perEntry)
+            throw runtime_error("Invalid array length " + to_string(top) + " times " + to_string(perEntry));
+        top = NewArray(*registers._heap, ElementType(registers._currInstruction->p1), top * perEntry);
+        ++registers._currInstruction;
+    }
+
+    void ArrayLengthInstruction(InterpreterRegisters& registers) {
+        size_t elementsPerStruct = max<size_t>(registers._currInstruction->p1, 1);
+        registers._stack.push_back(int64_t(PopArray(registers).Length() / elementsPerStruct));
+        ++registers._currInstruction;
+    }
+
+    void ArrayLoadIntInstruction(InterpreterRegisters& registers) {
+        int64_t index = registers._stack.back();
+        registers._stack.pop_back();
+        Array& array = PopArray(registers);
+        size_t x = CheckedIndex(index, array, *registers._currInstruction);
+        if(array._type == ElementType::INT32)
+            registers._stack.push_back(array.Ints()[x]);
+        else
+            registers._stack.push_back(DoubleToInt32(array.Doubles()[x]));
+        ++registers._currInstruction;
+    }
+
+    void ArrayLoadDoubleInstruction(InterpreterRegisters& registers) {
+        int64_t index = registers._stack.back();
+        registers._stack.pop_back();
+        Array& array = PopArray(registers);
+        size_t x = CheckedIndex(index, array, *registers._currInstruction);
+        PushDouble(registers, array._type == ElementType::INT32 ? double(array.Ints()[x]) : array.Doubles()[x]);
+        ++registers._currInstruction;
+    }
+
+    void ArrayStoreIntInstruction(InterpreterRegisters& registers) {
+        int64_t value = registers._stack.back();
+        registers._stack.pop_back();
+        int64_t index = registers._stack.back();
+        registers._stack.pop_back();
+        Array& array = PopArray(registers);
+        size_t x = CheckedIndex(index, array, *registers._currInstruction);
+        if(array._type == ElementType::INT32)
+            array.Ints()[x] = int32_t(value);
+        else
+            array.Doubles()[x] = double(value);
+        ++registers._currInstruction;
+    }
+
+    void ArrayStoreDoubleInstruction(InterpreterRegisters& registers) {
+        double value = PopDouble(registers);
+        int64_t index = registers._stack.back();
+        registers._stack.pop_back();
+        Array& array = PopArray(registers);
+        size_t x = CheckedIndex(index, array, *registers._currInstruction);
+        if(array._type == ElementType::INT32)
+            array.Ints()[x] = DoubleToInt32(value);
+        else
+            array.Doubles()[x] = value;
+        ++registers._currInstruction;
+    }
+
+    void ArrayAddInstruction(InterpreterRegisters& registers) {
+        Array& b = PopArray(registers);
+        Array& a = PopArray(registers);
+        Array& out = PopArray(registers);
+        RequireAlike(a, b);
+        RequireAlike(out, b);
+        if(b._type == ElementType::INT32)
+            kernels::Add(a.Ints(), b.Ints(), out.Ints(), b.Length());
+        else
+            kernels::Add(a.Doubles(), b.Doubles(), out.Doubles(), b.Length());
+        ++registers._currInstruction;
+    }
+
+    void ArrayMultiplyInstruction(InterpreterRegisters& registers) {
+        Array& b = PopArray(registers);
+        Array& a = PopArray(registers);
+        Array& out = PopArray(registers);
+        RequireAlike(a, b);
+        RequireAlike(out, b);
+        if(b._type == ElementType::INT32)
+            kernels::Multiply(a.Ints(), b.Ints(), out.Ints(), b.Length());
+        else
+            kernels::Multiply(a.Doubles(), b.Doubles(), out.Doubles(), b.Length());
+        ++registers._currInstruction;
+    }
+
+    void ArraySumInstruction(InterpreterRegisters& registers) {
+        Array& array = PopArray(registers);
+        if(array._type == ElementType::INT32)
+            PushDouble(registers, double(kernels::Sum(array.Ints(), array.Length())));
+        else
+            PushDouble(registers, kernels::Sum(array.Doubles(), array.Length()));
+        ++registers._currInstruction;
+    }
+
+    void ArrayMinInstruction(InterpreterRegisters& registers) {
+        Array& array = PopArray(registers);
+        if(array.Length() == 0)
+            throw runtime_error("Minimum of an empty array");
+        if(array._type == ElementType::INT32)
+            PushDouble(registers, kernels::Min(array.Ints(), array.Length()));
+        else
+            PushDouble(registers, kernels::Min(array.Doubles(), array.Length()));
+        ++registers._currInstruction;
+    }
+
+    void ArrayMaxInstruction(InterpreterRegisters& registers) {
+        Array& array = PopArray(registers);
+        if(array.Length() == 0)
+            throw runtime_error("Maximum of an empty array");
+        if(array._type == ElementType::INT32)
+            PushDouble(registers, kernels::Max(array.Ints(), array.Length()));
+        else
+            PushDouble(registers, kernels::Max(array.Doubles(), array.Length()));
+        ++registers._currInstruction;
+    }
+
+    void ArrayDotInstruction(InterpreterRegisters& registers) {
+        Array& b = PopArray(registers);
+        Array& a = PopArray(registers);
+        RequireAlike(a, b);
+        if(b._type == ElementType::INT32)
+            PushDouble(registers, double(kernels::Dot(a.Ints(), b.Ints(), b.Length())));
+        else
+            PushDouble(registers, kernels::Dot(a.Doubles(), b.Doubles(), b.Length()));
+        ++registers._currInstruction;
+    }
+
+    void ConcatStringInstruction(InterpreterRegisters& registers) {
+        int64_t b = registers._stack.back();
+        registers._stack.pop_back();
+        int64_t& top = registers._stack.back();
+        top = StringsOf(registers).Concatenate(top, b);
+        ++registers._currInstruction;
+    }
+
+    void CompareStringLessInstruction(InterpreterRegisters& registers) {
+        int64_t b = registers._stack.back();
+        registers._stack.pop_back();
+        int64_t& top = registers._stack.back();
+        const StringHeap& strings = StringsOf(registers);
+        bool less = strings.View(top) < strings.View(b);
+        top = less;
+        ++registers._currInstruction;
+    }
+
+    void EqualStringInstruction(InterpreterRegisters& registers) {
+        int64_t b = registers._stack.back();
+        registers._stack.pop_back();
+        int64_t& top = registers._stack.back();
+        top = StringsOf(registers).Equal(top, b);
+        ++registers._currInstruction;
+    }
+
+    void PrintValuesInstruction(InterpreterRegisters& registers) {
+        size_t count = registers._currInstruction->p1;
+        uint16_t kinds = uint16_t(registers._currInstruction->p2);
+        const int64_t* values = registers._stack.data() + registers._stack.size() - count;
+
+        // The whole line goes to the sink at once, kept between prints to not allocate.
+        static thread_local string line;
+        line.clear();
+        char number[max(MAX_FORMATTED_INT_LENGTH, MAX_FORMATTED_DOUBLE_LENGTH)];
+        for(size_t x = 0; x < count; ++x) {
+            switch(PrintedKind((kinds >> (2 * x)) & 3)) {
+                case PrintedKind::INT:
+                    line.append(number, FormatInt(values[x], number));
+                    break;
+                case PrintedKind::DOUBLE:
+                    line.append(number, FormatDouble(bit_cast<double>(values[x]), number));
+                    break;
+                default:
+                    line.append(StringsOf(registers).View(values[x]));
+                    break;
+            }
+        }
+        line += '\n';
+
+        registers._stack.resize(registers._stack.size() - count);
+        CurrentOutput().PrintText(line);
+        ++registers._currInstruction;
+    }
+
+    void SaturateInt16Instruction(InterpreterRegisters& registers) {
+        int64_t& top = registers._stack.back();
+        top = clamp<int64_t>(top, INT16_MIN, INT16_MAX);
+        ++registers._currInstruction;
+    }
+
+}
@@ -0,0 +1,144 @@
+#include "../include/JitCode.h"
+#include "../include/JitTemplates.h"
+#include "../include/JitSymbols.h"
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#if !defined(__x86_64__)
+#error "The JIT only generates x86-64 code"
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    static constexpr X86Register ENTRY_RSP = R15; // rsp inside the entry stub, to bail out from any depth
+
+    typedef int (*EntryStub)(int16_t* sp, int16_t* base, int16_t* limit, const uint8_t* target);
+
+    JitCode::JitCode(const Instruction* code, size_t numInstructions, const map<size_t, string>& functionNames)
+        : _source(code, code + numInstructions), _offsets(numInstructions) {
+        RequireNarrowCode(code, numInstructions);
+        X86Emitter emitter;
+
+        // Entry stub: save callee-saved registers, set up the stack registers and
+        // call into the code. Returns 0 after RETURN or EXIT, 1 on overflow.
+        EmitSaveCalleeSaved(emitter);
+        emitter.Move(ENTRY_RSP, RSP);
+        emitter.Move(STACK_POINTER, RDI);
+        emitter.Move(STACK_BASE, RSI);
+        emitter.Move(STACK_LIMIT, RDX);
+        emitter.LoadEffectiveAddress(FRAME_POINTER, STACK_POINTER, JitSlot(1));
+        emitter.CallIndirect(RCX);
+        emitter.Xor32(RAX, RAX);
+        size_t exitLabel = emitter.Size();
+        emitter.Move(RSP, ENTRY_RSP);
+        EmitRestoreCalleeSaved(emitter);
+        emitter.Return();
+
+        size_t overflowLabel = emitter.Size();
+        emitter.MoveImmediate32(RAX, 1);
+        emitter.PatchRelative(emitter.Jump(), exitLabel);
+
+        vector<pair<size_t, size_t>> branches; // rel32 field, target instruction
+        map<size_t, size_t> frameSizes;
+
+        for(size_t x = 0; x < numInstructions; ++x) {
+            const Instruction& currInstruction = code[x];
+            _offsets[x] = uint32_t(emitter.Size());
+
+            if(EmitStraightLineTemplate(emitter, currInstruction))
+                continue;
+
+            switch(currInstruction._opcode) {
+                case EXIT:
+                    emitter.Xor32(RAX, RAX);
+                    emitter.PatchRelative(emitter.Jump(), exitLabel);
+                    break;
+
+                case JUMP_BY_IF_ZERO:
+                    emitter.LoadInt16(RAX, STACK_POINTER, 0);
+                    emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                    emitter.TestInt16(RAX);
+                    branches.emplace_back(emitter.JumpIf(EQUAL), x + currInstruction.p2);
+                    break;
+
+                case JUMP_BY_IF_NOT_LESS:
+                    emitter.LoadInt16(RAX, STACK_POINTER, JitSlot(-1));
+                    emitter.SubImmediate(STACK_POINTER, JitSlot(2));
+                    emitter.CompareInt16(RAX, STACK_POINTER, JitSlot(2));
+                    branches.emplace_back(emitter.JumpIf(NOT_LESS), x + currInstruction.p2);
+                    break;
+
+                case JUMP_BY:
+                    branches.emplace_back(emitter.Jump(), x + currInstruction.p2);
+                    break;
+
+                case CALL: {
+                    size_t target = x + currInstruction.p2;
+                    if(target >= numInstructions)
+                        throw runtime_error("Jump target out of range at instruction " + to_string(x));
+                    auto foundFrameSize = frameSizes.find(target);
+                    if(foundFrameSize == frameSizes.end())
+                        foundFrameSize = frameSizes.emplace(target, FrameSize(target)).first;
+
+                    emitter.PatchRelative(EmitFrameCheck(emitter, foundFrameSize->second), overflowLabel);
+                    EmitEnterFrame(emitter);
+                    branches.emplace_back(emitter.Call(), target);
+                    break;
+                }
+
+                case RETURN:
+                    EmitLeaveFrame(emitter);
+                    emitter.Return();
+                    break;
+
+                default:
+                    throw runtime_error("Invalid opcode at instruction " + to_string(x));
+            }
+        }
+
+        for(auto [field, target] : branches) {
+            if(target >= numInstructions)
+                throw runtime_error("Jump target out of range in JIT code");
+            emitter.PatchRelative(field, _offsets[target]);
+        }
+
+        _memory = ExecutableMemory(emitter.Bytes());
+        if(JitSymbols* symbols = CurrentJitSymbols())
+            symbols->AddFunctions(_memory.Data(), _memory.Size(), _offsets, functionNames);
+    }
+
+    bool JitCode::Enter(int16_t* sp, OperandStack& stack, const uint8_t* target) const {
+        EntryStub entryStub = reinterpret_cast<EntryStub>(const_cast<uint8_t*>(_memory.Data()));
+        return entryStub(sp, stack.Base(), stack.Limit(), target) == 0;
+    }
+
+    void JitExecutor::Run(const JitCode& code, size_t entry, vector<int16_t> args, int16_t* result) {
+        if(entry >= code.Size())
+            throw out_of_range("Entry point outside of the JIT code");
+
+        OperandStack stack;
+        int16_t* sp = stack.Base() - 1;
+
+        // Result slot, arguments, the outermost saved base and the entry frame itself.
+        if(size_t(result != nullptr) + args.size() + 1 + code.FrameSize(entry) > stack.NumSlots())
+            throw StackOverflow();
+
+        if(result) {
+            *++sp = 0;
+        }
+        for(int16_t arg : args) {
+            *++sp = arg;
+        }
+        *++sp = 0;
+
+        if(!code.Enter(sp, stack, code.At(entry)))
+            throw StackOverflow();
+
+        if(result)
+            *result = stack.Base()[0];
+    }
+
+}
@@ -0,0 +1,215 @@
+#include "../include/JitSymbols.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    // Layout from tools/perf/Documentation/jitdump-specification.txt of the Linux sources.
+    static constexpr uint32_t JITDUMP_MAGIC = 0x4A695444;
+    static constexpr uint32_t JITDUMP_VERSION = 1;
+    static constexpr uint32_t ELF_MACHINE_X86_64 = 62;
+    static constexpr uint32_t JIT_CODE_LOAD = 0;
+    static constexpr uint32_t JIT_CODE_CLOSE = 3;
+
+    struct JitdumpHeader {
+        uint32_t _magic;
+        uint32_t _version;
+        uint32_t _totalSize;
+        uint32_t _elfMachine;
+        uint32_t _pad;
+        uint32_t _pid;
+        uint64_t _timestamp;
+        uint64_t _flags;
+    };
+
+    struct JitdumpRecordHeader {
+        uint32_t _id;
+        uint32_t _totalSize;
+        uint64_t _timestamp;
+    };
+
+    // Followed by the name with its terminating zero and then the code.
+    struct JitdumpCodeLoad {
+        JitdumpRecordHeader _header;
+        uint32_t _pid;
+        uint32_t _tid;
+        uint64_t _vma;
+        uint64_t _codeAddress;
+        uint64_t _codeSize;
+        uint64_t _codeIndex;
+    };
+
+    static atomic<JitSymbols*> gCurrentJitSymbols = nullptr;
+
+    // perf record -k mono timestamps samples with the same clock.
+    static uint64_t MonotonicTimestamp() {
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return uint64_t(now.tv_sec) * 1000000000 + uint64_t(now.tv_nsec);
+    }
+
+    static uint32_t ThreadId() {
+#if defined(__linux__)
+        return uint32_t(syscall(SYS_gettid));
+#else
+        return uint32_t(getpid());
+#endif
+    }
+
+    JitSymbols::JitSymbols(bool perfMap, bool jitdump, const string& jitdumpDirectory) {
+        string pid = to_string(getpid());
+        if(perfMap) {
+            string path = "/tmp/perf-" + pid + ".map";
+            _perfMap = fopen(path.c_str(), "w");
+            if(!_perfMap)
+                throw runtime_error("Can't write " + path + ": " + strerror(errno));
+        }
+
+        if(jitdump) {
+            string path = jitdumpDirectory + "/jit-" + pid + ".dump";
+            _jitdump = fopen(path.c_str(), "w+");
+            if(!_jitdump) {
+                string error = strerror(errno);
+                if(_perfMap)
+                    fclose(_perfMap);
+                throw runtime_error("Can't write " + path + ": " + error);
+            }
+
+            JitdumpHeader header{JITDUMP_MAGIC, JITDUMP_VERSION, sizeof(JitdumpHeader), ELF_MACHINE_X86_64, 0,
+                                 uint32_t(getpid()), MonotonicTimestamp(), 0};
+            WriteJitdump(&header, sizeof(header));
+            fflush(_jitdump);
+
+            // perf record only learns about the file through an executable mapping of it.
+            _jitdumpMarkerSize = size_t(sysconf(_SC_PAGESIZE));
+            _jitdumpMarker = mmap(nullptr, _jitdumpMarkerSize, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+                                  fileno(_jitdump), 0);
+            if(_jitdumpMarker == MAP_FAILED)
+                _jitdumpMarker = nullptr;
+        }
+    }
+
+    JitSymbols::~JitSymbols() {
+        JitSymbols* self = this;
+        gCurrentJitSymbols.compare_exchange_strong(self, nullptr);
+
+        if(_perfMap)
+            fclose(_perfMap);
+        if(_jitdump) {
+            JitdumpRecordHeader close{JIT_CODE_CLOSE, sizeof(JitdumpRecordHeader), MonotonicTimestamp()};
+            WriteJitdump(&close, sizeof(close));
+            if(_jitdumpMarker)
+                munmap(_jitdumpMarker, _jitdumpMarkerSize);
+            fclose(_jitdump);
+        }
+    }
+
+    void JitSymbols::WriteJitdump(const void* data, size_t size) {
+        fwrite(data, 1, size, _jitdump);
+    }
+
+    void JitSymbols::WriteCodeLoad(const string& name, const void* start, size_t size) {
+        JitdumpCodeLoad load{};
+        load._header = JitdumpRecordHeader{JIT_CODE_LOAD, uint32_t(sizeof(load) + name.size() + 1 + size),
+                                           MonotonicTimestamp()};
+        load._pid = uint32_t(getpid());
+        load._tid = ThreadId();
+        load._vma = uint64_t(uintptr_t(start));
+        load._codeAddress = load._vma;
+        load._codeSize = size;
+        load._codeIndex = _codeIndex++;
+        WriteJitdump(&load, sizeof(load));
+        WriteJitdump(name.c_str(), name.size() + 1);
+        WriteJitdump(start, size);
+        fflush(_jitdump);
+    }
+
+    void JitSymbols::AddCode(const string& name, const void* start, size_t size) {
+        if(size == 0)
+            return;
+        lock_guard<mutex> lock(_mutex);
+
+        // Flushed per entry, the process may never get to close the files.
+        if(_perfMap) {
+            fprintf(_perfMap, "%llx %zx %s\n", (unsigned long long)uintptr_t(start), size, name.c_str());
+            fflush(_perfMap);
+        }
+        if(_jitdump)
+            WriteCodeLoad(name, start, size);
+    }
+
+    void JitSymbols::AddFunctions(const uint8_t* code, size_t codeSize, const vector<uint32_t>& nativeOffsets,
+                                  const map<size_t, string>& functionNames, const string& suffix) {
+        size_t numInstructions = nativeOffsets.size();
+        if(numInstructions == 0)
+            return;
+
+        // Whatever comes before the first instruction, like an entry stub.
+        AddCode("jit entry" + suffix, code, nativeOffsets[0]);
+
+        vector<size_t> starts{0};
+        for(auto& [start, _] : functionNames) {
+            if(start > 0 && start < numInstructions)
+                starts.push_back(start);
+        }
+        for(size_t x = 0; x < starts.size(); ++x) {
+            size_t begin = nativeOffsets[starts[x]];
+            size_t end = x + 1 < starts.size() ? nativeOffsets[starts[x + 1]] : codeSize;
+            AddCode(FunctionName(functionNames, starts[x]) + suffix, code + begin, end - begin);
+        }
+    }
+
+    void JitSymbols::AddThreadedHandlers(StackCaching caching) {
+        const void* const* handlers = ThreadedInterpreter::HandlerTable(caching);
+        vector<pair<uintptr_t, size_t>> byAddress; // handler address, index
+        for(size_t x = 0; x < ThreadedInterpreter::NumHandlers(caching); ++x)
+            byAddress.emplace_back(uintptr_t(handlers[x]), x);
+        sort(byAddress.begin(), byAddress.end());
+
+        lock_guard<mutex> lock(_mutex);
+        if(!_jitdump)
+            return;
+
+        // Handlers shared between cache states are labelled once, by their first state.
+        string suffix = caching == StackCaching::TOP_OF_STACK ? " handler (top of stack cached)" : " handler";
+        size_t next = 0;
+        for(size_t x = 0; x < byAddress.size(); x = next) {
+            auto [address, handler] = byAddress[x];
+            next = x + 1;
+            while(next < byAddress.size() && byAddress[next].first == address)
+                ++next;
+            if(next == byAddress.size())
+                break;
+            WriteCodeLoad(ThreadedInterpreter::HandlerName(caching, handler) + suffix,
+                          reinterpret_cast<const void*>(address), byAddress[next].first - address);
+        }
+    }
+
+    string FunctionName(const map<size_t, string>& functionNames, size_t offset) {
+        auto next = functionNames.upper_bound(offset);
+        if(next == functionNames.begin())
+            return "function@" + to_string(offset);
+        return prev(next)->second;
+    }
+
+    JitSymbols* CurrentJitSymbols() {
+        return gCurrentJitSymbols.load(memory_order_acquire);
+    }
+
+    JitSymbols* SetJitSymbols(JitSymbols* symbols) {
+        return gCurrentJitSymbols.exchange(symbols, memory_order_acq_rel);
+    }
+
+}
@@ -0,0 +1,151 @@
+#include "../include/JitTemplates.h"
+#include "../include/OutputSink.h"
+#include <cstddef>
+
+namespace interpreter {
+
+    using namespace std;
+
+    static void PrintInt(int64_t number) {
+        CurrentOutput().PrintInt(int16_t(number));
+    }
+
+    void EmitSaveCalleeSaved(X86Emitter& emitter) {
+        emitter.Push(RBX);
+        emitter.Push(RBP);
+        emitter.Push(R12);
+        emitter.Push(R13);
+        emitter.Push(R14);
+        emitter.Push(R15);
+    }
+
+    void EmitRestoreCalleeSaved(X86Emitter& emitter) {
+        emitter.Pop(R15);
+        emitter.Pop(R14);
+        emitter.Pop(R13);
+        emitter.Pop(R12);
+        emitter.Pop(RBP);
+        emitter.Pop(RBX);
+    }
+
+    void EmitLoadState(X86Emitter& emitter) {
+        EmitSaveCalleeSaved(emitter);
+        emitter.Move(JIT_STATE, RDI);
+        emitter.Load(STACK_POINTER, JIT_STATE, offsetof(JitState, _sp));
+        emitter.Load(FRAME_POINTER, JIT_STATE, offsetof(JitState, _fp));
+        emitter.Load(STACK_BASE, JIT_STATE, offsetof(JitState, _base));
+        emitter.Load(STACK_LIMIT, JIT_STATE, offsetof(JitState, _limit));
+    }
+
+    vector<size_t> EmitExitStubs(X86Emitter& emitter, size_t numExits) {
+        vector<size_t> stubs;
+        vector<size_t> commonExitJumps;
+        for(size_t x = 0; x < numExits; ++x) {
+            stubs.push_back(emitter.Size());
+            emitter.MoveImmediate32(RAX, uint32_t(x));
+            commonExitJumps.push_back(emitter.Jump());
+        }
+
+        size_t commonExit = emitter.Size();
+        emitter.Store(JIT_STATE, offsetof(JitState, _sp), STACK_POINTER);
+        emitter.Store(JIT_STATE, offsetof(JitState, _fp), FRAME_POINTER);
+        EmitRestoreCalleeSaved(emitter);
+        emitter.Return();
+
+        for(size_t field : commonExitJumps)
+            emitter.PatchRelative(field, commonExit);
+        return stubs;
+    }
+
+    bool EmitStraightLineTemplate(X86Emitter& emitter, const Instruction& instruction) {
+        switch(instruction._opcode) {
+            case ADD_INT:
+                emitter.LoadInt16(RAX, STACK_POINTER, 0);
+                emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                emitter.AddInt16(STACK_POINTER, 0, RAX);
+                return true;
+
+            case PUSH_INT:
+                emitter.AddImmediate(STACK_POINTER, JitSlot(1));
+                emitter.StoreImmediateInt16(STACK_POINTER, 0, instruction.p2);
+                return true;
+
+            case POP_INT:
+                emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                return true;
+
+            case PRINT_INT:
+                // Generated code doesn't keep rsp aligned, so realign around the call.
+                emitter.LoadSignExtendInt16(RDI, STACK_POINTER, 0);
+                emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                emitter.Move(HELPER_SAVED_RSP, RSP);
+                emitter.AndImmediate(RSP, -16);
+                emitter.MoveImmediate(RAX, uint64_t(&PrintInt));
+                emitter.CallIndirect(RAX);
+                emitter.Move(RSP, HELPER_SAVED_RSP);
+                return true;
+
+            case COMP_INT_LT:
+                emitter.LoadInt16(RAX, STACK_POINTER, JitSlot(-1));
+                emitter.CompareInt16(RAX, STACK_POINTER, 0);
+                emitter.SetLessZeroExtend(RAX);
+                emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                emitter.StoreInt16(STACK_POINTER, 0, RAX);
+                return true;
+
+            case LOAD_INT:
+            case LOAD_INT_BASEPOINTER_RELATIVE:
+                emitter.LoadInt16(RAX, instruction._opcode == LOAD_INT ? STACK_BASE : FRAME_POINTER,
+                                  JitSlot(instruction.p2));
+                emitter.AddImmediate(STACK_POINTER, JitSlot(1));
+                emitter.StoreInt16(STACK_POINTER, 0, RAX);
+                return true;
+
+            case STORE_INT:
+            case STORE_INT_BASEPOINTER_RELATIVE:
+                emitter.LoadInt16(RAX, STACK_POINTER, 0);
+                emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                emitter.StoreInt16(instruction._opcode == STORE_INT ? STACK_BASE : FRAME_POINTER,
+                                   JitSlot(instruction.p2), RAX);
+                return true;
+
+            case INC_INT_BASEPOINTER_RELATIVE:
+                emitter.AddImmediateInt16(FRAME_POINTER, JitSlot(instruction.p2), int8_t(instruction.p1));
+                return true;
+
+            case ADD_INT_IMMEDIATE:
+                emitter.AddImmediateInt16(STACK_POINTER, 0, instruction.p2);
+                return true;
+
+            case POP_INT_N:
+                emitter.SubImmediate(STACK_POINTER, JitSlot(instruction.p2));
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    size_t EmitFrameCheck(X86Emitter& emitter, size_t frameSize) {
+        emitter.Move(RAX, STACK_LIMIT);
+        emitter.Sub(RAX, STACK_POINTER);
+        emitter.CompareImmediate(RAX, JitSlot(int32_t(frameSize) + 2));
+        return emitter.JumpIf(BELOW);
+    }
+
+    void EmitEnterFrame(X86Emitter& emitter) {
+        emitter.Move(RAX, FRAME_POINTER);
+        emitter.Sub(RAX, STACK_BASE);
+        emitter.ShiftRightArithmetic(RAX, 1);
+        emitter.AddImmediate(STACK_POINTER, JitSlot(1));
+        emitter.StoreInt16(STACK_POINTER, 0, RAX);
+        emitter.LoadEffectiveAddress(FRAME_POINTER, STACK_POINTER, JitSlot(1));
+    }
+
+    void EmitLeaveFrame(X86Emitter& emitter) {
+        emitter.LoadSignExtendInt16(RAX, STACK_POINTER, 0);
+        emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+        emitter.LoadEffectiveAddress(FRAME_POINTER, STACK_BASE, RAX, sizeof(int16_t));
+    }
+
+}
@@ -0,0 +1,266 @@
+#include "../include/LockstepInterpreter.h"
+#include "../include/OperandStack.h"
+#include "../include/OutputSink.h"
+#include "../include/VM.h"
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define LOCKSTEP_SIMD 1
+#define LOCKSTEP_TARGET __attribute__((target("avx2,bmi2")))
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+#if LOCKSTEP_SIMD
+    // One stack slot of all lanes, laid out as an __m256i.
+    struct alignas(32) LaneSlot {
+        int16_t _lanes[LockstepInterpreter::NUM_LANES];
+    };
+
+    // Lane masks are uint32_t with bit n for lane n, or vectors with all ones in the selected lanes.
+    LOCKSTEP_TARGET static inline __m256i LaneMask(uint32_t lanes) {
+        const __m256i laneBits = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192,
+                                                   16384, int16_t(0x8000));
+        return _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(int16_t(lanes)), laneBits), laneBits);
+    }
+
+    LOCKSTEP_TARGET static inline uint32_t LaneBits(__m256i mask) {
+        return _pext_u32(uint32_t(_mm256_movemask_epi8(mask)), 0xAAAAAAAA);
+    }
+
+    LOCKSTEP_TARGET static inline void Write(__m256i& slot, __m256i value, __m256i mask) {
+        slot = _mm256_blendv_epi8(slot, value, mask);
+    }
+
+    // Runs until every lane in alive returned. pcs holds each lane's instruction offset.
+    LOCKSTEP_TARGET static void ExecuteLanes(const Instruction* code, const ptrdiff_t* depths, __m256i* stack,
+                                             size_t framePointer, uint32_t alive, uint32_t* pcs) {
+        __m256i* const fp = stack + framePointer;
+
+        while(alive) {
+            uint32_t pc = UINT32_MAX;
+            for(uint32_t lanes = alive; lanes; lanes &= lanes - 1)
+                pc = min(pc, pcs[__builtin_ctz(lanes)]);
+
+            // The group runs until it branches apart, finishes, or reaches the lowest waiting lane.
+            uint32_t group = 0;
+            uint32_t nextWaiting = UINT32_MAX;
+            for(uint32_t lanes = alive; lanes; lanes &= lanes - 1) {
+                int lane = __builtin_ctz(lanes);
+                if(pcs[lane] == pc)
+                    group |= 1u << lane;
+                else
+                    nextWaiting = min(nextWaiting, pcs[lane]);
+            }
+            __m256i mask = LaneMask(group);
+
+            while(true) {
+                if(pc == nextWaiting) {
+                    nextWaiting = UINT32_MAX;
+                    for(uint32_t lanes = alive & ~group; lanes; lanes &= lanes - 1) {
+                        int lane = __builtin_ctz(lanes);
+                        if(pcs[lane] == pc)
+                            group |= 1u << lane;
+                        else
+                            nextWaiting = min(nextWaiting, pcs[lane]);
+                    }
+                    mask = LaneMask(group);
+                }
+
+                const Instruction& currInstruction = code[pc];
+                __m256i* const sp = fp + depths[pc] - 1;
+                uint32_t jumping = 0;
+
+                switch(currInstruction._opcode) {
+                    case ADD_INT:
+                        Write(sp[-1], _mm256_add_epi16(sp[-1], sp[0]), mask);
+                        ++pc;
+                        break;
+
+                    case PUSH_INT:
+                        Write(sp[1], _mm256_set1_epi16(currInstruction.p2), mask);
+                        ++pc;
+                        break;
+
+                    case POP_INT:
+                    case POP_INT_N:
+                        ++pc;
+                        break;
+
+                    case PRINT_INT: {
+                        alignas(32) int16_t values[16];
+                        _mm256_store_si256(reinterpret_cast<__m256i*>(values), sp[0]);
+                        for(uint32_t lanes = group; lanes; lanes &= lanes - 1)
+                            CurrentOutput().PrintInt(values[__builtin_ctz(lanes)]);
+                        ++pc;
+                        break;
+                    }
+
+                    case COMP_INT_LT:
+                        Write(sp[-1], _mm256_srli_epi16(_mm256_cmpgt_epi16(sp[0], sp[-1]), 15), mask);
+                        ++pc;
+                        break;
+
+                    case LOAD_INT:
+                        Write(sp[1], stack[currInstruction.p2], mask);
+                        ++pc;
+                        break;
+
+                    case STORE_INT:
+                        Write(stack[currInstruction.p2], sp[0], mask);
+                        ++pc;
+                        break;
+
+                    case LOAD_INT_BASEPOINTER_RELATIVE:
+                        Write(sp[1], fp[currInstruction.p2], mask);
+                        ++pc;
+                        break;
+
+                    case STORE_INT_BASEPOINTER_RELATIVE:
+                        Write(fp[currInstruction.p2], sp[0], mask);
+                        ++pc;
+                        break;
+
+                    case INC_INT_BASEPOINTER_RELATIVE:
+                        Write(fp[currInstruction.p2], _mm256_add_epi16(fp[currInstruction.p2],
+                                                                       _mm256_set1_epi16(int8_t(currInstruction.p1))),
+                              mask);
+                        ++pc;
+                        break;
+
+                    case ADD_INT_IMMEDIATE:
+                        Write(sp[0], _mm256_add_epi16(sp[0], _mm256_set1_epi16(currInstruction.p2)), mask);
+                        ++pc;
+                        break;
+
+                    case JUMP_BY:
+                        pc += currInstruction.p2;
+                        break;
+
+                    case JUMP_BY_IF_ZERO:
+                        jumping = LaneBits(_mm256_cmpeq_epi16(sp[0], _mm256_setzero_si256())) & group;
+                        break;
+
+                    case JUMP_BY_IF_NOT_LESS:
+                        jumping = ~LaneBits(_mm256_cmpgt_epi16(sp[0], sp[-1])) & group;
+                        break;
+
+                    case RETURN:
+                    case EXIT:
+                        alive &= ~group;
+                        group = 0;
+                        break;
+
+                    default:
+                        throw runtime_error("Lockstep execution can't run instruction " + to_string(pc));
+                }
+
+                if(currInstruction._opcode == JUMP_BY_IF_ZERO || currInstruction._opcode == JUMP_BY_IF_NOT_LESS) {
+                    uint32_t target = pc + currInstruction.p2;
+                    if(jumping == group) {
+                        pc = target;
+                    } else if(jumping == 0) {
+                        ++pc;
+                    } else {
+                        // Divergence: every lane continues from its own offset.
+                        for(uint32_t lanes = group; lanes; lanes &= lanes - 1) {
+                            int lane = __builtin_ctz(lanes);
+                            pcs[lane] = (jumping >> lane) & 1 ? target : pc + 1;
+                        }
+                        break;
+                    }
+                }
+
+                if(group == 0)
+                    break;
+                // Jumped past a waiting lane, which now has the lowest offset.
+                if(pc > nextWaiting) {
+                    for(uint32_t lanes = group; lanes; lanes &= lanes - 1)
+                        pcs[__builtin_ctz(lanes)] = pc;
+                    break;
+                }
+            }
+        }
+    }
+#endif
+
+    LockstepInterpreter::LockstepInterpreter(const Instruction* code, size_t numInstructions, size_t entry)
+        : _source(code, code + numInstructions), _entry(entry), _vectorized(false) {
+        RequireNarrowCode(code, numInstructions);
+        if(entry >= numInstructions)
+            throw out_of_range("Entry point outside of the code");
+
+        for(size_t x = 0; x < numInstructions; ++x) {
+            const Instruction& currInstruction = code[x];
+            if(currInstruction._opcode >= NUM_INSTRUCTIONS)
+                throw runtime_error("Invalid opcode at instruction " + to_string(x));
+
+            if(currInstruction._opcode == JUMP_BY_IF_ZERO || currInstruction._opcode == JUMP_BY
+               || currInstruction._opcode == CALL || currInstruction._opcode == JUMP_BY_IF_NOT_LESS) {
+                ptrdiff_t target = ptrdiff_t(x) + currInstruction.p2;
+                if(target < 0 || size_t(target) >= numInstructions)
+                    throw runtime_error("Jump target out of range at instruction " + to_string(x));
+            }
+        }
+
+        ComputeStackDepths(code, numInstructions, entry, _depths);
+        _frameSize = FrameSize(code, numInstructions, entry);
+
+#if LOCKSTEP_SIMD
+        // Lanes in different callees would need a frame pointer each.
+        bool makesCalls = false;
+        for(size_t x = 0; x < numInstructions; ++x)
+            makesCalls = makesCalls || (_depths[x] != UNKNOWN_DEPTH && code[x]._opcode == CALL);
+        _vectorized = !makesCalls && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+#endif
+    }
+
+    vector<int16_t> LockstepInterpreter::Run(span<const vector<int16_t>> argumentSets) {
+        vector<int16_t> results(argumentSets.size());
+
+        if(!_vectorized) {
+            VM vm;
+            for(size_t x = 0; x < argumentSets.size(); ++x)
+                results[x] = vm.Call(_source.data() + _entry, argumentSets[x]);
+            return results;
+        }
+
+#if LOCKSTEP_SIMD
+        size_t numArgs = argumentSets.empty() ? 0 : argumentSets[0].size();
+        for(const vector<int16_t>& args : argumentSets) {
+            if(args.size() != numArgs)
+                throw invalid_argument("Lockstep argument sets need the same number of arguments");
+        }
+
+        // Result slot, arguments, the outermost saved base, then the frame.
+        size_t framePointer = 1 + numArgs + 1;
+        vector<LaneSlot> stack(framePointer + _frameSize);
+
+        for(size_t first = 0; first < argumentSets.size(); first += NUM_LANES) {
+            size_t numLanes = min(NUM_LANES, argumentSets.size() - first);
+            stack[0] = LaneSlot{};
+            for(size_t arg = 0; arg < numArgs; ++arg) {
+                stack[1 + arg] = LaneSlot{};
+                for(size_t lane = 0; lane < numLanes; ++lane)
+                    stack[1 + arg]._lanes[lane] = argumentSets[first + lane][arg];
+            }
+            stack[framePointer - 1] = LaneSlot{};
+
+            uint32_t pcs[NUM_LANES];
+            for(uint32_t& pc : pcs)
+                pc = uint32_t(_entry);
+            ExecuteLanes(_source.data(), _depths.data(), reinterpret_cast<__m256i*>(stack.data()), framePointer,
+                         numLanes == NUM_LANES ? 0xFFFF : (1u << numLanes) - 1, pcs);
+
+            for(size_t lane = 0; lane < numLanes; ++lane)
+                results[first + lane] = stack[0]._lanes[lane];
+        }
+#endif
+        return results;
+    }
+
+}
@@ -0,0 +1,239 @@
+#include "../include/ManagedHeap.h"
+#include "../include/Interpreter.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace interpreter {
+
+    using namespace std;
+
+    static constexpr uint8_t FORWARDED = 1;
+    static constexpr uint8_t LARGE = 2;
+    static constexpr uint8_t MARKED = 4;
+
+    void HeapStatistics::Print(ostream& out) const {
+        uint64_t collections = _minorCollections + _majorCollections;
+        out << _minorCollections << " minor and " << _majorCollections << " major collections, "
+            << _promotedBytes << " bytes promoted\n";
+        if(collections > 0) {
+            out << "Pauses: " << chrono::duration<double, micro>(_totalPause).count() / double(collections)
+                << " us on average, " << chrono::duration<double, micro>(_maxPause).count() << " us at most\n";
+        }
+    }
+
+    void ManagedHeap::SetStackMaps(const StackMaps* maps, const Instruction* code) {
+        _maps = maps;
+        _code = code;
+    }
+
+    ObjectHeader* ManagedHeap::AllocateSlow(ObjectKind kind, size_t size) {
+        if(size > MAX_SMALL_OBJECT_SIZE) {
+            _largeObjects.emplace_back(new uint8_t[size]);
+            _ranges.emplace(_largeObjects.back().get(), size);
+            auto object = reinterpret_cast<ObjectHeader*>(_largeObjects.back().get());
+            *object = ObjectHeader{size, kind, LARGE};
+            _oldBytes += size;
+            if(_maps && _oldBytes >= _majorThreshold)
+                _collectionRequested = true;
+            return object;
+        }
+
+        // Past the nursery proper, allocation goes on until the next safepoint collects.
+        if(_maps && !_nursery.empty())
+            _collectionRequested = true;
+        _nursery.push_back(TakeChunk());
+        _nurseryTop = _nursery.back().get();
+        _nurseryEnd = _nurseryTop + CHUNK_SIZE;
+        return Allocate(kind, size);
+    }
+
+    ObjectHeader* ManagedHeap::AllocateOld(size_t size) {
+        if(size > size_t(_oldEnd - _oldTop)) {
+            _old.push_back(TakeChunk());
+            _oldTop = _old.back().get();
+            _oldEnd = _oldTop + CHUNK_SIZE;
+        }
+        auto object = reinterpret_cast<ObjectHeader*>(_oldTop);
+        _oldTop += size;
+        _oldBytes += size;
+        return object;
+    }
+
+    ManagedHeap::Chunk ManagedHeap::TakeChunk() {
+        Chunk chunk;
+        if(_freeChunks.empty()) {
+            chunk.reset(new uint8_t[CHUNK_SIZE]);
+        } else {
+            chunk = std::move(_freeChunks.back());
+            _freeChunks.pop_back();
+        }
+        _ranges.emplace(chunk.get(), CHUNK_SIZE);
+        return chunk;
+    }
+
+    void ManagedHeap::RecycleChunk(Chunk chunk) {
+        _ranges.erase(chunk.get());
+        if(_freeChunks.size() < MAX_FREE_CHUNKS)
+            _freeChunks.push_back(std::move(chunk));
+    }
+
+    bool ManagedHeap::InNursery(const ObjectHeader* object) const {
+        auto address = reinterpret_cast<const uint8_t*>(object);
+        for(auto& chunk : _nursery) {
+            if(address >= chunk.get() && address < chunk.get() + CHUNK_SIZE)
+                return true;
+        }
+        return false;
+    }
+
+    size_t ManagedHeap::BytesFrom(const void* address) const {
+        auto start = reinterpret_cast<const uint8_t*>(address);
+        // The last range starting at or before address.
+        auto found = _ranges.upper_bound(start);
+        if(found == _ranges.begin())
+            return 0;
+        --found;
+        size_t offset = size_t(start - found->first);
+        return offset < found->second ? found->second - offset : 0;
+    }
+
+    void ManagedHeap::Collect(InterpreterRegisters& registers) {
+        if(!_maps)
+            return;
+        const StackMap* stackMap = _maps->At(size_t(registers._currInstruction - _code));
+        if(!stackMap)
+            return;
+
+        // From the top frame down to the one the run started with, which the host
+        // called. A frame of a function without stack maps means no collection until
+        // the nursery overflows again.
+        vector<pair<size_t, const StackMap*>> frames;
+        size_t base = registers._baseIdx;
+        size_t end = registers._stack.size();
+        for(size_t frame = registers._returnAdressStack.size();;) {
+            if(stackMap->_frameSize != end - base)
+                throw logic_error("The stack map of a frame doesn't match its " + to_string(end - base) + " slots");
+            frames.emplace_back(base, stackMap);
+
+            const Instruction* returnAddress = frame > 0 ? registers._returnAdressStack[--frame] : nullptr;
+            if(!returnAddress)
+                break;
+            stackMap = _maps->At(size_t(returnAddress - 1 - _code));
+            if(!stackMap) {
+                _collectionRequested = false;
+                return;
+            }
+            end = base - 1;
+            base = size_t(registers._stack[base - 1]);
+        }
+
+        auto start = chrono::steady_clock::now();
+        bool major = _oldBytes >= _majorThreshold;
+        vector<Chunk> fromSpace;
+        if(major) {
+            fromSpace = std::move(_old);
+            _old.clear();
+            _oldTop = _oldEnd = nullptr;
+            _oldBytes = 0;
+        }
+
+        for(auto [frameBase, frameMap] : frames) {
+            for(auto [slot, kind] : frameMap->_references)
+                EvacuateSlot(registers._stack[frameBase + slot], kind, major);
+        }
+
+        // The nursery proper stays, the chunks that held what didn't fit in it are reused.
+        for(size_t x = 1; x < _nursery.size(); ++x)
+            RecycleChunk(std::move(_nursery[x]));
+        if(_nursery.size() > 1)
+            _nursery.erase(_nursery.begin() + 1, _nursery.end());
+        _nurseryTop = _nursery.empty() ? nullptr : _nursery[0].get();
+        _nurseryEnd = _nursery.empty() ? nullptr : _nurseryTop + CHUNK_SIZE;
+
+        if(major) {
+            for(auto& chunk : fromSpace)
+                RecycleChunk(std::move(chunk));
+            SweepLargeObjects();
+            _majorThreshold = max(MIN_MAJOR_THRESHOLD, 2 * _oldBytes);
+            ++_statistics._majorCollections;
+        } else {
+            ++_statistics._minorCollections;
+        }
+        _collectionRequested = false;
+
+        auto pause = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        _statistics._totalPause += pause;
+        _statistics._maxPause = max(_statistics._maxPause, pause);
+    }
+
+    void ManagedHeap::EvacuateSlot(int64_t& slot, SlotKind kind, bool major) {
+        if(kind == SlotKind::STRING) {
+            // Only strings that are neither inline nor literals are in the heap, see Strings.h.
+            if((slot & 3) != 3)
+                return;
+            auto object = reinterpret_cast<ObjectHeader*>(slot & ~int64_t(3));
+            slot = reinterpret_cast<int64_t>(Evacuate(object, major)) | 3;
+        } else if(slot != 0) {
+            slot = reinterpret_cast<int64_t>(Evacuate(reinterpret_cast<ObjectHeader*>(slot), major));
+        }
+    }
+
+    ObjectHeader* ManagedHeap::Evacuate(ObjectHeader* object, bool major) {
+        if(object->_flags & FORWARDED)
+            return reinterpret_cast<ObjectHeader*>(object->_size);
+        if(object->_flags & LARGE) {
+            if(major)
+                object->_flags |= MARKED;
+            return object;
+        }
+        if(!major && !InNursery(object))
+            return object;
+
+        size_t size = object->_size;
+        ObjectHeader* copy = AllocateOld(size);
+        memcpy(copy, object, size);
+        if(InNursery(object))
+            _statistics._promotedBytes += size;
+        object->_flags |= FORWARDED;
+        object->_size = reinterpret_cast<uint64_t>(copy);
+        return copy;
+    }
+
+    void ManagedHeap::SweepLargeObjects() {
+        auto unmarked = partition(_largeObjects.begin(), _largeObjects.end(), [](const Chunk& memory) {
+            return reinterpret_cast<const ObjectHeader*>(memory.get())->_flags & MARKED;
+        });
+        for(auto memory = unmarked; memory != _largeObjects.end(); ++memory)
+            _ranges.erase(memory->get());
+        _largeObjects.erase(unmarked, _largeObjects.end());
+        for(auto& memory : _largeObjects) {
+            auto object = reinterpret_cast<ObjectHeader*>(memory.get());
+            object->_flags &= uint8_t(~MARKED);
+            _oldBytes += object->_size;
+        }
+    }
+
+    void ManagedHeap::Clear() {
+        for(size_t x = 1; x < _nursery.size(); ++x)
+            RecycleChunk(std::move(_nursery[x]));
+        if(_nursery.size() > 1)
+            _nursery.erase(_nursery.begin() + 1, _nursery.end());
+        _nurseryTop = _nursery.empty() ? nullptr : _nursery[0].get();
+        _nurseryEnd = _nursery.empty() ? nullptr : _nurseryTop + CHUNK_SIZE;
+
+        for(auto& chunk : _old)
+            RecycleChunk(std::move(chunk));
+        _old.clear();
+        _oldTop = _oldEnd = nullptr;
+        for(auto& memory : _largeObjects)
+            _ranges.erase(memory.get());
+        _largeObjects.clear();
+
+        _oldBytes = 0;
+        _majorThreshold = MIN_MAJOR_THRESHOLD;
+        _collectionRequested = false;
+    }
+
+}
@@ -0,0 +1,113 @@
+#include "../include/OpcodeNgrams.h"
+#include "../include/Interpreter.h"
+#include "../include/VM.h"
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+namespace interpreter {
+
+    using namespace std;
+
+    void OpcodeNgrams::Record(Instruction* code, size_t numInstructions, size_t entry, vector<int16_t> args,
+                              int16_t* result) {
+        if(entry >= numInstructions)
+            throw out_of_range("Entry point outside of the code");
+
+        InterpreterRegisters registers{{}, {}, code + entry, 0};
+        if(result)
+            registers._stack.push_back(0);
+        registers._stack.insert(registers._stack.end(), args.begin(), args.end());
+        registers._stack.push_back(0);
+        registers._returnAdressStack.push_back(nullptr);
+        registers._baseIdx = registers._stack.size();
+
+        Record(registers, code, numInstructions);
+        if(result)
+            *result = int16_t(registers._stack[0]);
+    }
+
+    void OpcodeNgrams::Record(VM& vm, Instruction* code, size_t numInstructions, size_t entry,
+                              span<const int64_t> args, int64_t* result) {
+        if(entry >= numInstructions)
+            throw out_of_range("Entry point outside of the code");
+
+        const ConstantPool* constants = vm.Constants();
+        vm.Heap().Clear();
+        InterpreterRegisters registers{{}, {}, code + entry, 0};
+        registers._constants = constants ? constants->Data() : nullptr;
+        registers._numConstants = constants ? constants->Size() : 0;
+        registers._heap = &vm.Heap();
+        registers._strings = &vm.Strings();
+        registers._stack.reserve(args.size() + 2); // the result, the arguments and the saved base
+        if(result)
+            registers._stack.push_back(0);
+        registers._stack.insert(registers._stack.end(), args.begin(), args.end());
+        registers._stack.push_back(0);
+        registers._returnAdressStack.push_back(nullptr);
+        registers._baseIdx = registers._stack.size();
+
+        Record(registers, code, numInstructions);
+        if(result)
+            *result = registers._stack[0];
+    }
+
+    void OpcodeNgrams::Record(InterpreterRegisters& registers, Instruction* code, size_t numInstructions) {
+        vector<bool> isJumpTarget(numInstructions, false);
+        for(size_t x = 0; x < numInstructions; ++x) {
+            Opcode opcode = code[x]._opcode;
+            if(opcode == JUMP_BY_IF_ZERO || opcode == JUMP_BY || opcode == JUMP_BY_IF_NOT_LESS || opcode == CALL) {
+                ptrdiff_t target = ptrdiff_t(x) + code[x].p2;
+                if(target >= 0 && size_t(target) < numInstructions)
+                    isJumpTarget[target] = true;
+            }
+        }
+
+        deque<Opcode> window;
+        const Instruction* previous = nullptr;
+
+        while(registers._currInstruction != nullptr) {
+            const Instruction* current = registers._currInstruction;
+            if(current < code || current >= code + numInstructions)
+                throw runtime_error("Instruction pointer left the code while recording opcode n-grams");
+
+            size_t offset = size_t(current - code);
+            if(current != previous + 1 || isJumpTarget[offset])
+                window.clear();
+
+            window.push_back(current->_opcode);
+            if(window.size() > _maxLength)
+                window.pop_front();
+
+            // Every suffix of the window is a sequence ending here.
+            vector<Opcode> sequence;
+            for(auto opcode = window.rbegin(); opcode != window.rend(); ++opcode) {
+                sequence.insert(sequence.begin(), *opcode);
+                if(sequence.size() >= 2)
+                    ++_counts[sequence];
+            }
+
+            previous = current;
+            gInstructionFunctions[current->_opcode](registers);
+        }
+    }
+
+    void OpcodeNgrams::Print(ostream& out, size_t maxEntries) const {
+        vector<pair<uint64_t, const vector<Opcode>*>> ranked;
+        for(auto& [sequence, count] : _counts)
+            ranked.emplace_back(count * (sequence.size() - 1), &sequence);
+
+        sort(ranked.begin(), ranked.end(), [](auto& a, auto& b) { return a.first > b.first; });
+        if(ranked.size() > maxEntries)
+            ranked.resize(maxEntries);
+
+        for(auto& [saved, sequence] : ranked) {
+            out << _counts.at(*sequence) << "x, saves " << saved << " dispatches:";
+            for(Opcode opcode : *sequence)
+                out << " " << gOpcodeNames[opcode];
+            out << "\n";
+        }
+    }
+
+}
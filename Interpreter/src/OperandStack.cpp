@@ -0,0 +1,112 @@
+#include "../include/OperandStack.h"
+#include <vector>
+
+namespace interpreter {
+
+    using namespace std;
+
+    OperandStack::OperandStack(size_t numSlots) : _numSlots(numSlots) {
+        if(numSlots == 0 || numSlots > MAX_NUM_SLOTS)
+            throw invalid_argument("Operand stack size must be between 1 and 32768 slots");
+
+        _slots.reset(new int16_t[numSlots]);
+        _returnAddresses.reset(new const void*[numSlots]);
+    }
+
+    void ComputeStackDepths(const Instruction* code, size_t numInstructions, size_t entry,
+                            vector<ptrdiff_t>& depths) {
+        // Code from generateCodeForFunction has the same depth on every path into an
+        // instruction, so each one only needs to be visited once.
+        depths.resize(numInstructions, UNKNOWN_DEPTH);
+        vector<pair<size_t, ptrdiff_t>> pending{{entry, 0}};
+
+        while(!pending.empty()) {
+            auto [offset, depth] = pending.back();
+            pending.pop_back();
+
+            while(offset < numInstructions && depths[offset] == UNKNOWN_DEPTH) {
+                depths[offset] = depth;
+                const Instruction& currInstruction = code[offset];
+
+                switch(currInstruction._opcode) {
+                    case EXIT:
+                    case RETURN:
+                        offset = numInstructions;
+                        continue;
+                    case PUSH_INT:
+                    case PUSH_CONST:
+                    case LOAD_INT:
+                    case LOAD_INT_BASEPOINTER_RELATIVE:
+                        ++depth;
+                        break;
+                    case JUMP_BY:
+                        offset += currInstruction.p2;
+                        continue;
+                    case JUMP_BY_IF_ZERO:
+                        --depth;
+                        pending.emplace_back(offset + currInstruction.p2, depth);
+                        break;
+                    case JUMP_BY_IF_NOT_LESS:
+                        depth -= 2;
+                        pending.emplace_back(offset + currInstruction.p2, depth);
+                        break;
+                    case POP_INT_N:
+                        depth -= currInstruction.p2;
+                        break;
+                    case PRINT_VALUES:
+                        depth -= currInstruction.p1;
+                        break;
+                    case CALL:
+                        // The saved base slot the call pushes is popped again by RETURN.
+                    case INC_INT_BASEPOINTER_RELATIVE:
+                    case ADD_INT_IMMEDIATE:
+                    case INT_TO_DOUBLE:
+                    case DOUBLE_TO_INT:
+                    case SATURATE_INT16:
+                    case NEW_ARRAY:
+                    case ARRAY_LENGTH:
+                    case ARRAY_SUM:
+                    case ARRAY_MIN:
+                    case ARRAY_MAX:
+                        break;
+                    case ARRAY_STORE_INT:
+                    case ARRAY_STORE_DOUBLE:
+                    case ARRAY_ADD:
+                    case ARRAY_MUL:
+                        depth -= 3;
+                        break;
+                    default:
+                        --depth;
+                        break;
+                }
+                ++offset;
+            }
+        }
+    }
+
+    size_t FrameSize(const Instruction* code, size_t numInstructions, size_t entry) {
+        vector<ptrdiff_t> depths;
+        ComputeStackDepths(code, numInstructions, entry, depths);
+
+        ptrdiff_t maxDepth = 0;
+        for(size_t x = 0; x < numInstructions; ++x) {
+            if(depths[x] == UNKNOWN_DEPTH)
+                continue;
+
+            switch(code[x]._opcode) {
+                case PUSH_INT:
+                case PUSH_CONST:
+                case LOAD_INT:
+                case LOAD_INT_BASEPOINTER_RELATIVE:
+                case CALL: // the callee's saved base slot
+                    maxDepth = max(maxDepth, depths[x] + 1);
+                    break;
+                default:
+                    maxDepth = max(maxDepth, depths[x]);
+                    break;
+            }
+        }
+        return size_t(maxDepth);
+    }
+
+}
@@ -0,0 +1,145 @@
+#include "../include/OutputSink.h"
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <cstring>
+#include <iostream>
+
+namespace interpreter {
+
+    using namespace std;
+
+    static const char gDigitPairs[] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899";
+
+    static const char gPrefix[] = "Number printed: ";
+    static constexpr size_t PREFIX_LENGTH = sizeof(gPrefix) - 1;
+    static constexpr size_t MAX_LINE_LENGTH =
+            PREFIX_LENGTH + max(MAX_FORMATTED_INT_LENGTH, MAX_FORMATTED_DOUBLE_LENGTH) + 1;
+
+    static thread_local OutputSink* gCurrentOutput = nullptr;
+
+    size_t FormatInt(int64_t number, char* buffer) {
+        // Digits are produced two at a time from the end of a scratch buffer.
+        char digits[MAX_FORMATTED_INT_LENGTH];
+        char* end = digits + sizeof(digits);
+        char* out = end;
+        uint64_t magnitude = number < 0 ? 0 - uint64_t(number) : uint64_t(number);
+
+        while(magnitude >= 100) {
+            out -= 2;
+            memcpy(out, gDigitPairs + (magnitude % 100) * 2, 2);
+            magnitude /= 100;
+        }
+        if(magnitude >= 10) {
+            out -= 2;
+            memcpy(out, gDigitPairs + magnitude * 2, 2);
+        } else {
+            *--out = char('0' + magnitude);
+        }
+
+        size_t length = 0;
+        if(number < 0)
+            buffer[length++] = '-';
+        memcpy(buffer + length, out, size_t(end - out));
+        return length + size_t(end - out);
+    }
+
+    size_t FormatDouble(double number, char* buffer) {
+        return size_t(to_chars(buffer, buffer + MAX_FORMATTED_DOUBLE_LENGTH, number).ptr - buffer);
+    }
+
+    BufferedOutput::BufferedOutput(ostream& stream, FlushPolicy policy, size_t capacity)
+        : _stream(stream), _policy(policy), _buffer(max(capacity, MAX_LINE_LENGTH)) {
+    }
+
+    BufferedOutput::~BufferedOutput() {
+        Flush();
+    }
+
+    void BufferedOutput::PrintInt(int64_t number) {
+        if(_buffer.size() - _used < MAX_LINE_LENGTH)
+            Flush();
+
+        char* out = _buffer.data() + _used;
+        memcpy(out, gPrefix, PREFIX_LENGTH);
+        size_t length = PREFIX_LENGTH + FormatInt(number, out + PREFIX_LENGTH);
+        out[length++] = '\n';
+        _used += length;
+
+        if(_policy == FlushPolicy::EVERY_PRINT)
+            Flush();
+    }
+
+    void BufferedOutput::PrintDouble(double number) {
+        if(_buffer.size() - _used < MAX_LINE_LENGTH)
+            Flush();
+
+        char* out = _buffer.data() + _used;
+        memcpy(out, gPrefix, PREFIX_LENGTH);
+        size_t length = PREFIX_LENGTH + FormatDouble(number, out + PREFIX_LENGTH);
+        out[length++] = '\n';
+        _used += length;
+
+        if(_policy == FlushPolicy::EVERY_PRINT)
+            Flush();
+    }
+
+    void BufferedOutput::PrintText(string_view text) {
+        if(_buffer.size() - _used < text.size())
+            Flush();
+
+        // Text longer than the buffer goes to the stream directly.
+        if(text.size() > _buffer.size()) {
+            _stream.write(text.data(), streamsize(text.size()));
+            _stream.flush();
+            return;
+        }
+        memcpy(_buffer.data() + _used, text.data(), text.size());
+        _used += text.size();
+
+        if(_policy == FlushPolicy::EVERY_PRINT)
+            Flush();
+    }
+
+    void BufferedOutput::Flush() {
+        if(_used == 0)
+            return;
+        _stream.write(_buffer.data(), streamsize(_used));
+        _stream.flush();
+        _used = 0;
+    }
+
+    void CollectingOutput::PrintDouble(double number) {
+        if(!_doubles)
+            throw runtime_error("Printed a double where only integers are collected");
+        _doubles->push_back(number);
+    }
+
+    void CollectingOutput::PrintText(string_view text) {
+        if(!_texts)
+            throw runtime_error("Printed text where only numbers are collected");
+        _texts->emplace_back(text);
+    }
+
+    OutputSink& CurrentOutput() {
+        static thread_local BufferedOutput defaultOutput(cout, FlushPolicy::EVERY_PRINT, MAX_LINE_LENGTH);
+        return gCurrentOutput ? *gCurrentOutput : defaultOutput;
+    }
+
+    OutputSink* SetOutputSink(OutputSink* sink) {
+        OutputSink* previous = gCurrentOutput;
+        gCurrentOutput = sink;
+        return previous;
+    }
+
+}
@@ -0,0 +1,93 @@
+#include "../include/Peephole.h"
+#include <stdexcept>
+#include <string>
+
+namespace interpreter {
+
+    using namespace std;
+
+    static bool IsRelativeJump(Opcode opcode) {
+        return opcode == JUMP_BY_IF_ZERO || opcode == JUMP_BY || opcode == JUMP_BY_IF_NOT_LESS || opcode == CALL;
+    }
+
+    vector<Instruction> OptimizePeephole(const vector<Instruction>& code, vector<size_t>* newOffsets) {
+        size_t numInstructions = code.size();
+        vector<bool> isJumpTarget(numInstructions, false);
+
+        for(size_t x = 0; x < numInstructions; ++x) {
+            if(!IsRelativeJump(code[x]._opcode))
+                continue;
+            ptrdiff_t target = ptrdiff_t(x) + code[x].p2;
+            if(target < 0 || size_t(target) >= numInstructions)
+                throw runtime_error("Jump target out of range at instruction " + to_string(x));
+            isJumpTarget[target] = true;
+        }
+
+        // A sequence of length n starting at x can be fused if it fits and nothing
+        // jumps into its middle.
+        auto fusable = [&](size_t x, size_t length) {
+            if(x + length > numInstructions)
+                return false;
+            for(size_t y = x + 1; y < x + length; ++y) {
+                if(isJumpTarget[y])
+                    return false;
+            }
+            return true;
+        };
+
+        vector<Instruction> optimized;
+        vector<size_t> offsetOf(numInstructions + 1);
+        vector<size_t> jumpTargets; // old target of every relative jump in optimized, by index
+
+        optimized.reserve(numInstructions);
+        jumpTargets.reserve(numInstructions);
+
+        for(size_t x = 0; x < numInstructions;) {
+            const Instruction& currInstruction = code[x];
+            Instruction fused = currInstruction;
+            size_t length = 1;
+            size_t jumpTarget = 0;
+
+            if(currInstruction._opcode == LOAD_INT_BASEPOINTER_RELATIVE && fusable(x, 4)
+               && code[x + 1]._opcode == PUSH_INT && code[x + 1].p2 >= INT8_MIN && code[x + 1].p2 <= INT8_MAX
+               && code[x + 2]._opcode == ADD_INT
+               && code[x + 3]._opcode == STORE_INT_BASEPOINTER_RELATIVE && code[x + 3].p2 == currInstruction.p2) {
+                fused = Instruction{INC_INT_BASEPOINTER_RELATIVE, uint8_t(int8_t(code[x + 1].p2)), currInstruction.p2};
+                length = 4;
+            } else if(currInstruction._opcode == COMP_INT_LT && fusable(x, 2)
+                      && code[x + 1]._opcode == JUMP_BY_IF_ZERO) {
+                fused = Instruction{JUMP_BY_IF_NOT_LESS, 0, 0};
+                jumpTarget = x + 1 + code[x + 1].p2;
+                length = 2;
+            } else if(currInstruction._opcode == PUSH_INT && fusable(x, 2) && code[x + 1]._opcode == ADD_INT) {
+                fused = Instruction{ADD_INT_IMMEDIATE, 0, currInstruction.p2};
+                length = 2;
+            } else if(currInstruction._opcode == POP_INT) {
+                while(fusable(x, length + 1) && code[x + length]._opcode == POP_INT && length < INT16_MAX)
+                    ++length;
+                if(length > 1)
+                    fused = Instruction{POP_INT_N, 0, int16_t(length)};
+            } else if(IsRelativeJump(currInstruction._opcode)) {
+                jumpTarget = x + currInstruction.p2;
+            }
+
+            for(size_t y = x; y < x + length; ++y)
+                offsetOf[y] = optimized.size();
+            optimized.push_back(fused);
+            jumpTargets.push_back(jumpTarget);
+            x += length;
+        }
+        offsetOf[numInstructions] = optimized.size();
+
+        // Code only gets shorter, so the new distances still fit in p2.
+        for(size_t x = 0; x < optimized.size(); ++x) {
+            if(IsRelativeJump(optimized[x]._opcode))
+                optimized[x].p2 = int16_t(ptrdiff_t(offsetOf[jumpTargets[x]]) - ptrdiff_t(x));
+        }
+
+        if(newOffsets)
+            *newOffsets = std::move(offsetOf);
+        return optimized;
+    }
+
+}
@@ -0,0 +1,166 @@
+#include "../include/PerfCounters.h"
+#include <algorithm>
+#include <iomanip>
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    const char* gPerfEventNames[NUM_PERF_EVENTS] = {
+            "cycles",
+            "instructions",
+            "branch-misses",
+            "L1i-misses",
+            "L1d-misses",
+    };
+
+#if defined(__linux__)
+    static int OpenEvent(PerfEvent event) {
+        perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        // With more events than hardware counters the kernel multiplexes them, so scopes scale.
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        const uint64_t readMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        switch(event) {
+            case PERF_CYCLES:
+                attributes.type = PERF_TYPE_HARDWARE;
+                attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case PERF_INSTRUCTIONS:
+                attributes.type = PERF_TYPE_HARDWARE;
+                attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case PERF_BRANCH_MISSES:
+                attributes.type = PERF_TYPE_HARDWARE;
+                attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            case PERF_L1I_MISSES:
+                attributes.type = PERF_TYPE_HW_CACHE;
+                attributes.config = PERF_COUNT_HW_CACHE_L1I | readMiss;
+                break;
+            case PERF_L1D_MISSES:
+                attributes.type = PERF_TYPE_HW_CACHE;
+                attributes.config = PERF_COUNT_HW_CACHE_L1D | readMiss;
+                break;
+            default:
+                return -1;
+        }
+
+        return int(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+    }
+#endif
+
+    PerfCounters::PerfCounters(bool enabled, ostream* dumpAtExit) : _dumpAtExit(dumpAtExit) {
+        for(size_t x = 0; x < NUM_PERF_EVENTS; ++x) {
+            _fds[x] = -1;
+#if defined(__linux__)
+            if(enabled)
+                _fds[x] = OpenEvent(PerfEvent(x));
+#endif
+        }
+    }
+
+    PerfCounters::~PerfCounters() {
+        if(_dumpAtExit)
+            Print(*_dumpAtExit);
+#if defined(__linux__)
+        for(int fd : _fds) {
+            if(fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+
+    void PerfCounters::Read(PerfReading readings[NUM_PERF_EVENTS]) const {
+        for(size_t x = 0; x < NUM_PERF_EVENTS; ++x) {
+            readings[x] = PerfReading();
+#if defined(__linux__)
+            uint64_t reading[3]; // value, time enabled, time running
+            if(_fds[x] >= 0 && read(_fds[x], reading, sizeof(reading)) == ssize_t(sizeof(reading)))
+                readings[x] = PerfReading{reading[0], reading[1], reading[2]};
+#endif
+        }
+    }
+
+    PerfCounters::Scope PerfCounters::Measure(const string& phase) {
+        auto foundPhase = _phases.find(phase);
+        if(foundPhase == _phases.end()) {
+            foundPhase = _phases.emplace(phase, PerfCounts()).first;
+            _order.push_back(phase);
+        }
+        return Scope(this, &foundPhase->second);
+    }
+
+    PerfCounters::Scope::Scope(PerfCounters* counters, PerfCounts* counts) : _counters(counters), _counts(counts) {
+        _counters->Read(_start);
+    }
+
+    PerfCounters::Scope::~Scope() {
+        PerfReading end[NUM_PERF_EVENTS];
+        _counters->Read(end);
+        // Only the scope's own share of enabled and running time scales its count,
+        // the ratio over the whole life of the event may differ.
+        for(size_t x = 0; x < NUM_PERF_EVENTS; ++x) {
+            uint64_t counted = end[x]._value - _start[x]._value;
+            uint64_t enabled = end[x]._timeEnabled - _start[x]._timeEnabled;
+            uint64_t running = end[x]._timeRunning - _start[x]._timeRunning;
+            if(running > 0)
+                _counts->_values[x] += uint64_t(double(counted) * double(enabled) / double(running));
+        }
+        ++_counts->_runs;
+    }
+
+    void PerfCounters::Print(ostream& out) const {
+        ios_base::fmtflags flags = out.flags();
+        streamsize precision = out.precision();
+        bool anyAvailable = false;
+        for(size_t x = 0; x < NUM_PERF_EVENTS; ++x)
+            anyAvailable = anyAvailable || Available(PerfEvent(x));
+        if(!anyAvailable) {
+            out << "Hardware performance counters are not available\n";
+            out.flush();
+            return;
+        }
+
+        size_t nameWidth = 5;
+        for(const string& phase : _order)
+            nameWidth = max(nameWidth, phase.size());
+        int phaseWidth = int(nameWidth) + 2;
+
+        out << left << setw(phaseWidth) << "phase" << right;
+        for(size_t x = 0; x < NUM_PERF_EVENTS; ++x)
+            out << setw(16) << gPerfEventNames[x];
+        out << setw(8) << "IPC" << "\n";
+
+        for(const string& phase : _order) {
+            const PerfCounts& counts = _phases.at(phase);
+            out << left << setw(phaseWidth) << phase << right;
+            for(size_t x = 0; x < NUM_PERF_EVENTS; ++x) {
+                if(Available(PerfEvent(x)))
+                    out << setw(16) << counts._values[x];
+                else
+                    out << setw(16) << "n/a";
+            }
+
+            if(Available(PERF_CYCLES) && Available(PERF_INSTRUCTIONS) && counts._values[PERF_CYCLES])
+                out << setw(8) << fixed << setprecision(2)
+                    << double(counts._values[PERF_INSTRUCTIONS]) / double(counts._values[PERF_CYCLES]);
+            out << "\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+        out.flush();
+    }
+
+}
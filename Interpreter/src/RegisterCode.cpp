@@ -0,0 +1,369 @@
+#include "../include/RegisterCode.h"
+#include <stdexcept>
+#include <string>
+
+namespace interpreter {
+
+    using namespace std;
+
+    namespace {
+        // What the stack code would have in a slot at this point. Only HOME values
+        // are actually in the slot's register; the others have not been moved
+        // there because nothing needed them to be yet.
+        struct VirtualSlot {
+            enum Kind { HOME, REGISTER, IMMEDIATE } _kind;
+            int16_t _value; // the register for REGISTER, the constant for IMMEDIATE
+        };
+
+        class Translator {
+        public:
+            Translator(const Instruction* code, size_t numInstructions,
+                       vector<RegisterInstruction>& out, vector<uint32_t>& indexOf)
+                : _code(code), _numInstructions(numInstructions), _out(out), _indexOf(indexOf) {}
+
+            void Translate();
+
+        private:
+            void Emit(RegisterOpcode opcode, int16_t a, int16_t b, int16_t c) {
+                _out.push_back(RegisterInstruction{opcode, a, b, c});
+            }
+
+            void EmitBranch(RegisterOpcode opcode, int16_t a, int16_t b, size_t target) {
+                _branches.emplace_back(_out.size(), target);
+                Emit(opcode, a, b, 0);
+            }
+
+            int16_t Top() const { return int16_t(_stack.size()); }
+
+            VirtualSlot Pop() {
+                if(_stack.empty())
+                    throw runtime_error("Stack underflow while translating instruction " + to_string(_offset));
+                VirtualSlot slot = _stack.back();
+                _stack.pop_back();
+                return slot;
+            }
+
+            void Materialize(size_t slot);
+            void MaterializeAll();
+            void MaterializeReadersOf(int16_t reg);
+            int16_t RegisterFor(const VirtualSlot& slot, int16_t home);
+            bool LastInstructionDefines(int16_t reg) const;
+
+            const Instruction* _code;
+            size_t _numInstructions;
+            vector<RegisterInstruction>& _out;
+            vector<uint32_t>& _indexOf;
+            vector<VirtualSlot> _stack;
+            vector<pair<size_t, size_t>> _branches; // emitted branch, original target offset
+            size_t _offset = 0;
+            bool _lastIsTemporary = false; // the last emitted instruction only defines a temporary
+        };
+
+        void Translator::Materialize(size_t slot) {
+            VirtualSlot& virtualSlot = _stack[slot];
+            if(virtualSlot._kind == VirtualSlot::REGISTER && virtualSlot._value != int16_t(slot))
+                Emit(R_MOVE, int16_t(slot), virtualSlot._value, 0);
+            else if(virtualSlot._kind == VirtualSlot::IMMEDIATE)
+                Emit(R_LOAD_IMM, int16_t(slot), 0, virtualSlot._value);
+            virtualSlot._kind = VirtualSlot::HOME;
+        }
+
+        void Translator::MaterializeAll() {
+            for(size_t slot = 0; slot < _stack.size(); ++slot)
+                Materialize(slot);
+        }
+
+        // Called before reg is overwritten, so pending reads of its old value stay correct.
+        void Translator::MaterializeReadersOf(int16_t reg) {
+            for(size_t slot = 0; slot < _stack.size(); ++slot) {
+                if(_stack[slot]._kind == VirtualSlot::REGISTER && _stack[slot]._value == reg)
+                    Materialize(slot);
+            }
+        }
+
+        // Register holding the value of slot, which was just popped from home.
+        int16_t Translator::RegisterFor(const VirtualSlot& slot, int16_t home) {
+            switch(slot._kind) {
+                case VirtualSlot::HOME:
+                    return home;
+                case VirtualSlot::REGISTER:
+                    return slot._value;
+                case VirtualSlot::IMMEDIATE:
+                default:
+                    MaterializeReadersOf(home);
+                    Emit(R_LOAD_IMM, home, 0, slot._value);
+                    return home;
+            }
+        }
+
+        bool Translator::LastInstructionDefines(int16_t reg) const {
+            return _lastIsTemporary && !_out.empty() && _out.back().a == reg;
+        }
+
+        void Translator::Translate() {
+            vector<bool> isJumpTarget(_numInstructions, false);
+            vector<ptrdiff_t> depths(_numInstructions, UNKNOWN_DEPTH);
+
+            for(size_t x = 0; x < _numInstructions; ++x) {
+                const Instruction& currInstruction = _code[x];
+                if(currInstruction._opcode >= NUM_INSTRUCTIONS)
+                    throw runtime_error("Invalid opcode at instruction " + to_string(x));
+
+                if(currInstruction._opcode == JUMP_BY_IF_ZERO || currInstruction._opcode == JUMP_BY
+                   || currInstruction._opcode == CALL || currInstruction._opcode == JUMP_BY_IF_NOT_LESS) {
+                    ptrdiff_t target = ptrdiff_t(x) + currInstruction.p2;
+                    if(target < 0 || size_t(target) >= _numInstructions)
+                        throw runtime_error("Jump target out of range at instruction " + to_string(x));
+                    isJumpTarget[target] = true;
+                }
+            }
+
+            // Functions start at the beginning, after every RETURN and at call targets.
+            for(size_t x = 0; x < _numInstructions; ++x) {
+                if(x == 0 || _code[x - 1]._opcode == RETURN || _code[x - 1]._opcode == EXIT
+                   || (isJumpTarget[x] && depths[x] == UNKNOWN_DEPTH))
+                    ComputeStackDepths(_code, _numInstructions, x, depths);
+            }
+
+            bool fallsThrough = false;
+            for(_offset = 0; _offset < _numInstructions; ++_offset) {
+                const Instruction& currInstruction = _code[_offset];
+                ptrdiff_t depth = depths[_offset];
+
+                if(depth == UNKNOWN_DEPTH) {
+                    // Unreachable, nothing to translate.
+                    _indexOf[_offset] = uint32_t(_out.size());
+                    fallsThrough = false;
+                    continue;
+                }
+
+                if(!fallsThrough || isJumpTarget[_offset]) {
+                    if(fallsThrough)
+                        MaterializeAll();
+                    _stack.assign(size_t(max<ptrdiff_t>(depth, 0)), VirtualSlot{VirtualSlot::HOME, 0});
+                    _lastIsTemporary = false;
+                } else if(ptrdiff_t(_stack.size()) != depth) {
+                    throw runtime_error("Inconsistent stack depth at instruction " + to_string(_offset));
+                }
+
+                _indexOf[_offset] = uint32_t(_out.size());
+                size_t emittedBefore = _out.size();
+                bool definesTemporary = false;
+                fallsThrough = true;
+
+                switch(currInstruction._opcode) {
+                    case EXIT:
+                        Emit(R_EXIT, 0, 0, 0);
+                        fallsThrough = false;
+                        break;
+
+                    case ADD_INT:
+                    case COMP_INT_LT: {
+                        bool add = currInstruction._opcode == ADD_INT;
+                        VirtualSlot rightHandSide = Pop();
+                        VirtualSlot leftHandSide = Pop();
+                        int16_t home = Top();
+
+                        if(leftHandSide._kind == VirtualSlot::IMMEDIATE && rightHandSide._kind == VirtualSlot::IMMEDIATE) {
+                            int16_t folded = add ? int16_t(leftHandSide._value + rightHandSide._value)
+                                                 : int16_t(leftHandSide._value < rightHandSide._value);
+                            _stack.push_back(VirtualSlot{VirtualSlot::IMMEDIATE, folded});
+                            break;
+                        }
+
+                        if(add && leftHandSide._kind == VirtualSlot::IMMEDIATE)
+                            swap(leftHandSide, rightHandSide);
+
+                        int16_t leftRegister = RegisterFor(leftHandSide, home);
+                        MaterializeReadersOf(home);
+                        if(rightHandSide._kind == VirtualSlot::IMMEDIATE) {
+                            Emit(add ? R_ADD_IMM : R_LESS_IMM, home, leftRegister, rightHandSide._value);
+                        } else {
+                            int16_t rightRegister = RegisterFor(rightHandSide, int16_t(home + 1));
+                            Emit(add ? R_ADD : R_LESS, home, leftRegister, rightRegister);
+                        }
+                        _stack.push_back(VirtualSlot{VirtualSlot::HOME, 0});
+                        definesTemporary = true;
+                        break;
+                    }
+
+                    case PUSH_INT:
+                        _stack.push_back(VirtualSlot{VirtualSlot::IMMEDIATE, currInstruction.p2});
+                        break;
+
+                    case POP_INT:
+                        Pop();
+                        break;
+
+                    case PRINT_INT: {
+                        VirtualSlot value = Pop();
+                        Emit(R_PRINT, RegisterFor(value, Top()), 0, 0);
+                        break;
+                    }
+
+                    case LOAD_INT:
+                        // Absolute slots can alias anything, so everything goes to memory first.
+                        MaterializeAll();
+                        Emit(R_LOAD_ABSOLUTE, Top(), 0, currInstruction.p2);
+                        _stack.push_back(VirtualSlot{VirtualSlot::HOME, 0});
+                        break;
+
+                    case STORE_INT: {
+                        VirtualSlot value = Pop();
+                        int16_t valueRegister = RegisterFor(value, Top());
+                        MaterializeAll();
+                        Emit(R_STORE_ABSOLUTE, valueRegister, 0, currInstruction.p2);
+                        break;
+                    }
+
+                    case LOAD_INT_BASEPOINTER_RELATIVE: {
+                        int16_t reg = currInstruction.p2;
+                        if(reg >= 0 && reg < Top())
+                            Materialize(size_t(reg));
+                        _stack.push_back(VirtualSlot{VirtualSlot::REGISTER, reg});
+                        break;
+                    }
+
+                    case STORE_INT_BASEPOINTER_RELATIVE: {
+                        int16_t reg = currInstruction.p2;
+                        VirtualSlot value = Pop();
+                        int16_t home = Top();
+
+                        if(value._kind == VirtualSlot::REGISTER && value._value == reg)
+                            break;
+
+                        MaterializeReadersOf(reg);
+                        if(value._kind == VirtualSlot::HOME && _out.size() == emittedBefore
+                           && LastInstructionDefines(home)) {
+                            // Compute straight into the destination instead of moving there.
+                            _out.back().a = reg;
+                        } else if(value._kind == VirtualSlot::IMMEDIATE) {
+                            Emit(R_LOAD_IMM, reg, 0, value._value);
+                        } else {
+                            Emit(R_MOVE, reg, RegisterFor(value, home), 0);
+                        }
+
+                        if(reg >= 0 && reg < Top())
+                            _stack[size_t(reg)]._kind = VirtualSlot::HOME;
+                        break;
+                    }
+
+                    case JUMP_BY_IF_ZERO: {
+                        size_t target = _offset + currInstruction.p2;
+                        VirtualSlot condition = Pop();
+                        int16_t home = Top();
+
+                        if(condition._kind == VirtualSlot::HOME && _out.size() == emittedBefore
+                           && LastInstructionDefines(home)
+                           && (_out.back()._opcode == R_LESS || _out.back()._opcode == R_LESS_IMM)) {
+                            // Fuse the comparison into the branch. Materializing the rest of the
+                            // stack only writes slots the comparison does not read.
+                            RegisterInstruction compare = _out.back();
+                            _out.pop_back();
+                            MaterializeAll();
+                            EmitBranch(compare._opcode == R_LESS ? R_JUMP_IF_NOT_LESS : R_JUMP_IF_NOT_LESS_IMM,
+                                       compare.b, compare.c, target);
+                            break;
+                        }
+
+                        int16_t conditionRegister = RegisterFor(condition, home);
+                        MaterializeAll();
+                        EmitBranch(R_JUMP_IF_ZERO, conditionRegister, 0, target);
+                        break;
+                    }
+
+                    case JUMP_BY:
+                        MaterializeAll();
+                        EmitBranch(R_JUMP, 0, 0, _offset + currInstruction.p2);
+                        fallsThrough = false;
+                        break;
+
+                    case CALL: {
+                        size_t target = _offset + currInstruction.p2;
+                        MaterializeAll();
+                        size_t frameSize = FrameSize(_code, _numInstructions, target);
+                        if(frameSize > OperandStack::MAX_NUM_SLOTS)
+                            throw runtime_error("Frame too large at instruction " + to_string(_offset));
+                        EmitBranch(R_CALL, Top(), int16_t(frameSize), target);
+                        break;
+                    }
+
+                    case RETURN:
+                        MaterializeAll();
+                        Emit(R_RETURN, 0, 0, 0);
+                        fallsThrough = false;
+                        break;
+
+                    case INC_INT_BASEPOINTER_RELATIVE: {
+                        int16_t reg = currInstruction.p2;
+                        MaterializeReadersOf(reg);
+                        if(reg >= 0 && reg < Top())
+                            Materialize(size_t(reg));
+                        Emit(R_ADD_IMM, reg, reg, int8_t(currInstruction.p1));
+                        break;
+                    }
+
+                    case ADD_INT_IMMEDIATE: {
+                        VirtualSlot value = Pop();
+                        int16_t home = Top();
+
+                        if(value._kind == VirtualSlot::IMMEDIATE) {
+                            _stack.push_back(VirtualSlot{VirtualSlot::IMMEDIATE,
+                                                         int16_t(value._value + currInstruction.p2)});
+                            break;
+                        }
+
+                        int16_t valueRegister = RegisterFor(value, home);
+                        MaterializeReadersOf(home);
+                        Emit(R_ADD_IMM, home, valueRegister, currInstruction.p2);
+                        _stack.push_back(VirtualSlot{VirtualSlot::HOME, 0});
+                        definesTemporary = true;
+                        break;
+                    }
+
+                    case JUMP_BY_IF_NOT_LESS: {
+                        size_t target = _offset + currInstruction.p2;
+                        VirtualSlot rightHandSide = Pop();
+                        VirtualSlot leftHandSide = Pop();
+                        int16_t home = Top();
+
+                        int16_t leftRegister = RegisterFor(leftHandSide, home);
+                        if(rightHandSide._kind == VirtualSlot::IMMEDIATE) {
+                            MaterializeAll();
+                            EmitBranch(R_JUMP_IF_NOT_LESS_IMM, leftRegister, rightHandSide._value, target);
+                        } else {
+                            int16_t rightRegister = RegisterFor(rightHandSide, int16_t(home + 1));
+                            MaterializeAll();
+                            EmitBranch(R_JUMP_IF_NOT_LESS, leftRegister, rightRegister, target);
+                        }
+                        break;
+                    }
+
+                    case POP_INT_N:
+                        for(int16_t x = 0; x < currInstruction.p2; ++x)
+                            Pop();
+                        break;
+
+                    default:
+                        throw runtime_error("Unsupported opcode at instruction " + to_string(_offset));
+                }
+
+                _lastIsTemporary = definesTemporary;
+            }
+
+            for(auto [branch, target] : _branches) {
+                ptrdiff_t distance = ptrdiff_t(_indexOf[target]) - ptrdiff_t(branch);
+                if(distance < INT16_MIN || distance > INT16_MAX)
+                    throw runtime_error("Branch distance out of range in register code");
+                _out[branch].c = int16_t(distance);
+            }
+        }
+    }
+
+    RegisterCode::RegisterCode(const Instruction* code, size_t numInstructions)
+        : _source(code, code + numInstructions), _indexOf(numInstructions) {
+        RequireNarrowCode(code, numInstructions);
+        Translator(code, numInstructions, _instructions, _indexOf).Translate();
+    }
+
+}
@@ -0,0 +1,156 @@
+#include "../include/RegisterCode.h"
+#include "../include/OutputSink.h"
+#include <stdexcept>
+
+#if !defined(__GNUC__)
+#error "The register interpreter needs computed goto (GCC or Clang)"
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    static void Execute(const RegisterInstruction* ip, OperandStack& stack, int16_t* sp) {
+        static const void* const handlers[] = {
+                &&exit,
+                &&move,
+                &&loadImm,
+                &&add,
+                &&addImm,
+                &&less,
+                &&lessImm,
+                &&print,
+                &&loadAbsolute,
+                &&storeAbsolute,
+                &&jump,
+                &&jumpIfZero,
+                &&jumpIfNotLess,
+                &&jumpIfNotLessImm,
+                &&call,
+                &&ret,
+        };
+        static_assert(sizeof(handlers) / sizeof(handlers[0]) == NUM_REGISTER_INSTRUCTIONS,
+                      "Every register opcode needs a handler");
+
+        int16_t* const base = stack.Base();
+        int16_t* const limit = stack.Limit();
+        int16_t* fp = sp + 1;
+        const RegisterInstruction** returnAddress =
+                reinterpret_cast<const RegisterInstruction**>(stack.ReturnAddresses());
+        *returnAddress = nullptr;
+
+#define DISPATCH() goto *handlers[ip->_opcode]
+
+        DISPATCH();
+
+    exit:
+        return;
+
+    move:
+        fp[ip->a] = fp[ip->b];
+        ++ip;
+        DISPATCH();
+
+    loadImm:
+        fp[ip->a] = ip->c;
+        ++ip;
+        DISPATCH();
+
+    add:
+        fp[ip->a] = int16_t(fp[ip->b] + fp[ip->c]);
+        ++ip;
+        DISPATCH();
+
+    addImm:
+        fp[ip->a] = int16_t(fp[ip->b] + ip->c);
+        ++ip;
+        DISPATCH();
+
+    less:
+        fp[ip->a] = fp[ip->b] < fp[ip->c];
+        ++ip;
+        DISPATCH();
+
+    lessImm:
+        fp[ip->a] = fp[ip->b] < ip->c;
+        ++ip;
+        DISPATCH();
+
+    print:
+        CurrentOutput().PrintInt(fp[ip->a]);
+        ++ip;
+        DISPATCH();
+
+    loadAbsolute:
+        fp[ip->a] = base[ip->c];
+        ++ip;
+        DISPATCH();
+
+    storeAbsolute:
+        base[ip->c] = fp[ip->a];
+        ++ip;
+        DISPATCH();
+
+    jump:
+        ip += ip->c;
+        DISPATCH();
+
+    jumpIfZero:
+        ip += fp[ip->a] == 0 ? ip->c : 1;
+        DISPATCH();
+
+    jumpIfNotLess:
+        ip += fp[ip->a] < fp[ip->b] ? 1 : ip->c;
+        DISPATCH();
+
+    jumpIfNotLessImm:
+        ip += fp[ip->a] < ip->b ? 1 : ip->c;
+        DISPATCH();
+
+    call: {
+        int16_t* savedBase = fp + ip->a;
+        if(size_t(ip->b) + 1 > size_t(limit - savedBase))
+            throw StackOverflow();
+        *savedBase = int16_t(fp - base);
+        *++returnAddress = ip + 1;
+        fp = savedBase + 1;
+        ip += ip->c;
+        DISPATCH();
+    }
+
+    ret:
+        ip = *returnAddress--;
+        fp = base + fp[-1];
+        if(!ip)
+            return;
+        DISPATCH();
+
+#undef DISPATCH
+    }
+
+    void RegisterInterpreter::Run(const RegisterCode& code, size_t entry, vector<int16_t> args, int16_t* result) {
+        if(entry >= code.Size())
+            throw out_of_range("Entry point outside of the register code");
+
+        OperandStack stack;
+        int16_t* sp = stack.Base() - 1;
+
+        // Result slot, arguments, the outermost saved base and the entry frame itself.
+        if(size_t(result != nullptr) + args.size() + 1 + code.FrameSize(entry) > stack.NumSlots())
+            throw StackOverflow();
+
+        if(result) {
+            *++sp = 0;
+        }
+        for(int16_t arg : args) {
+            *++sp = arg;
+        }
+        *++sp = 0;
+
+        Execute(code.At(entry), stack, sp);
+
+        if(result)
+            *result = stack.Base()[0];
+    }
+
+}
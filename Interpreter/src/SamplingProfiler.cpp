@@ -0,0 +1,166 @@
+#include "../include/SamplingProfiler.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <sys/time.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+// Older C libraries only have the union member.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    static atomic<SamplingProfiler*> gActiveSampler = nullptr;
+    static struct sigaction gPreviousAction;
+
+    SamplingProfiler::SamplingProfiler(const Instruction* code, size_t codeSize, chrono::microseconds interval)
+        : _code(code), _interval(interval), _hits(codeSize) {
+    }
+
+    SamplingProfiler::~SamplingProfiler() {
+        Stop();
+    }
+
+    void SamplingProfiler::OnSample(int) {
+        // Runs in the signal handler: only lock-free atomics and reads of the watched pointer.
+        SamplingProfiler* profiler = gActiveSampler.load(memory_order_relaxed);
+        if(!profiler)
+            return;
+
+        Instruction* const volatile* watched = profiler->_watched.load(memory_order_acquire);
+        uintptr_t instruction = watched ? uintptr_t(*watched) : 0;
+        uintptr_t offset = (instruction - uintptr_t(profiler->_code)) / sizeof(Instruction);
+        if(instruction >= uintptr_t(profiler->_code) && offset < profiler->_hits.size())
+            profiler->_hits[offset].fetch_add(1, memory_order_relaxed);
+        else
+            profiler->_otherSamples.fetch_add(1, memory_order_relaxed);
+    }
+
+    void SamplingProfiler::Start() {
+        if(_running)
+            return;
+        SamplingProfiler* expected = nullptr;
+        if(!gActiveSampler.compare_exchange_strong(expected, this))
+            throw runtime_error("Another sampling profiler is already running");
+
+        struct sigaction action{};
+        action.sa_handler = OnSample;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, &gPreviousAction);
+
+        long seconds = long(_interval.count() / 1000000);
+        long microseconds = long(_interval.count() % 1000000);
+#if defined(__linux__)
+        sigevent event{};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_notify_thread_id = pid_t(syscall(SYS_gettid));
+        itimerspec period{{seconds, microseconds * 1000}, {seconds, microseconds * 1000}};
+        bool started = timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &_timer) == 0;
+        if(started && timer_settime(_timer, 0, &period, nullptr) != 0) {
+            int error = errno;
+            timer_delete(_timer);
+            errno = error;
+            started = false;
+        }
+#else
+        itimerval period{{seconds, int(microseconds)}, {seconds, int(microseconds)}};
+        bool started = setitimer(ITIMER_PROF, &period, nullptr) == 0;
+#endif
+        if(!started) {
+            string error = strerror(errno);
+            sigaction(SIGPROF, &gPreviousAction, nullptr);
+            gActiveSampler = nullptr;
+            throw runtime_error("Can't start the sampling timer: " + error);
+        }
+        _running = true;
+    }
+
+    void SamplingProfiler::Stop() {
+        if(!_running)
+            return;
+#if defined(__linux__)
+        timer_delete(_timer);
+#else
+        itimerval stopped{};
+        setitimer(ITIMER_PROF, &stopped, nullptr);
+#endif
+        sigaction(SIGPROF, &gPreviousAction, nullptr);
+        gActiveSampler = nullptr;
+        _running = false;
+    }
+
+    uint64_t SamplingProfiler::Samples() const {
+        uint64_t samples = OtherSamples();
+        for(auto& hits : _hits)
+            samples += hits.load(memory_order_relaxed);
+        return samples;
+    }
+
+    vector<uint64_t> SamplingProfiler::Hits() const {
+        vector<uint64_t> hits;
+        hits.reserve(_hits.size());
+        for(auto& instructionHits : _hits)
+            hits.push_back(instructionHits.load(memory_order_relaxed));
+        return hits;
+    }
+
+    map<uint32_t, uint64_t> SamplingProfiler::HitsByLine(const SourceLineTable& lines) const {
+        map<uint32_t, uint64_t> byLine;
+        for(size_t offset = 0; offset < _hits.size(); ++offset) {
+            uint64_t hits = _hits[offset].load(memory_order_relaxed);
+            if(hits != 0)
+                byLine[lines.LineAt(offset)] += hits;
+        }
+        return byLine;
+    }
+
+    void SamplingProfiler::Print(ostream& out, const SourceLineTable& lines, string_view source,
+                                 size_t maxLines) const {
+        vector<string_view> sourceLines;
+        for(size_t start = 0; start <= source.size();) {
+            size_t end = min(source.find('\n', start), source.size());
+            sourceLines.push_back(source.substr(start, end - start));
+            start = end + 1;
+        }
+
+        map<uint32_t, uint64_t> byLine = HitsByLine(lines);
+        vector<pair<uint32_t, uint64_t>> ranked(byLine.begin(), byLine.end());
+        sort(ranked.begin(), ranked.end(), [](auto& a, auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+
+        uint64_t samples = Samples();
+        out << samples << " samples, " << OtherSamples() << " outside script code\n";
+        if(samples == 0)
+            return;
+
+        ios_base::fmtflags flags = out.flags();
+        streamsize precision = out.precision();
+        out << setw(6) << "line" << setw(10) << "samples" << setw(8) << "%" << "  source\n";
+        for(size_t x = 0; x < ranked.size() && x < maxLines; ++x) {
+            auto [line, hits] = ranked[x];
+            string_view text = line > 0 && line <= sourceLines.size() ? sourceLines[line - 1] : string_view();
+            text.remove_prefix(min(text.find_first_not_of(" \t"), text.size()));
+
+            out << setw(6) << (line > 0 ? to_string(line) : string("?")) << setw(10) << hits
+                << setw(7) << fixed << setprecision(1) << 100.0 * double(hits) / double(samples) << "%"
+                << "  " << text << "\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+}
@@ -0,0 +1,29 @@
+#include "../include/SourceLineTable.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace interpreter {
+
+    using namespace std;
+
+    void SourceLineTable::Mark(size_t offset, uint32_t line) {
+        if(!_entries.empty() && offset < _entries.back()._offset)
+            throw runtime_error("Source lines have to be marked in code order");
+
+        // A statement that generated no code leaves its mark to the next one.
+        if(!_entries.empty() && _entries.back()._offset == offset)
+            _entries.pop_back();
+        if(!_entries.empty() && _entries.back()._line == line)
+            return;
+        _entries.push_back(Entry{uint32_t(offset), line});
+    }
+
+    uint32_t SourceLineTable::LineAt(size_t offset) const {
+        auto next = upper_bound(_entries.begin(), _entries.end(), offset,
+                                [](size_t offset, const Entry& entry) { return offset < entry._offset; });
+        if(next == _entries.begin())
+            return 0;
+        return prev(next)->_line;
+    }
+
+}
@@ -0,0 +1,203 @@
+#include "../include/StackMaps.h"
+#include <stdexcept>
+#include <string>
+
+namespace interpreter {
+
+    using namespace std;
+
+    static void Pop(vector<SlotKind>& slots, size_t count, size_t offset) {
+        if(count > slots.size())
+            throw logic_error("Stack underflow at " + to_string(offset));
+        slots.resize(slots.size() - count);
+    }
+
+    static void SetTop(vector<SlotKind>& slots, SlotKind kind, size_t offset) {
+        if(slots.empty())
+            throw logic_error("Stack underflow at " + to_string(offset));
+        slots.back() = kind;
+    }
+
+    static StackMap MapOf(const vector<SlotKind>& slots) {
+        StackMap stackMap{slots.size(), {}};
+        for(size_t x = 0; x < slots.size(); ++x) {
+            if(slots[x] != SlotKind::VALUE)
+                stackMap._references.emplace_back(uint32_t(x), slots[x]);
+        }
+        return stackMap;
+    }
+
+    void StackMaps::AddFunction(const Instruction* code, size_t numInstructions, size_t entry,
+                                const vector<SlotKind>& parameters, const map<size_t, CalleeShape>& callees) {
+        // The kinds of the frame's slots on entry of every instruction reached so far.
+        // An instruction is visited again whenever one of them gets a reference kind.
+        vector<vector<SlotKind>> kinds(numInstructions);
+        vector<bool> reached(numInstructions, false);
+        vector<size_t> pending{entry};
+        reached[entry] = true;
+        bool consistent = true;
+
+        auto flowTo = [&](size_t target, const vector<SlotKind>& slots, size_t from) {
+            if(target >= numInstructions)
+                throw logic_error("A jump out of the code at " + to_string(from));
+            if(!reached[target]) {
+                reached[target] = true;
+                kinds[target] = slots;
+                pending.push_back(target);
+                return;
+            }
+            vector<SlotKind>& known = kinds[target];
+            // Like after a call whose result is left on the stack in a loop. Such a
+            // function gets no maps, so the heap doesn't collect while it runs.
+            if(known.size() != slots.size()) {
+                consistent = false;
+                return;
+            }
+            // A slot that holds a number on one path and a reference on another is
+            // only ever a zeroed reference, the initial value of a variable.
+            bool changed = false;
+            for(size_t x = 0; x < slots.size(); ++x) {
+                if(slots[x] == known[x] || slots[x] == SlotKind::VALUE)
+                    continue;
+                if(known[x] != SlotKind::VALUE)
+                    consistent = false;
+                known[x] = slots[x];
+                changed = true;
+            }
+            if(changed)
+                pending.push_back(target);
+        };
+
+        // The callee's result is in the slot below its arguments once it runs.
+        auto afterCall = [&](vector<SlotKind>& slots, size_t offset) {
+            auto found = callees.find(offset + code[offset].p2);
+            if(found == callees.end())
+                throw logic_error("A call to an unknown function at " + to_string(offset));
+            const CalleeShape& callee = found->second;
+            if(callee._numParameterSlots + (callee._returnsSmth ? 1 : 0) > slots.size())
+                throw logic_error("Stack underflow at " + to_string(offset));
+            if(callee._returnsSmth)
+                slots[slots.size() - callee._numParameterSlots - 1] = callee._result;
+        };
+
+        while(consistent && !pending.empty()) {
+            size_t offset = pending.back();
+            pending.pop_back();
+            vector<SlotKind> slots = kinds[offset];
+            const Instruction& currInstruction = code[offset];
+
+            switch(currInstruction._opcode) {
+                case EXIT:
+                case RETURN:
+                    continue;
+                case PUSH_INT:
+                case PUSH_CONST:
+                case LOAD_INT:
+                    // Literals are never in the heap, see Strings.h.
+                    slots.push_back(SlotKind::VALUE);
+                    break;
+                case LOAD_INT_BASEPOINTER_RELATIVE: {
+                    ptrdiff_t slot = currInstruction.p2;
+                    ptrdiff_t parameter = slot + 1 + ptrdiff_t(parameters.size());
+                    if(slot >= 0 && size_t(slot) < slots.size())
+                        slots.push_back(slots[slot]);
+                    else if(slot < 0 && parameter >= 0)
+                        slots.push_back(parameters[parameter]);
+                    else
+                        slots.push_back(SlotKind::VALUE);
+                    break;
+                }
+                case STORE_INT_BASEPOINTER_RELATIVE: {
+                    if(slots.empty())
+                        throw logic_error("Stack underflow at " + to_string(offset));
+                    SlotKind kind = slots.back();
+                    slots.pop_back();
+                    if(currInstruction.p2 >= 0 && size_t(currInstruction.p2) < slots.size())
+                        slots[currInstruction.p2] = kind;
+                    break;
+                }
+                case JUMP_BY:
+                    flowTo(offset + currInstruction.p2, slots, offset);
+                    continue;
+                case JUMP_BY_IF_ZERO:
+                    Pop(slots, 1, offset);
+                    flowTo(offset + currInstruction.p2, slots, offset);
+                    break;
+                case JUMP_BY_IF_NOT_LESS:
+                    Pop(slots, 2, offset);
+                    flowTo(offset + currInstruction.p2, slots, offset);
+                    break;
+                case POP_INT_N:
+                    Pop(slots, size_t(currInstruction.p2), offset);
+                    break;
+                case PRINT_VALUES:
+                    Pop(slots, currInstruction.p1, offset);
+                    break;
+                case CALL:
+                    afterCall(slots, offset);
+                    break;
+                case INC_INT_BASEPOINTER_RELATIVE:
+                    break;
+                case NEW_ARRAY:
+                    SetTop(slots, SlotKind::ARRAY, offset);
+                    break;
+                case ADD_INT_IMMEDIATE:
+                case INT_TO_DOUBLE:
+                case DOUBLE_TO_INT:
+                case SATURATE_INT16:
+                case ARRAY_LENGTH:
+                case ARRAY_SUM:
+                case ARRAY_MIN:
+                case ARRAY_MAX:
+                    SetTop(slots, SlotKind::VALUE, offset);
+                    break;
+                case ARRAY_STORE_INT:
+                case ARRAY_STORE_DOUBLE:
+                case ARRAY_ADD:
+                case ARRAY_MUL:
+                    Pop(slots, 3, offset);
+                    break;
+                case POP_INT:
+                case PRINT_INT:
+                case PRINT_DOUBLE:
+                case STORE_INT:
+                    Pop(slots, 1, offset);
+                    break;
+                case CONCAT_STRING:
+                    Pop(slots, 1, offset);
+                    SetTop(slots, SlotKind::STRING, offset);
+                    break;
+                default:
+                    // Binary operators on numbers, and comparisons of strings.
+                    Pop(slots, 1, offset);
+                    SetTop(slots, SlotKind::VALUE, offset);
+                    break;
+            }
+            flowTo(offset + 1, slots, offset);
+        }
+
+        if(!consistent)
+            return;
+        for(size_t offset = 0; offset < numInstructions; ++offset) {
+            const Instruction& currInstruction = code[offset];
+            if(!reached[offset])
+                continue;
+            if(currInstruction._opcode == CALL) {
+                // For as long as the callee runs, which is when its result may refer to something.
+                vector<SlotKind> slots = kinds[offset];
+                afterCall(slots, offset);
+                _maps[offset] = MapOf(slots);
+            } else if(currInstruction._opcode == JUMP_BY && currInstruction.p2 < 0) {
+                _maps[offset] = MapOf(kinds[offset]);
+            }
+        }
+    }
+
+    void StackMaps::Relocate(const vector<size_t>& newOffsets) {
+        unordered_map<size_t, StackMap> maps;
+        for(auto& [offset, stackMap] : _maps)
+            maps.emplace(newOffsets.at(offset), std::move(stackMap));
+        _maps = std::move(maps);
+    }
+
+}
@@ -0,0 +1,118 @@
+#include "../include/Strings.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace interpreter {
+
+    using namespace std;
+
+    static constexpr int64_t POOLED_STRING = 1;
+    static constexpr int64_t MADE_STRING = 3;
+    static constexpr size_t MAX_STRINGS = size_t(1) << 61;
+
+    int64_t InlineString(string_view text) {
+        uint8_t bytes[8] = {uint8_t(text.size() * 2)};
+        memcpy(bytes + 1, text.data(), text.size());
+        return bit_cast<int64_t>(bytes);
+    }
+
+    static int64_t ReferenceString(size_t index, int64_t kind) {
+        if(index >= MAX_STRINGS)
+            throw runtime_error("Too many strings");
+        return int64_t(uint64_t(index) << 2) | kind;
+    }
+
+    int64_t StringPool::Add(string_view text) {
+        if(text.size() <= MAX_INLINE_STRING_LENGTH)
+            return InlineString(text);
+
+        auto found = _values.find(text);
+        if(found != _values.end())
+            return found->second;
+
+        int64_t value = ReferenceString(_strings.size(), POOLED_STRING);
+        _strings.emplace_back(text);
+        _values.emplace(_strings.back(), value);
+        return value;
+    }
+
+    // A string of the managed heap, its text right after it.
+    struct HeapString : ObjectHeader {
+        uint64_t _length;
+
+        const char* Text() const { return reinterpret_cast<const char*>(this + 1); }
+    };
+
+    int64_t StringHeap::Allocate(size_t length, char*& text) {
+        auto made = static_cast<HeapString*>(_heap.Allocate(ObjectKind::STRING, sizeof(HeapString) + length));
+        made->_length = length;
+        text = reinterpret_cast<char*>(made + 1);
+        return reinterpret_cast<int64_t>(made) | MADE_STRING;
+    }
+
+    int64_t StringHeap::Make(string_view text) {
+        if(text.size() <= MAX_INLINE_STRING_LENGTH)
+            return InlineString(text);
+
+        char* copy;
+        int64_t value = Allocate(text.size(), copy);
+        memcpy(copy, text.data(), text.size());
+        return value;
+    }
+
+    int64_t StringHeap::Concatenate(int64_t first, int64_t second) {
+        string_view firstText = View(first);
+        string_view secondText = View(second);
+        if(secondText.empty())
+            return first;
+        if(firstText.empty())
+            return second;
+
+        size_t length = firstText.size() + secondText.size();
+        if(length <= MAX_INLINE_STRING_LENGTH) {
+            char text[MAX_INLINE_STRING_LENGTH];
+            memcpy(text, firstText.data(), firstText.size());
+            memcpy(text + firstText.size(), secondText.data(), secondText.size());
+            return InlineString(string_view(text, length));
+        }
+
+        char* text;
+        int64_t value = Allocate(length, text);
+        memcpy(text, firstText.data(), firstText.size());
+        memcpy(text + firstText.size(), secondText.data(), secondText.size());
+        return value;
+    }
+
+    string_view StringHeap::View(const int64_t& value) const {
+        if(IsInlineString(value)) {
+            size_t length = size_t(value & 0xff) / 2;
+            if(length > MAX_INLINE_STRING_LENGTH)
+                throw runtime_error("Not a string: " + to_string(value));
+            return string_view(reinterpret_cast<const char*>(&value) + 1, length);
+        }
+
+        size_t index = size_t(uint64_t(value) >> 2);
+        if((value & 3) == POOLED_STRING) {
+            if(!_pool || index >= _pool->Size())
+                throw runtime_error("Not a string literal: " + to_string(value));
+            return _pool->At(index);
+        }
+        auto made = reinterpret_cast<const HeapString*>(value & ~MADE_STRING);
+        size_t bytes = (value & 7) == MADE_STRING ? _heap.BytesFrom(made) : 0;
+        if(bytes < sizeof(HeapString) || made->_kind != ObjectKind::STRING
+           || bytes - sizeof(HeapString) < made->_length)
+            throw runtime_error("Not a string: " + to_string(value));
+        return string_view(made->Text(), size_t(made->_length));
+    }
+
+    bool StringHeap::Equal(int64_t first, int64_t second) const {
+        // Short strings are equal values, and so are the same literal.
+        if(first == second)
+            return true;
+        // Only strings that don't fit inline are stored elsewhere.
+        if(IsInlineString(first) || IsInlineString(second))
+            return false;
+        return View(first) == View(second);
+    }
+
+}
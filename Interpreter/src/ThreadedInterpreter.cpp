@@ -0,0 +1,648 @@
+#include "../include/ThreadedCode.h"
+#include "../include/OutputSink.h"
+#include "../include/Interpreter.h"
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#if !defined(__GNUC__)
+#error "The threaded interpreter needs computed goto (GCC or Clang)"
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    // Returns the handler table when called with a null instruction pointer, which is
+    // how ThreadedCode gets hold of the label addresses it stores at translation time.
+    // The stack, frame and return-address pointers live in locals for the whole run.
+    static const void* const* Execute(const ThreadedInstruction* ip, OperandStack* stack, int16_t* sp) {
+        static const void* const handlers[] = {
+                &&exit,
+                &&addInt,
+                &&pushInt,
+                &&popInt,
+                &&printInt,
+                &&compareIntLess,
+                &&loadInt,
+                &&storeInt,
+                &&jumpByIfZero,
+                &&jumpBy,
+                &&loadIntBasePointerRelative,
+                &&storeIntBasePointerRelative,
+                &&call,
+                &&ret,
+                &&incIntBasePointerRelative,
+                &&addIntImmediate,
+                &&jumpByIfNotLess,
+                &&popIntN,
+        };
+        static_assert(sizeof(handlers) / sizeof(handlers[0]) == NUM_NARROW_OPCODES,
+                      "Every opcode before the wide ones needs a threaded handler");
+
+        if(!ip)
+            return handlers;
+
+        int16_t* const base = stack->Base();
+        int16_t* const limit = stack->Limit();
+        int16_t* fp = sp + 1;
+        const ThreadedInstruction** returnAddress =
+                reinterpret_cast<const ThreadedInstruction**>(stack->ReturnAddresses());
+        *returnAddress = nullptr;
+
+#define DISPATCH() goto *ip->_handler
+
+        DISPATCH();
+
+    exit:
+        return handlers;
+
+    addInt:
+        sp[-1] += sp[0];
+        --sp;
+        ++ip;
+        DISPATCH();
+
+    pushInt:
+        *++sp = ip->_operand;
+        ++ip;
+        DISPATCH();
+
+    popInt:
+        --sp;
+        ++ip;
+        DISPATCH();
+
+    printInt:
+        CurrentOutput().PrintInt(*sp--);
+        ++ip;
+        DISPATCH();
+
+    compareIntLess:
+        sp[-1] = sp[-1] < sp[0];
+        --sp;
+        ++ip;
+        DISPATCH();
+
+    loadInt:
+        sp[1] = base[ip->_operand];
+        ++sp;
+        ++ip;
+        DISPATCH();
+
+    storeInt:
+        base[ip->_operand] = *sp--;
+        ++ip;
+        DISPATCH();
+
+    jumpByIfZero:
+        ip = *sp-- == 0 ? ip->_target : ip + 1;
+        DISPATCH();
+
+    jumpBy:
+        ip = ip->_target;
+        DISPATCH();
+
+    loadIntBasePointerRelative:
+        sp[1] = fp[ip->_operand];
+        ++sp;
+        ++ip;
+        DISPATCH();
+
+    storeIntBasePointerRelative:
+        fp[ip->_operand] = *sp--;
+        ++ip;
+        DISPATCH();
+
+    call:
+        if(ip->_frameSize + 2 > size_t(limit - sp))
+            throw StackOverflow();
+        *++sp = int16_t(fp - base);
+        *++returnAddress = ip + 1;
+        fp = sp + 1;
+        ip = ip->_target;
+        DISPATCH();
+
+    ret:
+        ip = *returnAddress--;
+        fp = base + *sp--;
+        if(!ip)
+            return handlers;
+        DISPATCH();
+
+    incIntBasePointerRelative:
+        fp[ip->_operand] += int8_t(ip->_p1);
+        ++ip;
+        DISPATCH();
+
+    addIntImmediate:
+        *sp += ip->_operand;
+        ++ip;
+        DISPATCH();
+
+    jumpByIfNotLess:
+        sp -= 2;
+        ip = sp[1] < sp[2] ? ip + 1 : ip->_target;
+        DISPATCH();
+
+    popIntN:
+        sp -= ip->_operand;
+        ++ip;
+        DISPATCH();
+
+#undef DISPATCH
+    }
+
+    // Top-of-stack cached variant of Execute. Up to two values from the top of the
+    // stack live in tos and nos instead of memory, and which of them are live at an
+    // instruction is decided when ThreadedCode is built: every opcode has one handler
+    // per cache state (empty, tos, nos + tos) and the translator picks the matching
+    // one. Jump targets, calls and returns always see an empty cache.
+    static const void* const* ExecuteTopOfStackCached(const ThreadedInstruction* ip, OperandStack* stack, int16_t* sp) {
+        static const void* const handlers[] = {
+                &&exit0, &&addInt0, &&pushInt0, &&popInt0, &&printInt0, &&compareIntLess0,
+                &&loadInt0, &&storeInt0, &&jumpByIfZero0, &&jumpBy0,
+                &&loadIntBasePointerRelative0, &&storeIntBasePointerRelative0, &&call0, &&ret0,
+                &&incIntBasePointerRelative, &&addIntImmediate0, &&jumpByIfNotLess0, &&popIntN0,
+
+                &&exit1, &&addInt1, &&pushInt1, &&popInt1, &&printInt1, &&compareIntLess1,
+                &&loadInt1, &&storeInt1, &&jumpByIfZero1, &&jumpBy1,
+                &&loadIntBasePointerRelative1, &&storeIntBasePointerRelative1, &&call1, &&ret1,
+                &&incIntBasePointerRelative, &&addIntImmediate12, &&jumpByIfNotLess1, &&popIntN1,
+
+                &&exit2, &&addInt2, &&pushInt2, &&popInt2, &&printInt2, &&compareIntLess2,
+                &&loadInt2, &&storeInt2, &&jumpByIfZero2, &&jumpBy2,
+                &&loadIntBasePointerRelative2, &&storeIntBasePointerRelative2, &&call2, &&ret2,
+                &&incIntBasePointerRelative, &&addIntImmediate12, &&jumpByIfNotLess2, &&popIntN2,
+
+                &&flush1, &&flush2,
+        };
+        static_assert(sizeof(handlers) / sizeof(handlers[0]) == NUM_CACHE_STATES * NUM_NARROW_OPCODES + 2,
+                      "Every opcode before the wide ones needs a threaded handler per cache state");
+
+        if(!ip)
+            return handlers;
+
+        int16_t* const base = stack->Base();
+        int16_t* const limit = stack->Limit();
+        int16_t* fp = sp + 1;
+        // Always sign-extended int16_t values; full-width registers avoid partial writes.
+        int32_t tos = 0;
+        int32_t nos = 0;
+        const ThreadedInstruction** returnAddress =
+                reinterpret_cast<const ThreadedInstruction**>(stack->ReturnAddresses());
+        *returnAddress = nullptr;
+
+#define DISPATCH() goto *ip->_handler
+
+        DISPATCH();
+
+        // Cache empty: the whole stack is in memory.
+    exit0:
+        return handlers;
+
+    addInt0:
+        tos = int16_t(sp[-1] + sp[0]);
+        sp -= 2;
+        ++ip;
+        DISPATCH();
+
+    pushInt0:
+        tos = ip->_operand;
+        ++ip;
+        DISPATCH();
+
+    popInt0:
+        --sp;
+        ++ip;
+        DISPATCH();
+
+    printInt0:
+        CurrentOutput().PrintInt(*sp--);
+        ++ip;
+        DISPATCH();
+
+    compareIntLess0:
+        tos = sp[-1] < sp[0];
+        sp -= 2;
+        ++ip;
+        DISPATCH();
+
+    loadInt0:
+        tos = base[ip->_operand];
+        ++ip;
+        DISPATCH();
+
+    storeInt0:
+        base[ip->_operand] = *sp--;
+        ++ip;
+        DISPATCH();
+
+    jumpByIfZero0:
+        ip = *sp-- == 0 ? ip->_target : ip + 1;
+        DISPATCH();
+
+    jumpBy0:
+        ip = ip->_target;
+        DISPATCH();
+
+    loadIntBasePointerRelative0:
+        tos = fp[ip->_operand];
+        ++ip;
+        DISPATCH();
+
+    storeIntBasePointerRelative0:
+        fp[ip->_operand] = *sp--;
+        ++ip;
+        DISPATCH();
+
+    call0:
+        if(ip->_frameSize + 2 > size_t(limit - sp))
+            throw StackOverflow();
+        *++sp = int16_t(fp - base);
+        *++returnAddress = ip + 1;
+        fp = sp + 1;
+        ip = ip->_target;
+        DISPATCH();
+
+    ret0:
+        ip = *returnAddress--;
+        fp = base + *sp--;
+        if(!ip)
+            return handlers;
+        DISPATCH();
+
+    incIntBasePointerRelative: // any state; never emitted while its slot is cached
+        fp[ip->_operand] += int8_t(ip->_p1);
+        ++ip;
+        DISPATCH();
+
+    addIntImmediate0:
+        tos = int16_t(*sp-- + ip->_operand);
+        ++ip;
+        DISPATCH();
+
+    jumpByIfNotLess0:
+        sp -= 2;
+        ip = sp[1] < sp[2] ? ip + 1 : ip->_target;
+        DISPATCH();
+
+    popIntN0:
+        sp -= ip->_operand;
+        ++ip;
+        DISPATCH();
+
+        // tos holds the top of the stack.
+    exit1:
+        *++sp = int16_t(tos);
+        goto exit0;
+
+    addInt1:
+        tos = int16_t(*sp-- + tos);
+        ++ip;
+        DISPATCH();
+
+    pushInt1:
+        nos = tos;
+        tos = ip->_operand;
+        ++ip;
+        DISPATCH();
+
+    popInt1:
+        ++ip;
+        DISPATCH();
+
+    printInt1:
+        CurrentOutput().PrintInt(int16_t(tos));
+        ++ip;
+        DISPATCH();
+
+    compareIntLess1:
+        tos = *sp-- < tos;
+        ++ip;
+        DISPATCH();
+
+    loadInt1:
+        *++sp = int16_t(tos);
+        goto loadInt0;
+
+    storeInt1:
+        *++sp = int16_t(tos);
+        goto storeInt0;
+
+    jumpByIfZero1:
+        ip = tos == 0 ? ip->_target : ip + 1;
+        DISPATCH();
+
+    jumpBy1:
+        *++sp = int16_t(tos);
+        goto jumpBy0;
+
+    loadIntBasePointerRelative1:
+        nos = tos;
+        tos = fp[ip->_operand];
+        ++ip;
+        DISPATCH();
+
+    storeIntBasePointerRelative1:
+        fp[ip->_operand] = int16_t(tos);
+        ++ip;
+        DISPATCH();
+
+    call1:
+        *++sp = int16_t(tos);
+        goto call0;
+
+    ret1:
+        *++sp = int16_t(tos);
+        goto ret0;
+
+    addIntImmediate12:
+        tos = int16_t(tos + ip->_operand);
+        ++ip;
+        DISPATCH();
+
+    jumpByIfNotLess1:
+        ip = *sp-- < tos ? ip + 1 : ip->_target;
+        DISPATCH();
+
+    popIntN1: // never emitted for fewer values than are cached
+        sp -= ip->_operand - 1;
+        ++ip;
+        DISPATCH();
+
+        // nos and tos hold the two topmost values.
+    exit2:
+        *++sp = int16_t(nos);
+        *++sp = int16_t(tos);
+        goto exit0;
+
+    addInt2:
+        tos = int16_t(nos + tos);
+        ++ip;
+        DISPATCH();
+
+    pushInt2:
+        *++sp = int16_t(nos);
+        nos = tos;
+        tos = ip->_operand;
+        ++ip;
+        DISPATCH();
+
+    popInt2:
+        tos = nos;
+        ++ip;
+        DISPATCH();
+
+    printInt2:
+        CurrentOutput().PrintInt(int16_t(tos));
+        tos = nos;
+        ++ip;
+        DISPATCH();
+
+    compareIntLess2:
+        tos = nos < tos;
+        ++ip;
+        DISPATCH();
+
+    loadInt2:
+        *++sp = int16_t(nos);
+        *++sp = int16_t(tos);
+        goto loadInt0;
+
+    storeInt2:
+        *++sp = int16_t(nos);
+        *++sp = int16_t(tos);
+        goto storeInt0;
+
+    jumpByIfZero2:
+        *++sp = int16_t(nos);
+        ip = tos == 0 ? ip->_target : ip + 1;
+        DISPATCH();
+
+    jumpBy2:
+        *++sp = int16_t(nos);
+        *++sp = int16_t(tos);
+        goto jumpBy0;
+
+    loadIntBasePointerRelative2:
+        *++sp = int16_t(nos);
+        nos = tos;
+        tos = fp[ip->_operand];
+        ++ip;
+        DISPATCH();
+
+    storeIntBasePointerRelative2:
+        fp[ip->_operand] = int16_t(tos);
+        tos = nos;
+        ++ip;
+        DISPATCH();
+
+    call2:
+        *++sp = int16_t(nos);
+        *++sp = int16_t(tos);
+        goto call0;
+
+    ret2:
+        *++sp = int16_t(nos);
+        *++sp = int16_t(tos);
+        goto ret0;
+
+    jumpByIfNotLess2:
+        ip = nos < tos ? ip + 1 : ip->_target;
+        DISPATCH();
+
+    popIntN2:
+        sp -= ip->_operand - 2;
+        ++ip;
+        DISPATCH();
+
+        // Spill the cache before a jump target or a frame access that would see it.
+    flush1:
+        *++sp = int16_t(tos);
+        ++ip;
+        DISPATCH();
+
+    flush2:
+        *++sp = int16_t(nos);
+        *++sp = int16_t(tos);
+        ++ip;
+        DISPATCH();
+
+#undef DISPATCH
+    }
+
+    // Cache state after an instruction that was entered in state.
+    static int NextCacheState(int state, Opcode opcode) {
+        switch(opcode) {
+            case PUSH_INT:
+            case LOAD_INT:
+            case LOAD_INT_BASEPOINTER_RELATIVE:
+                return state == 0 || opcode == LOAD_INT ? 1 : 2;
+            case ADD_INT:
+            case COMP_INT_LT:
+                return 1;
+            case ADD_INT_IMMEDIATE:
+                return state == 0 ? 1 : state;
+            case INC_INT_BASEPOINTER_RELATIVE:
+                return state;
+            case POP_INT:
+            case PRINT_INT:
+            case STORE_INT_BASEPOINTER_RELATIVE:
+                return state == 2 ? 1 : 0;
+            default:
+                return 0;
+        }
+    }
+
+    const void* const* ThreadedInterpreter::HandlerTable(StackCaching caching) {
+        if(caching == StackCaching::TOP_OF_STACK)
+            return ExecuteTopOfStackCached(nullptr, nullptr, nullptr);
+        return Execute(nullptr, nullptr, nullptr);
+    }
+
+    size_t ThreadedInterpreter::NumHandlers(StackCaching caching) {
+        if(caching == StackCaching::TOP_OF_STACK)
+            return NUM_CACHE_STATES * NUM_NARROW_OPCODES + 2;
+        return NUM_NARROW_OPCODES;
+    }
+
+    string ThreadedInterpreter::HandlerName(StackCaching caching, size_t handler) {
+        if(caching != StackCaching::TOP_OF_STACK)
+            return gOpcodeNames[handler];
+        // The flush handlers come after the opcodes of all cache states.
+        if(handler >= NUM_CACHE_STATES * NUM_NARROW_OPCODES)
+            return "FLUSH_CACHE_" + to_string(handler - NUM_CACHE_STATES * NUM_NARROW_OPCODES + 1);
+        return string(gOpcodeNames[handler % NUM_NARROW_OPCODES]) + "_CACHED_" + to_string(handler / NUM_NARROW_OPCODES);
+    }
+
+    ThreadedCode::ThreadedCode(const Instruction* code, size_t numInstructions, StackCaching caching)
+        : _caching(caching), _source(code, code + numInstructions), _indexOf(numInstructions) {
+        RequireNarrowCode(code, numInstructions);
+        const void* const* handlers = ThreadedInterpreter::HandlerTable(caching);
+        bool cached = caching == StackCaching::TOP_OF_STACK;
+        vector<bool> isJumpTarget(numInstructions, false);
+        vector<ptrdiff_t> depths(numInstructions, UNKNOWN_DEPTH);
+
+        for(size_t x = 0; x < numInstructions; ++x) {
+            const Instruction& currInstruction = code[x];
+            if(currInstruction._opcode >= NUM_INSTRUCTIONS)
+                throw runtime_error("Invalid opcode at instruction " + to_string(x));
+
+            if(currInstruction._opcode == JUMP_BY_IF_ZERO || currInstruction._opcode == JUMP_BY
+               || currInstruction._opcode == CALL || currInstruction._opcode == JUMP_BY_IF_NOT_LESS) {
+                ptrdiff_t target = ptrdiff_t(x) + currInstruction.p2;
+                if(target < 0 || size_t(target) >= numInstructions)
+                    throw runtime_error("Jump target out of range at instruction " + to_string(x));
+                isJumpTarget[target] = true;
+            }
+        }
+
+        if(cached) {
+            // Functions start at the beginning, after every RETURN and at call targets.
+            for(size_t x = 0; x < numInstructions; ++x) {
+                if(x == 0 || code[x - 1]._opcode == RETURN || code[x - 1]._opcode == EXIT
+                   || (isJumpTarget[x] && depths[x] == UNKNOWN_DEPTH))
+                    ComputeStackDepths(code, numInstructions, x, depths);
+            }
+        }
+
+        int state = 0;
+        for(size_t x = 0; x < numInstructions; ++x) {
+            const Instruction& currInstruction = code[x];
+
+            if(state != 0) {
+                bool flush = isJumpTarget[x];
+                if(currInstruction._opcode == LOAD_INT_BASEPOINTER_RELATIVE
+                   || currInstruction._opcode == STORE_INT_BASEPOINTER_RELATIVE
+                   || currInstruction._opcode == INC_INT_BASEPOINTER_RELATIVE) {
+                    // The slot may be one of the cached values, whose memory copy is stale.
+                    flush = flush || depths[x] == UNKNOWN_DEPTH || currInstruction.p2 >= depths[x] - state;
+                }
+                if(currInstruction._opcode == POP_INT_N && currInstruction.p2 < state)
+                    flush = true;
+                if(flush) {
+                    _instructions.push_back(ThreadedInstruction{
+                            handlers[NUM_CACHE_STATES * NUM_NARROW_OPCODES + state - 1],
+                            nullptr, 0, NUM_INSTRUCTIONS, 0, 0});
+                    state = 0;
+                }
+            }
+
+            _indexOf[x] = uint32_t(_instructions.size());
+            _instructions.push_back(ThreadedInstruction{
+                    handlers[state * NUM_NARROW_OPCODES + currInstruction._opcode],
+                    nullptr, currInstruction.p2, currInstruction._opcode, currInstruction.p1, 0});
+
+            if(cached)
+                state = NextCacheState(state, currInstruction._opcode);
+        }
+
+        _frameSizes.emplace(0, interpreter::FrameSize(code, numInstructions, 0));
+        for(size_t x = 0; x < numInstructions; ++x) {
+            const Instruction& currInstruction = code[x];
+            ThreadedInstruction& decoded = _instructions[_indexOf[x]];
+
+            switch(currInstruction._opcode) {
+                case JUMP_BY_IF_ZERO:
+                case JUMP_BY:
+                case JUMP_BY_IF_NOT_LESS:
+                case CALL: {
+                    size_t target = x + currInstruction.p2;
+                    decoded._target = At(target);
+
+                    if(currInstruction._opcode == CALL) {
+                        auto foundFrameSize = _frameSizes.find(target);
+                        if(foundFrameSize == _frameSizes.end())
+                            foundFrameSize = _frameSizes.emplace(target, FrameSize(target)).first;
+                        decoded._frameSize = foundFrameSize->second;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    size_t ThreadedCode::FrameSize(size_t entry) const {
+        auto foundFrameSize = _frameSizes.find(entry);
+        if(foundFrameSize != _frameSizes.end())
+            return foundFrameSize->second;
+        return interpreter::FrameSize(_source.data(), _source.size(), entry);
+    }
+
+    void ThreadedInterpreter::Run(const ThreadedCode& code, size_t entry, vector<int16_t> args, int16_t* result) {
+        OperandStack stack;
+        Run(code, entry, args, stack, result);
+    }
+
+    void ThreadedInterpreter::Run(const ThreadedCode& code, size_t entry, span<const int16_t> args,
+                                  OperandStack& stack, int16_t* result) {
+        if(entry >= code.Size())
+            throw out_of_range("Entry point outside of the threaded code");
+
+        int16_t* sp = stack.Base() - 1;
+
+        // Result slot, arguments, the outermost saved base and the entry frame itself.
+        if(size_t(result != nullptr) + args.size() + 1 + code.FrameSize(entry) > stack.NumSlots())
+            throw StackOverflow();
+
+        if(result) {
+            *++sp = 0;
+        }
+        for(int16_t arg : args) {
+            *++sp = arg;
+        }
+        *++sp = 0;
+
+        if(code.Caching() == StackCaching::TOP_OF_STACK)
+            ExecuteTopOfStackCached(code.At(entry), &stack, sp);
+        else
+            Execute(code.At(entry), &stack, sp);
+
+        if(result)
+            *result = stack.Base()[0];
+    }
+
+}
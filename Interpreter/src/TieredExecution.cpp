@@ -0,0 +1,459 @@
+#include "../include/TieredExecution.h"
+#include "../include/JitTemplates.h"
+#include "../include/JitSymbols.h"
+#include "../include/Peephole.h"
+#include "../include/OutputSink.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#if !defined(__x86_64__)
+#error "Tiered execution only generates x86-64 code"
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    typedef int (*NativeEntry)(JitState* state, const uint8_t* target);
+
+    struct TieredExecution::NativeFunction {
+        struct Exit {
+            TransferKind _kind;
+            size_t _offset;
+            size_t _branch; // the conditional jump whose speculation failed
+        };
+
+        const uint8_t* At(size_t offset, size_t start) const { return _memory.Data() + _offsets[offset - start]; }
+
+        ExecutableMemory _memory;
+        vector<uint32_t> _offsets; // from the start of the function
+        vector<Exit> _exits;
+    };
+
+    TieredExecution::TieredExecution(const Instruction* code, size_t numInstructions,
+                                     const vector<size_t>& functionStarts, TieringPolicy policy,
+                                     map<size_t, string> functionNames)
+        : _source(code, code + numInstructions), _policy(policy), _functionAt(numInstructions),
+          _branchProfiles(numInstructions), _functionNames(std::move(functionNames)) {
+        RequireNarrowCode(code, numInstructions);
+        if(numInstructions == 0)
+            throw invalid_argument("No code to run");
+
+        vector<size_t> starts(functionStarts);
+        starts.push_back(0);
+
+        for(size_t x = 0; x < numInstructions; ++x) {
+            const Instruction& currInstruction = code[x];
+            if(currInstruction._opcode >= NUM_INSTRUCTIONS)
+                throw runtime_error("Invalid opcode at instruction " + to_string(x));
+
+            if(currInstruction._opcode == JUMP_BY_IF_ZERO || currInstruction._opcode == JUMP_BY
+               || currInstruction._opcode == CALL || currInstruction._opcode == JUMP_BY_IF_NOT_LESS) {
+                ptrdiff_t target = ptrdiff_t(x) + currInstruction.p2;
+                if(target < 0 || size_t(target) >= numInstructions)
+                    throw runtime_error("Jump target out of range at instruction " + to_string(x));
+                if(currInstruction._opcode == CALL)
+                    starts.push_back(size_t(target));
+            }
+        }
+
+        sort(starts.begin(), starts.end());
+        starts.erase(unique(starts.begin(), starts.end()), starts.end());
+        if(starts.back() >= numInstructions)
+            throw out_of_range("Function start outside of the code");
+
+        for(size_t x = 0; x < starts.size(); ++x) {
+            size_t end = x + 1 < starts.size() ? starts[x + 1] : numInstructions;
+            _functions.push_back(Function{starts[x], end, FrameSize(code, numInstructions, starts[x]), Tier::INTERPRETER,
+                                          0, 0, 0, true, nullptr});
+            fill(_functionAt.begin() + ptrdiff_t(starts[x]), _functionAt.begin() + ptrdiff_t(end), uint32_t(x));
+        }
+    }
+
+    TieredExecution::~TieredExecution() = default;
+
+    const TieredExecution::Function& TieredExecution::FunctionStartingAt(size_t functionStart) const {
+        if(functionStart >= _source.size() || _functions[_functionAt[functionStart]]._start != functionStart)
+            throw invalid_argument("No function starts at " + to_string(functionStart));
+        return _functions[_functionAt[functionStart]];
+    }
+
+    Tier TieredExecution::TierOf(size_t functionStart) const {
+        return FunctionStartingAt(functionStart)._tier;
+    }
+
+    uint32_t TieredExecution::Deoptimizations(size_t functionStart) const {
+        return FunctionStartingAt(functionStart)._deoptimizations;
+    }
+
+    void TieredExecution::Enter(Function& function) {
+        ++function._calls;
+        TierUp(function);
+    }
+
+    void TieredExecution::TierUp(Function& function) {
+        uint64_t hotness = function._calls + function._loopIterations;
+
+        if(function._tier == Tier::INTERPRETER && hotness >= _policy._optimizedBytecodeThreshold) {
+            if(_optimized.empty()) {
+                _optimized = OptimizePeephole(_source, &_optimizedOffsets);
+                _sourceOffsets.assign(_optimized.size(), 0);
+                for(size_t x = _source.size(); x-- > 0;)
+                    _sourceOffsets[_optimizedOffsets[x]] = x;
+            }
+            function._tier = Tier::OPTIMIZED_BYTECODE;
+        }
+
+        if(function._tier == Tier::OPTIMIZED_BYTECODE && function._compilable && hotness >= _policy._nativeThreshold) {
+            function._compilable = CompileNative(function);
+            if(function._compilable)
+                function._tier = Tier::NATIVE;
+        }
+    }
+
+    void TieredExecution::Deoptimize(Function& function) {
+        ++function._deoptimizations;
+        function._native.reset();
+        function._tier = Tier::INTERPRETER;
+        function._calls = 0;
+        function._loopIterations = 0;
+    }
+
+    TieredExecution::Transfer TieredExecution::Interpret(Function& function, size_t offset, JitState& state) {
+        bool optimized = function._tier == Tier::OPTIMIZED_BYTECODE;
+        // Hotness at which a loop back-edge hands the running frame to the next tier.
+        uint64_t tierUpAt = UINT64_MAX;
+        if(_policy._onStackReplacement)
+            tierUpAt = !optimized ? _policy._optimizedBytecodeThreshold
+                                  : function._compilable ? _policy._nativeThreshold : UINT64_MAX;
+        const Instruction* code = optimized ? _optimized.data() : _source.data();
+        const Instruction* ip = code + (optimized ? _optimizedOffsets[offset] : offset);
+        int16_t* sp = state._sp;
+        int16_t* fp = state._fp;
+        int16_t* const base = state._base;
+        int16_t* const limit = state._limit;
+
+        auto sourceOffset = [&]() {
+            size_t x = size_t(ip - code);
+            return optimized ? _sourceOffsets[x] : x;
+        };
+        auto transfer = [&](TransferKind kind, size_t at) {
+            state._sp = sp;
+            state._fp = fp;
+            return Transfer{kind, at};
+        };
+        // Only the interpreter tier profiles branches; they aren't in the same place in optimized code.
+        auto profile = [&](bool jumped) {
+            if(!optimized) {
+                BranchProfile& branchProfile = _branchProfiles[size_t(ip - code)];
+                ++(jumped ? branchProfile._jumped : branchProfile._fellThrough);
+            }
+        };
+
+        while(true) {
+            switch(ip->_opcode) {
+                case EXIT:
+                    return transfer(TransferKind::EXIT, sourceOffset());
+
+                case ADD_INT:
+                    sp[-1] = int16_t(sp[-1] + sp[0]);
+                    --sp;
+                    ++ip;
+                    break;
+
+                case PUSH_INT:
+                    *++sp = ip->p2;
+                    ++ip;
+                    break;
+
+                case POP_INT:
+                    --sp;
+                    ++ip;
+                    break;
+
+                case PRINT_INT:
+                    CurrentOutput().PrintInt(*sp--);
+                    ++ip;
+                    break;
+
+                case COMP_INT_LT:
+                    sp[-1] = sp[-1] < sp[0];
+                    --sp;
+                    ++ip;
+                    break;
+
+                case LOAD_INT:
+                    *++sp = base[ip->p2];
+                    ++ip;
+                    break;
+
+                case STORE_INT:
+                    base[ip->p2] = *sp--;
+                    ++ip;
+                    break;
+
+                case JUMP_BY_IF_ZERO: {
+                    bool jump = *sp-- == 0;
+                    profile(jump);
+                    ip += jump ? ip->p2 : 1;
+                    break;
+                }
+
+                case JUMP_BY: {
+                    bool backward = ip->p2 < 0;
+                    ip += ip->p2;
+                    if(backward && ++function._loopIterations + function._calls >= tierUpAt)
+                        return transfer(TransferKind::ON_STACK_REPLACEMENT, sourceOffset());
+                    break;
+                }
+
+                case LOAD_INT_BASEPOINTER_RELATIVE:
+                    *++sp = fp[ip->p2];
+                    ++ip;
+                    break;
+
+                case STORE_INT_BASEPOINTER_RELATIVE:
+                    fp[ip->p2] = *sp--;
+                    ++ip;
+                    break;
+
+                case CALL: {
+                    size_t call = sourceOffset();
+                    const Function& callee = _functions[_functionAt[call + _source[call].p2]];
+                    if(callee._frameSize + 2 > size_t(limit - sp))
+                        return transfer(TransferKind::OVERFLOW, call);
+                    *++sp = int16_t(fp - base);
+                    fp = sp + 1;
+                    return transfer(TransferKind::CALL, call);
+                }
+
+                case RETURN:
+                    fp = base + *sp--;
+                    return transfer(TransferKind::RETURN, sourceOffset());
+
+                case INC_INT_BASEPOINTER_RELATIVE:
+                    fp[ip->p2] = int16_t(fp[ip->p2] + int8_t(ip->p1));
+                    ++ip;
+                    break;
+
+                case ADD_INT_IMMEDIATE:
+                    *sp = int16_t(*sp + ip->p2);
+                    ++ip;
+                    break;
+
+                case JUMP_BY_IF_NOT_LESS: {
+                    sp -= 2;
+                    bool jump = !(sp[1] < sp[2]);
+                    profile(jump);
+                    ip += jump ? ip->p2 : 1;
+                    break;
+                }
+
+                case POP_INT_N:
+                    sp -= ip->p2;
+                    ++ip;
+                    break;
+
+                default:
+                    throw runtime_error("Invalid opcode at instruction " + to_string(sourceOffset()));
+            }
+        }
+    }
+
+    bool TieredExecution::CompileNative(Function& function) {
+        auto native = make_unique<NativeFunction>();
+        X86Emitter emitter;
+        vector<pair<size_t, size_t>> branches;     // rel32 field, target in optimized code
+        vector<pair<size_t, size_t>> exitBranches; // rel32 field, exit
+        bool speculate = function._deoptimizations < _policy._maxDeoptimizations;
+
+        // Native code is generated from the optimized code, but exits and profiles
+        // use offsets into the source. A fused branch is the last instruction of its sequence.
+        size_t start = _optimizedOffsets[function._start];
+        size_t end = _optimizedOffsets[function._end];
+        auto sourceOffset = [&](size_t x) { return x < _optimized.size() ? _sourceOffsets[x] : _source.size(); };
+
+        auto exitTo = [&](size_t field, TransferKind kind, size_t offset, size_t branch = SIZE_MAX) {
+            exitBranches.emplace_back(field, native->_exits.size());
+            native->_exits.push_back(NativeFunction::Exit{kind, offset, branch});
+        };
+
+        EmitLoadState(emitter);
+        emitter.JumpIndirect(RSI);
+
+        vector<uint32_t> offsets(end - start);
+        for(size_t x = start; x < end; ++x) {
+            const Instruction& currInstruction = _optimized[x];
+            offsets[x - start] = uint32_t(emitter.Size());
+
+            if(EmitStraightLineTemplate(emitter, currInstruction))
+                continue;
+
+            switch(currInstruction._opcode) {
+                case EXIT:
+                    exitTo(emitter.Jump(), TransferKind::EXIT, sourceOffset(x));
+                    break;
+
+                case JUMP_BY:
+                    branches.emplace_back(emitter.Jump(), x + currInstruction.p2);
+                    break;
+
+                case JUMP_BY_IF_ZERO:
+                case JUMP_BY_IF_NOT_LESS: {
+                    X86Condition jumps = EQUAL;
+                    X86Condition fallsThrough = NOT_EQUAL;
+                    if(currInstruction._opcode == JUMP_BY_IF_ZERO) {
+                        emitter.LoadInt16(RAX, STACK_POINTER, 0);
+                        emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                        emitter.TestInt16(RAX);
+                    } else {
+                        emitter.LoadInt16(RAX, STACK_POINTER, JitSlot(-1));
+                        emitter.SubImmediate(STACK_POINTER, JitSlot(2));
+                        emitter.CompareInt16(RAX, STACK_POINTER, JitSlot(2));
+                        jumps = NOT_LESS;
+                        fallsThrough = LESS;
+                    }
+
+                    // A direction the interpreter never saw leaves native code instead.
+                    size_t branch = sourceOffset(x + 1) - 1;
+                    const BranchProfile& profile = _branchProfiles[branch];
+                    size_t target = x + currInstruction.p2;
+                    if(speculate && profile._jumped == 0 && profile._fellThrough > 0) {
+                        exitTo(emitter.JumpIf(jumps), TransferKind::DEOPTIMIZE, sourceOffset(target), branch);
+                    } else if(speculate && profile._fellThrough == 0 && profile._jumped > 0) {
+                        exitTo(emitter.JumpIf(fallsThrough), TransferKind::DEOPTIMIZE, branch + 1, branch);
+                        branches.emplace_back(emitter.Jump(), target);
+                    } else {
+                        branches.emplace_back(emitter.JumpIf(jumps), target);
+                    }
+                    break;
+                }
+
+                case CALL: {
+                    size_t call = sourceOffset(x);
+                    const Function& callee = _functions[_functionAt[call + _source[call].p2]];
+                    exitTo(EmitFrameCheck(emitter, callee._frameSize), TransferKind::OVERFLOW, call);
+                    EmitEnterFrame(emitter);
+                    exitTo(emitter.Jump(), TransferKind::CALL, call);
+                    break;
+                }
+
+                case RETURN:
+                    EmitLeaveFrame(emitter);
+                    exitTo(emitter.Jump(), TransferKind::RETURN, sourceOffset(x));
+                    break;
+
+                default:
+                    throw runtime_error("Invalid opcode at instruction " + to_string(sourceOffset(x)));
+            }
+        }
+
+        vector<size_t> exitStubs = EmitExitStubs(emitter, native->_exits.size());
+        for(auto [field, exit] : exitBranches)
+            emitter.PatchRelative(field, exitStubs[exit]);
+        for(auto [field, target] : branches) {
+            // Code that jumps between functions is left to the interpreter.
+            if(target < start || target >= end)
+                return false;
+            emitter.PatchRelative(field, offsets[target - start]);
+        }
+
+        // Entry points by source offset; native code is only entered at the start of a sequence.
+        native->_offsets.resize(function._end - function._start);
+        for(size_t x = function._start; x < function._end; ++x)
+            native->_offsets[x - function._start] = offsets[_optimizedOffsets[x] - start];
+
+        native->_memory = ExecutableMemory(emitter.Bytes());
+        if(JitSymbols* symbols = CurrentJitSymbols())
+            symbols->AddCode(FunctionName(_functionNames, function._start) + " [native]",
+                             native->_memory.Data(), native->_memory.Size());
+        function._native = std::move(native);
+        return true;
+    }
+
+    TieredExecution::Transfer TieredExecution::RunNative(Function& function, size_t offset, JitState& state) {
+        const NativeFunction& native = *function._native;
+        NativeEntry entry = reinterpret_cast<NativeEntry>(const_cast<uint8_t*>(native._memory.Data()));
+        const NativeFunction::Exit& exit = native._exits[entry(&state, native.At(offset, function._start))];
+
+        // Count the direction native code didn't expect, so it isn't speculated on again.
+        if(exit._kind == TransferKind::DEOPTIMIZE) {
+            BranchProfile& profile = _branchProfiles[exit._branch];
+            ++(exit._offset == exit._branch + 1 ? profile._fellThrough : profile._jumped);
+        }
+        return Transfer{exit._kind, exit._offset};
+    }
+
+    void TieredExecution::Run(size_t entry, vector<int16_t> args, int16_t* result) {
+        if(entry >= _source.size())
+            throw out_of_range("Entry point outside of the code");
+
+        OperandStack stack;
+        int16_t* sp = stack.Base() - 1;
+
+        // Result slot, arguments, the outermost saved base and the entry frame itself.
+        if(size_t(result != nullptr) + args.size() + 1 + FrameSize(_source.data(), _source.size(), entry)
+           > stack.NumSlots())
+            throw StackOverflow();
+
+        if(result) {
+            *++sp = 0;
+        }
+        for(int16_t arg : args) {
+            *++sp = arg;
+        }
+        *++sp = 0;
+
+        JitState state{sp, sp + 1, stack.Base(), stack.Limit()};
+        vector<size_t> returnOffsets;
+        Function* function = &_functions[_functionAt[entry]];
+        size_t offset = entry;
+        if(offset == function->_start)
+            Enter(*function);
+
+        while(true) {
+            Transfer transfer = function->_tier == Tier::NATIVE ? RunNative(*function, offset, state)
+                                                                : Interpret(*function, offset, state);
+            switch(transfer._kind) {
+                case TransferKind::CALL:
+                    returnOffsets.push_back(transfer._offset + 1);
+                    offset = transfer._offset + _source[transfer._offset].p2;
+                    function = &_functions[_functionAt[offset]];
+                    Enter(*function);
+                    break;
+
+                case TransferKind::RETURN:
+                    if(returnOffsets.empty()) {
+                        if(result)
+                            *result = stack.Base()[0];
+                        return;
+                    }
+                    offset = returnOffsets.back();
+                    returnOffsets.pop_back();
+                    function = &_functions[_functionAt[offset]];
+                    break;
+
+                case TransferKind::EXIT:
+                    if(result)
+                        *result = stack.Base()[0];
+                    return;
+
+                case TransferKind::DEOPTIMIZE:
+                    Deoptimize(*function);
+                    offset = transfer._offset;
+                    break;
+
+                case TransferKind::ON_STACK_REPLACEMENT:
+                    // The frame is already where every tier expects it, at the loop header.
+                    TierUp(*function);
+                    offset = transfer._offset;
+                    break;
+
+                case TransferKind::OVERFLOW:
+                    throw StackOverflow();
+            }
+        }
+    }
+
+}
@@ -0,0 +1,349 @@
+#include "../include/TracingJit.h"
+#include "../include/JitTemplates.h"
+#include "../include/JitSymbols.h"
+#include "../include/OutputSink.h"
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#if !defined(__x86_64__)
+#error "The tracing JIT only generates x86-64 code"
+#endif
+
+namespace interpreter {
+
+    using namespace std;
+
+    typedef int (*TraceEntry)(JitState* state);
+
+    struct TracingJit::Trace {
+        // Where the interpreter continues, and the return addresses of the calls
+        // inlined into the trace that are still active at that point.
+        struct SideExit {
+            size_t _resumeOffset;
+            vector<size_t> _inlinedReturns;
+        };
+
+        ExecutableMemory _memory;
+        vector<SideExit> _exits;
+    };
+
+    TracingJit::TracingJit(const Instruction* code, size_t numInstructions, uint32_t hotLoopThreshold,
+                           map<size_t, string> functionNames)
+        : _source(code, code + numInstructions), _hotLoopThreshold(max<uint32_t>(hotLoopThreshold, 1)),
+          _backEdgeCounts(numInstructions, 0), _blacklisted(numInstructions, false),
+          _frameSizes(numInstructions, SIZE_MAX), _traces(numInstructions), _functionNames(std::move(functionNames)) {
+        RequireNarrowCode(code, numInstructions);
+        for(size_t x = 0; x < numInstructions; ++x) {
+            const Instruction& currInstruction = code[x];
+            if(currInstruction._opcode >= NUM_INSTRUCTIONS)
+                throw runtime_error("Invalid opcode at instruction " + to_string(x));
+
+            if(currInstruction._opcode == JUMP_BY_IF_ZERO || currInstruction._opcode == JUMP_BY
+               || currInstruction._opcode == CALL || currInstruction._opcode == JUMP_BY_IF_NOT_LESS) {
+                ptrdiff_t target = ptrdiff_t(x) + currInstruction.p2;
+                if(target < 0 || size_t(target) >= numInstructions)
+                    throw runtime_error("Jump target out of range at instruction " + to_string(x));
+            }
+        }
+    }
+
+    TracingJit::~TracingJit() = default;
+
+    size_t TracingJit::CalleeFrameSize(size_t target) {
+        if(_frameSizes[target] == SIZE_MAX)
+            _frameSizes[target] = FrameSize(_source.data(), _source.size(), target);
+        return _frameSizes[target];
+    }
+
+    bool TracingJit::CompileTrace(size_t header, const vector<TraceStep>& steps) {
+        auto trace = make_unique<Trace>();
+        X86Emitter emitter;
+        vector<pair<size_t, size_t>> exitBranches; // rel32 field, side exit
+        vector<size_t> inlinedReturns;
+
+        EmitLoadState(emitter);
+        size_t loopStart = emitter.Size();
+
+        auto sideExit = [&](size_t field, size_t resumeOffset) {
+            exitBranches.emplace_back(field, trace->_exits.size());
+            trace->_exits.push_back(Trace::SideExit{resumeOffset, inlinedReturns});
+        };
+
+        for(const TraceStep& step : steps) {
+            const Instruction& currInstruction = _source[step._offset];
+            if(EmitStraightLineTemplate(emitter, currInstruction))
+                continue;
+
+            switch(currInstruction._opcode) {
+                case JUMP_BY:
+                    break;
+
+                case JUMP_BY_IF_ZERO:
+                    emitter.LoadInt16(RAX, STACK_POINTER, 0);
+                    emitter.SubImmediate(STACK_POINTER, JitSlot(1));
+                    emitter.TestInt16(RAX);
+                    if(step._jumped)
+                        sideExit(emitter.JumpIf(NOT_EQUAL), step._offset + 1);
+                    else
+                        sideExit(emitter.JumpIf(EQUAL), step._offset + currInstruction.p2);
+                    break;
+
+                case JUMP_BY_IF_NOT_LESS:
+                    emitter.LoadInt16(RAX, STACK_POINTER, JitSlot(-1));
+                    emitter.SubImmediate(STACK_POINTER, JitSlot(2));
+                    emitter.CompareInt16(RAX, STACK_POINTER, JitSlot(2));
+                    if(step._jumped)
+                        sideExit(emitter.JumpIf(LESS), step._offset + 1);
+                    else
+                        sideExit(emitter.JumpIf(NOT_LESS), step._offset + currInstruction.p2);
+                    break;
+
+                case CALL: {
+                    // Leave before the call if it would overflow, the interpreter reports it.
+                    size_t target = step._offset + currInstruction.p2;
+                    sideExit(EmitFrameCheck(emitter, CalleeFrameSize(target)), step._offset);
+                    EmitEnterFrame(emitter);
+                    inlinedReturns.push_back(step._offset + 1);
+                    break;
+                }
+
+                case RETURN:
+                    if(inlinedReturns.empty())
+                        return false;
+                    EmitLeaveFrame(emitter);
+                    inlinedReturns.pop_back();
+                    break;
+
+                default:
+                    return false;
+            }
+        }
+
+        if(!inlinedReturns.empty())
+            return false;
+        emitter.PatchRelative(emitter.Jump(), loopStart);
+
+        vector<size_t> exitStubs = EmitExitStubs(emitter, trace->_exits.size());
+        for(auto [field, exit] : exitBranches)
+            emitter.PatchRelative(field, exitStubs[exit]);
+
+        trace->_memory = ExecutableMemory(emitter.Bytes());
+        if(JitSymbols* symbols = CurrentJitSymbols())
+            symbols->AddCode(FunctionName(_functionNames, header) + " [trace@" + to_string(header) + "]",
+                             trace->_memory.Data(), trace->_memory.Size());
+        _traces[header] = std::move(trace);
+        ++_numTraces;
+        return true;
+    }
+
+    void TracingJit::Run(size_t entry, vector<int16_t> args, int16_t* result) {
+        if(entry >= _source.size())
+            throw out_of_range("Entry point outside of the code");
+
+        OperandStack stack;
+        int16_t* const base = stack.Base();
+        int16_t* const limit = stack.Limit();
+        int16_t* sp = base - 1;
+
+        // Result slot, arguments, the outermost saved base and the entry frame itself.
+        if(size_t(result != nullptr) + args.size() + 1 + CalleeFrameSize(entry) > stack.NumSlots())
+            throw StackOverflow();
+
+        if(result) {
+            *++sp = 0;
+        }
+        for(int16_t arg : args) {
+            *++sp = arg;
+        }
+        *++sp = 0;
+
+        const Instruction* const code = _source.data();
+        const Instruction* ip = code + entry;
+        int16_t* fp = sp + 1;
+        const Instruction** const returnAddresses = reinterpret_cast<const Instruction**>(stack.ReturnAddresses());
+        const Instruction** returnAddress = returnAddresses;
+        *returnAddress = nullptr;
+
+        bool recording = false;
+        size_t recordedHeader = 0;
+        ptrdiff_t recordedDepth = 0;
+        vector<TraceStep> steps;
+
+        auto stopRecording = [&](bool blacklist) {
+            if(blacklist)
+                _blacklisted[recordedHeader] = true;
+            recording = false;
+            steps.clear();
+        };
+
+        while(true) {
+            size_t offset = size_t(ip - code);
+
+            if(recording) {
+                if(offset == recordedHeader && returnAddress - returnAddresses == recordedDepth && !steps.empty()) {
+                    bool compiled = CompileTrace(recordedHeader, steps);
+                    stopRecording(!compiled);
+                } else if(steps.size() == MAX_TRACE_LENGTH) {
+                    stopRecording(true);
+                } else {
+                    steps.push_back(TraceStep{offset, false});
+                }
+            }
+
+            if(!recording && _traces[offset]) {
+                const Trace& trace = *_traces[offset];
+                JitState state{sp, fp, base, limit};
+                int exitIndex = reinterpret_cast<TraceEntry>(const_cast<uint8_t*>(trace._memory.Data()))(&state);
+
+                const Trace::SideExit& exit = trace._exits[exitIndex];
+                sp = state._sp;
+                fp = state._fp;
+                for(size_t returnOffset : exit._inlinedReturns)
+                    *++returnAddress = code + returnOffset;
+                ip = code + exit._resumeOffset;
+                continue;
+            }
+
+            switch(ip->_opcode) {
+                case EXIT:
+                    if(recording)
+                        stopRecording(true);
+                    if(result)
+                        *result = base[0];
+                    return;
+
+                case ADD_INT:
+                    sp[-1] = int16_t(sp[-1] + sp[0]);
+                    --sp;
+                    ++ip;
+                    break;
+
+                case PUSH_INT:
+                    *++sp = ip->p2;
+                    ++ip;
+                    break;
+
+                case POP_INT:
+                    --sp;
+                    ++ip;
+                    break;
+
+                case PRINT_INT:
+                    CurrentOutput().PrintInt(*sp--);
+                    ++ip;
+                    break;
+
+                case COMP_INT_LT:
+                    sp[-1] = sp[-1] < sp[0];
+                    --sp;
+                    ++ip;
+                    break;
+
+                case LOAD_INT:
+                    *++sp = base[ip->p2];
+                    ++ip;
+                    break;
+
+                case STORE_INT:
+                    base[ip->p2] = *sp--;
+                    ++ip;
+                    break;
+
+                case JUMP_BY_IF_ZERO:
+                    if(*sp-- == 0) {
+                        if(recording)
+                            steps.back()._jumped = true;
+                        ip += ip->p2;
+                    } else {
+                        ++ip;
+                    }
+                    break;
+
+                case JUMP_BY: {
+                    const Instruction* target = ip + ip->p2;
+                    if(ip->p2 < 0) {
+                        size_t header = size_t(target - code);
+                        ptrdiff_t depth = returnAddress - returnAddresses;
+                        if(recording) {
+                            // Nested and recursive loops aren't traced.
+                            if(header != recordedHeader || depth != recordedDepth)
+                                stopRecording(true);
+                        } else if(!_traces[header] && !_blacklisted[header]
+                                  && ++_backEdgeCounts[header] >= _hotLoopThreshold) {
+                            recording = true;
+                            recordedHeader = header;
+                            recordedDepth = depth;
+                        }
+                    }
+                    ip = target;
+                    break;
+                }
+
+                case LOAD_INT_BASEPOINTER_RELATIVE:
+                    *++sp = fp[ip->p2];
+                    ++ip;
+                    break;
+
+                case STORE_INT_BASEPOINTER_RELATIVE:
+                    fp[ip->p2] = *sp--;
+                    ++ip;
+                    break;
+
+                case CALL: {
+                    size_t target = offset + ip->p2;
+                    if(CalleeFrameSize(target) + 2 > size_t(limit - sp))
+                        throw StackOverflow();
+                    *++sp = int16_t(fp - base);
+                    *++returnAddress = ip + 1;
+                    fp = sp + 1;
+                    ip = code + target;
+                    break;
+                }
+
+                case RETURN:
+                    if(recording && returnAddress - returnAddresses == recordedDepth)
+                        stopRecording(true);
+                    ip = *returnAddress--;
+                    fp = base + *sp--;
+                    if(!ip) {
+                        if(result)
+                            *result = base[0];
+                        return;
+                    }
+                    break;
+
+                case INC_INT_BASEPOINTER_RELATIVE:
+                    fp[ip->p2] = int16_t(fp[ip->p2] + int8_t(ip->p1));
+                    ++ip;
+                    break;
+
+                case ADD_INT_IMMEDIATE:
+                    *sp = int16_t(*sp + ip->p2);
+                    ++ip;
+                    break;
+
+                case JUMP_BY_IF_NOT_LESS:
+                    sp -= 2;
+                    if(sp[1] < sp[2]) {
+                        ++ip;
+                    } else {
+                        if(recording)
+                            steps.back()._jumped = true;
+                        ip += ip->p2;
+                    }
+                    break;
+
+                case POP_INT_N:
+                    sp -= ip->p2;
+                    ++ip;
+                    break;
+
+                default:
+                    throw runtime_error("Invalid opcode at instruction " + to_string(offset));
+            }
+        }
+    }
+
+}
@@ -0,0 +1,153 @@
+#include "../include/VM.h"
+
+namespace interpreter {
+
+    using namespace std;
+
+    // What a run reports to besides executing.
+    struct DispatchHooks {
+        ExecutionCounters* _counters;
+        CallProfiler* _profiler;
+        TraceRecorder* _recorder;
+    };
+
+    // Counting, profiling and recording are separate instantiations, so plain runs keep the plain loop.
+    template<bool COUNT, bool PROFILE, bool RECORD>
+    static void Dispatch(InterpreterRegisters& registers, const DispatchHooks& hooks) {
+        Opcode previous = NUM_INSTRUCTIONS;
+        if constexpr(PROFILE)
+            hooks._profiler->Start(registers._currInstruction);
+        TraceRecorder::Stream* trace = nullptr;
+        if constexpr(RECORD) {
+            trace = &hooks._recorder->StreamOfThisThread();
+            trace->Start(registers._currInstruction, registers._stack.size());
+        }
+
+        while(registers._currInstruction != nullptr) {
+            const Instruction* current = registers._currInstruction;
+            if constexpr(COUNT) {
+                hooks._counters->Count(current, previous);
+                previous = current->_opcode;
+            }
+            if constexpr(PROFILE)
+                hooks._profiler->CountInstruction();
+
+            gInstructionFunctions[current->_opcode](registers);
+
+            if constexpr(PROFILE) {
+                if(current->_opcode == CALL)
+                    hooks._profiler->Call(registers._currInstruction);
+                else if(current->_opcode == RETURN)
+                    hooks._profiler->Return();
+            }
+            if constexpr(RECORD) {
+                switch(current->_opcode) {
+                    case JUMP_BY_IF_ZERO:
+                    case JUMP_BY_IF_NOT_LESS:
+                    case JUMP_BY:
+                    case CALL:
+                    case RETURN:
+                    case EXIT:
+                        trace->Record(current, registers._currInstruction, registers._stack.size());
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+
+    typedef void (*DispatchFunction)(InterpreterRegisters& registers, const DispatchHooks& hooks);
+
+    // Indexed by counting, profiling and recording as bits 0, 1 and 2.
+    static const DispatchFunction gDispatchFunctions[8] = {
+            Dispatch<false, false, false>,
+            Dispatch<true, false, false>,
+            Dispatch<false, true, false>,
+            Dispatch<true, true, false>,
+            Dispatch<false, false, true>,
+            Dispatch<true, false, true>,
+            Dispatch<false, true, true>,
+            Dispatch<true, true, true>,
+    };
+
+    VM::VM(size_t reservedSlots, size_t reservedCallDepth) : _registers{} {
+        _registers._stack.reserve(reservedSlots);
+        _registers._returnAdressStack.reserve(reservedCallDepth);
+    }
+
+    int16_t VM::Call(Instruction* code, span<const int16_t> args) {
+        int16_t result = 0;
+        Run(code, args, &result);
+        return result;
+    }
+
+    int16_t VM::Call(const ThreadedCode& code, size_t entry, span<const int16_t> args) {
+        int16_t result = 0;
+        Run(code, entry, args, &result);
+        return result;
+    }
+
+    int64_t VM::Call(Instruction* code, span<const int64_t> args) {
+        int64_t result = 0;
+        Run(code, args, &result);
+        return result;
+    }
+
+    void VM::Run(Instruction* code, span<const int16_t> args, int16_t* result) {
+        Run(code, args, result != nullptr);
+        if(result)
+            *result = int16_t(_registers._stack[0]);
+    }
+
+    void VM::Run(Instruction* code, span<const int64_t> args, int64_t* result) {
+        Run(code, args, result != nullptr);
+        if(result)
+            *result = _registers._stack[0];
+    }
+
+    template<typename Value>
+    void VM::Run(Instruction* code, span<const Value> args, bool withResult) {
+        // clear() keeps the capacity of the previous invocations.
+        _registers._stack.clear();
+        _registers._returnAdressStack.clear();
+        _registers._currInstruction = code;
+        _registers._constants = _constants ? _constants->Data() : nullptr;
+        _registers._numConstants = _constants ? _constants->Size() : 0;
+        _heap.Clear();
+        _registers._heap = &_heap;
+        _registers._strings = &_strings;
+
+        if(withResult) {
+            _registers._stack.push_back(0);
+        }
+        _registers._stack.insert(_registers._stack.end(), args.begin(), args.end());
+
+        _registers._stack.push_back(0);
+        _registers._returnAdressStack.push_back(nullptr);
+        _registers._baseIdx = _registers._stack.size();
+
+        // The sampler reads the instruction pointer the instruction functions update in
+        // memory. It stops when the run ends, an instruction throwing included, so it never
+        // reads the registers of a VM that is gone.
+        struct Watching {
+            SamplingProfiler* _sampler;
+            ~Watching() {
+                if(_sampler)
+                    _sampler->Watch(nullptr);
+            }
+        } watching{_sampler};
+        if(_sampler)
+            _sampler->Watch(&_registers._currInstruction);
+
+        size_t dispatch = (_counters ? 1 : 0) | (_profiler ? 2 : 0) | (_recorder ? 4 : 0);
+        gDispatchFunctions[dispatch](_registers, DispatchHooks{_counters, _profiler, _recorder});
+    }
+
+    void VM::Run(const ThreadedCode& code, size_t entry, span<const int16_t> args, int16_t* result) {
+        if(!_operandStack)
+            _operandStack = make_unique<OperandStack>();
+        ThreadedInterpreter::Run(code, entry, args, *_operandStack, result);
+    }
+
+}
@@ -0,0 +1,114 @@
+#include "../include/WorkStealingPool.h"
+#include <algorithm>
+
+namespace interpreter {
+
+    using namespace std;
+
+    WorkStealingPool::WorkStealingPool(size_t numWorkers) {
+        if(numWorkers == 0)
+            numWorkers = max(1u, thread::hardware_concurrency());
+
+        for(size_t x = 0; x < numWorkers; ++x)
+            _workers.push_back(make_unique<Worker>());
+        for(size_t x = 0; x < numWorkers; ++x)
+            _workers[x]->_thread = thread(&WorkStealingPool::WorkerLoop, this, x);
+    }
+
+    WorkStealingPool::~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_all();
+        for(auto& worker : _workers)
+            worker->_thread.join();
+    }
+
+    void WorkStealingPool::ParallelFor(size_t count, const function<void(size_t, size_t)>& body) {
+        if(count == 0)
+            return;
+
+        lock_guard<mutex> parallelForLock(_parallelForMutex);
+        size_t rangeSize = max<size_t>(1, count / (_workers.size() * RANGES_PER_WORKER));
+
+        // Set up before any range is visible: a worker still looking for work from
+        // the previous call may take one right away.
+        {
+            lock_guard<mutex> lock(_mutex);
+            _body = &body;
+            _error = nullptr;
+            _remainingRanges = (count + rangeSize - 1) / rangeSize;
+        }
+
+        size_t worker = 0;
+        for(size_t begin = 0; begin < count; begin += rangeSize) {
+            Worker& owner = *_workers[worker++ % _workers.size()];
+            lock_guard<mutex> lock(owner._mutex);
+            owner._ranges.emplace_back(begin, min(count, begin + rangeSize));
+        }
+
+        unique_lock<mutex> lock(_mutex);
+        ++_generation;
+        _wake.notify_all();
+        _done.wait(lock, [&] { return _remainingRanges == 0; });
+
+        _body = nullptr;
+        if(_error)
+            rethrow_exception(exchange(_error, nullptr));
+    }
+
+    bool WorkStealingPool::TakeRange(size_t worker, pair<size_t, size_t>& range) {
+        {
+            Worker& own = *_workers[worker];
+            lock_guard<mutex> lock(own._mutex);
+            if(!own._ranges.empty()) {
+                range = own._ranges.back();
+                own._ranges.pop_back();
+                return true;
+            }
+        }
+
+        for(size_t x = 1; x < _workers.size(); ++x) {
+            Worker& victim = *_workers[(worker + x) % _workers.size()];
+            lock_guard<mutex> lock(victim._mutex);
+            if(!victim._ranges.empty()) {
+                range = victim._ranges.front();
+                victim._ranges.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkStealingPool::WorkerLoop(size_t worker) {
+        uint64_t seenGeneration = 0;
+        while(true) {
+            {
+                unique_lock<mutex> lock(_mutex);
+                _wake.wait(lock, [&] { return _stopping || _generation != seenGeneration; });
+                if(_stopping)
+                    return;
+                seenGeneration = _generation;
+            }
+
+            pair<size_t, size_t> range;
+            while(TakeRange(worker, range)) {
+                try {
+                    for(size_t index = range.first; index < range.second; ++index)
+                        (*_body)(index, worker);
+                } catch(...) {
+                    lock_guard<mutex> lock(_mutex);
+                    if(!_error)
+                        _error = current_exception();
+                }
+
+                if(--_remainingRanges == 0) {
+                    lock_guard<mutex> lock(_mutex);
+                    _done.notify_all();
+                }
+            }
+        }
+    }
+
+}
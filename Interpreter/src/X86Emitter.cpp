@@ -0,0 +1,283 @@
+#include "../include/X86Emitter.h"
+#include <stdexcept>
+
+namespace interpreter {
+
+    using namespace std;
+
+    static bool FitsInt8(int32_t value) {
+        return value >= INT8_MIN && value <= INT8_MAX;
+    }
+
+    void X86Emitter::Emit16(uint16_t value) {
+        Emit(uint8_t(value));
+        Emit(uint8_t(value >> 8));
+    }
+
+    void X86Emitter::Emit32(uint32_t value) {
+        Emit16(uint16_t(value));
+        Emit16(uint16_t(value >> 16));
+    }
+
+    void X86Emitter::Rex(bool wide, uint8_t reg, uint8_t base, bool force) {
+        uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg >> 3) << 2) | (base >> 3);
+        if(rex != 0x40 || force)
+            Emit(rex);
+    }
+
+    void X86Emitter::MemoryOperand(uint8_t reg, X86Register base, int32_t disp) {
+        uint8_t rm = base & 7;
+        uint8_t mod = disp == 0 && rm != RBP ? 0x00 : FitsInt8(disp) ? 0x40 : 0x80;
+        Emit(mod | ((reg & 7) << 3) | rm);
+        if(rm == RSP)
+            Emit(0x24); // SIB: no index, base in rm
+        if(mod == 0x40)
+            Emit(uint8_t(int8_t(disp)));
+        else if(mod == 0x80)
+            Emit32(uint32_t(disp));
+    }
+
+    void X86Emitter::RegisterOperand(uint8_t reg, X86Register rm) {
+        Emit(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void X86Emitter::LoadInt16(X86Register dst, X86Register base, int32_t disp) {
+        Emit(0x66);
+        Rex(false, dst, base);
+        Emit(0x8B);
+        MemoryOperand(dst, base, disp);
+    }
+
+    void X86Emitter::LoadSignExtendInt16(X86Register dst, X86Register base, int32_t disp) {
+        Rex(true, dst, base);
+        Emit(0x0F);
+        Emit(0xBF);
+        MemoryOperand(dst, base, disp);
+    }
+
+    void X86Emitter::StoreInt16(X86Register base, int32_t disp, X86Register src) {
+        Emit(0x66);
+        Rex(false, src, base);
+        Emit(0x89);
+        MemoryOperand(src, base, disp);
+    }
+
+    void X86Emitter::StoreImmediateInt16(X86Register base, int32_t disp, int16_t value) {
+        Emit(0x66);
+        Rex(false, 0, base);
+        Emit(0xC7);
+        MemoryOperand(0, base, disp);
+        Emit16(uint16_t(value));
+    }
+
+    void X86Emitter::AddInt16(X86Register base, int32_t disp, X86Register src) {
+        Emit(0x66);
+        Rex(false, src, base);
+        Emit(0x01);
+        MemoryOperand(src, base, disp);
+    }
+
+    void X86Emitter::AddImmediateInt16(X86Register base, int32_t disp, int16_t value) {
+        Emit(0x66);
+        Rex(false, 0, base);
+        if(FitsInt8(value)) {
+            Emit(0x83);
+            MemoryOperand(0, base, disp);
+            Emit(uint8_t(int8_t(value)));
+        } else {
+            Emit(0x81);
+            MemoryOperand(0, base, disp);
+            Emit16(uint16_t(value));
+        }
+    }
+
+    void X86Emitter::CompareInt16(X86Register lhs, X86Register base, int32_t disp) {
+        Emit(0x66);
+        Rex(false, lhs, base);
+        Emit(0x3B);
+        MemoryOperand(lhs, base, disp);
+    }
+
+    void X86Emitter::TestInt16(X86Register reg) {
+        Emit(0x66);
+        Rex(false, reg, reg);
+        Emit(0x85);
+        RegisterOperand(reg, reg);
+    }
+
+    void X86Emitter::SetLessZeroExtend(X86Register reg) {
+        // Without a REX prefix the byte registers 4-7 would be ah, ch, dh and bh.
+        Rex(false, 0, reg, reg >= RSP);
+        Emit(0x0F);
+        Emit(0x9C);
+        RegisterOperand(0, reg);
+        Rex(false, reg, reg, reg >= RSP);
+        Emit(0x0F);
+        Emit(0xB6);
+        RegisterOperand(reg, reg);
+    }
+
+    void X86Emitter::Move(X86Register dst, X86Register src) {
+        Rex(true, src, dst);
+        Emit(0x89);
+        RegisterOperand(src, dst);
+    }
+
+    void X86Emitter::MoveImmediate(X86Register dst, uint64_t value) {
+        Rex(true, 0, dst);
+        Emit(0xB8 + (dst & 7));
+        Emit32(uint32_t(value));
+        Emit32(uint32_t(value >> 32));
+    }
+
+    void X86Emitter::MoveImmediate32(X86Register dst, uint32_t value) {
+        Rex(false, 0, dst);
+        Emit(0xB8 + (dst & 7));
+        Emit32(value);
+    }
+
+    void X86Emitter::Load(X86Register dst, X86Register base, int32_t disp) {
+        Rex(true, dst, base);
+        Emit(0x8B);
+        MemoryOperand(dst, base, disp);
+    }
+
+    void X86Emitter::Store(X86Register base, int32_t disp, X86Register src) {
+        Rex(true, src, base);
+        Emit(0x89);
+        MemoryOperand(src, base, disp);
+    }
+
+    void X86Emitter::LoadEffectiveAddress(X86Register dst, X86Register base, int32_t disp) {
+        Rex(true, dst, base);
+        Emit(0x8D);
+        MemoryOperand(dst, base, disp);
+    }
+
+    void X86Emitter::LoadEffectiveAddress(X86Register dst, X86Register base, X86Register index, uint8_t scale) {
+        if((index & 15) == RSP)
+            throw invalid_argument("rsp can't be used as an index register");
+        uint8_t scaleBits = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+
+        Emit(0x48 | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+        Emit(0x8D);
+        // rbp and r13 as base need an explicit displacement.
+        bool needsDisp = (base & 7) == RBP;
+        Emit((needsDisp ? 0x44 : 0x04) | ((dst & 7) << 3));
+        Emit((scaleBits << 6) | ((index & 7) << 3) | (base & 7));
+        if(needsDisp)
+            Emit(0);
+    }
+
+    void X86Emitter::Add(X86Register dst, X86Register src) {
+        Rex(true, src, dst);
+        Emit(0x01);
+        RegisterOperand(src, dst);
+    }
+
+    void X86Emitter::Sub(X86Register dst, X86Register src) {
+        Rex(true, src, dst);
+        Emit(0x29);
+        RegisterOperand(src, dst);
+    }
+
+    // Group 1 arithmetic with an immediate; extension goes in the ModRM reg field.
+    void X86Emitter::ArithmeticImmediate(uint8_t extension, X86Register dst, int32_t value) {
+        Rex(true, 0, dst);
+        Emit(FitsInt8(value) ? 0x83 : 0x81);
+        RegisterOperand(extension, dst);
+        if(FitsInt8(value))
+            Emit(uint8_t(int8_t(value)));
+        else
+            Emit32(uint32_t(value));
+    }
+
+    void X86Emitter::AddImmediate(X86Register dst, int32_t value) {
+        ArithmeticImmediate(0, dst, value);
+    }
+
+    void X86Emitter::SubImmediate(X86Register dst, int32_t value) {
+        ArithmeticImmediate(5, dst, value);
+    }
+
+    void X86Emitter::AndImmediate(X86Register dst, int32_t value) {
+        ArithmeticImmediate(4, dst, value);
+    }
+
+    void X86Emitter::CompareImmediate(X86Register lhs, int32_t value) {
+        ArithmeticImmediate(7, lhs, value);
+    }
+
+    void X86Emitter::ShiftRightArithmetic(X86Register reg, uint8_t count) {
+        Rex(true, 0, reg);
+        if(count == 1) {
+            Emit(0xD1);
+            RegisterOperand(7, reg);
+        } else {
+            Emit(0xC1);
+            RegisterOperand(7, reg);
+            Emit(count);
+        }
+    }
+
+    void X86Emitter::Xor32(X86Register dst, X86Register src) {
+        Rex(false, src, dst);
+        Emit(0x31);
+        RegisterOperand(src, dst);
+    }
+
+    void X86Emitter::Push(X86Register reg) {
+        Rex(false, 0, reg);
+        Emit(0x50 + (reg & 7));
+    }
+
+    void X86Emitter::Pop(X86Register reg) {
+        Rex(false, 0, reg);
+        Emit(0x58 + (reg & 7));
+    }
+
+    void X86Emitter::Return() {
+        Emit(0xC3);
+    }
+
+    void X86Emitter::CallIndirect(X86Register reg) {
+        Rex(false, 0, reg);
+        Emit(0xFF);
+        RegisterOperand(2, reg);
+    }
+
+    void X86Emitter::JumpIndirect(X86Register reg) {
+        Rex(false, 0, reg);
+        Emit(0xFF);
+        RegisterOperand(4, reg);
+    }
+
+    size_t X86Emitter::Jump() {
+        Emit(0xE9);
+        Emit32(0);
+        return Size() - 4;
+    }
+
+    size_t X86Emitter::JumpIf(X86Condition condition) {
+        Emit(0x0F);
+        Emit(0x80 | condition);
+        Emit32(0);
+        return Size() - 4;
+    }
+
+    size_t X86Emitter::Call() {
+        Emit(0xE8);
+        Emit32(0);
+        return Size() - 4;
+    }
+
+    void X86Emitter::PatchRelative(size_t field, size_t target) {
+        int64_t distance = int64_t(target) - int64_t(field + 4);
+        if(distance < INT32_MIN || distance > INT32_MAX)
+            throw runtime_error("Relative jump out of range in generated code");
+        uint32_t value = uint32_t(int32_t(distance));
+        for(size_t x = 0; x < 4; ++x)
+            _bytes[field + x] = uint8_t(value >> (8 * x));
+    }
+
+}
@@ -0,0 +1,484 @@
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <vector>
+#include "../include/Instruction.h"
+#include "../include/Interpreter.h"
+#include "../include/ThreadedCode.h"
+#include "../include/RegisterCode.h"
+#include "../include/Peephole.h"
+#include "../include/JitCode.h"
+#include "../include/TracingJit.h"
+#include "../include/TieredExecution.h"
+#include "../include/OutputSink.h"
+#include "../include/VM.h"
+#include "../include/BatchExecution.h"
+#include "../include/LockstepInterpreter.h"
+#include "../include/PerfCounters.h"
+#include "../include/ArrayKernels.h"
+#include "../include/ConstantPool.h"
+#include "../include/Strings.h"
+#include "../include/StackMaps.h"
+
+using namespace std;
+using namespace interpreter;
+
+// The loop shape generateCodeForStatement emits for compiler.myc's
+// "while (x < iterations) { x = x + 1; }", without the printNum call.
+static const vector<Instruction> gCountingLoop = {
+        Instruction{PUSH_INT, 0, 0}, // x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{COMP_INT_LT, 0, 0}, // x < iterations
+        Instruction{JUMP_BY_IF_ZERO, 0, 6}, // leave the loop
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT, 0, 0}, // x + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // x = x + 1
+        Instruction{JUMP_BY, 0, -8}, // back to the condition
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return x
+        Instruction{POP_INT, 0, 0}, // delete x
+        Instruction{RETURN, 0, 0}
+};
+
+// The same loop printing x on every iteration, like compiler.myc's printNum call.
+static const vector<Instruction> gPrintingLoop = {
+        Instruction{PUSH_INT, 0, 0}, // x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{COMP_INT_LT, 0, 0}, // x < iterations
+        Instruction{JUMP_BY_IF_ZERO, 0, 8}, // leave the loop
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PRINT_INT, 0, 0}, // print x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT, 0, 0}, // x + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // x = x + 1
+        Instruction{JUMP_BY, 0, -10}, // back to the condition
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return x
+        Instruction{POP_INT, 0, 0}, // delete x
+        Instruction{RETURN, 0, 0}
+};
+
+// compiler.myc's "int foo(int outsideNum) { return(700 + outsideNum); }".
+static const vector<Instruction> gFoo = {
+        Instruction{PUSH_INT, 0, 700}, // load 700
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load outsideNum
+        Instruction{ADD_INT, 0, 0}, // 700 + outsideNum
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return it
+        Instruction{JUMP_BY, 0, 1}, // to the epilog
+        Instruction{RETURN, 0, 0}
+};
+
+// Sums a new array of iterations ints element by element.
+static const vector<Instruction> gArraySumLoop = {
+        Instruction{PUSH_INT, 0, 0}, // x
+        Instruction{PUSH_INT, 0, 0}, // sum
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{NEW_ARRAY, 0, 0}, // the array
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{COMP_INT32_LT, 0, 0}, // x < iterations
+        Instruction{JUMP_BY_IF_ZERO, 0, 12}, // leave the loop
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 1}, // load sum
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 2}, // load the array
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{ARRAY_LOAD_INT, 0, 0}, // array[x]
+        Instruction{ADD_INT64, 0, 0}, // sum + array[x]
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 1}, // sum = sum + array[x]
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT32, 0, 0}, // x + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // x = x + 1
+        Instruction{JUMP_BY, 0, -14}, // back to the condition
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 1}, // load sum
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return sum
+        Instruction{POP_INT_N, 0, 3}, // delete x, sum and the array
+        Instruction{RETURN, 0, 0}
+};
+
+// The same sum as one bulk instruction.
+static const vector<Instruction> gArraySumBulk = {
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{NEW_ARRAY, 0, 0}, // the array
+        Instruction{ARRAY_SUM, 0, 0}, // sum it
+        Instruction{DOUBLE_TO_INT, 0, 0}, // as an int
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return it
+        Instruction{RETURN, 0, 0}
+};
+
+// Prints x three times an iteration, like three printNum calls.
+static const vector<Instruction> gPrintNumLoop = {
+        Instruction{PUSH_INT, 0, 0}, // x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{COMP_INT_LT, 0, 0}, // x < iterations
+        Instruction{JUMP_BY_IF_ZERO, 0, 12}, // leave the loop
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PRINT_INT, 0, 0}, // print x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PRINT_INT, 0, 0}, // print x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PRINT_INT, 0, 0}, // print x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT, 0, 0}, // x + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // x = x + 1
+        Instruction{JUMP_BY, 0, -14}, // back to the condition
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return x
+        Instruction{POP_INT, 0, 0}, // delete x
+        Instruction{RETURN, 0, 0}
+};
+
+// The same three values as one line, like print(x, x, x).
+static const vector<Instruction> gPrintLoop = {
+        Instruction{PUSH_INT, 0, 0}, // x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{COMP_INT_LT, 0, 0}, // x < iterations
+        Instruction{JUMP_BY_IF_ZERO, 0, 10}, // leave the loop
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PRINT_VALUES, 3, 0}, // print the three ints
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT, 0, 0}, // x + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // x = x + 1
+        Instruction{JUMP_BY, 0, -12}, // back to the condition
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return x
+        Instruction{POP_INT, 0, 0}, // delete x
+        Instruction{RETURN, 0, 0}
+};
+
+// Makes a small array every iteration, garbage by the next one.
+static const vector<Instruction> gAllocationLoop = {
+        Instruction{PUSH_INT, 0, 0}, // x
+        Instruction{PUSH_INT, 0, 0}, // the array
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{COMP_INT_LT, 0, 0}, // x < iterations
+        Instruction{JUMP_BY_IF_ZERO, 0, 9}, // leave the loop
+        Instruction{PUSH_INT, 0, 16}, // load 16
+        Instruction{NEW_ARRAY, 0, 0}, // an array of 16 ints
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 1}, // the array = it
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT, 0, 0}, // x + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // x = x + 1
+        Instruction{JUMP_BY, 0, -11}, // back to the condition
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return x
+        Instruction{POP_INT_N, 0, 2}, // delete x and the array
+        Instruction{RETURN, 0, 0}
+};
+
+// Keeps an array, a large array and a string made at run time in its frame
+// while it calls gGarbage iterations times, whose allocations fill the nursery
+// and the old generation, so the three are moved or kept by minor and major
+// collections at safepoints of both functions. Returns 778 if they survive.
+// PUSH_CONST 0 and 1 are "abcdefg" and "hijklmn", 2 the literal "abcdefghijklmn".
+static constexpr size_t GARBAGE_ENTRY = 40;
+static const vector<Instruction> gCollectingCalls = {
+        Instruction{PUSH_INT, 0, 0}, // i
+        Instruction{PUSH_INT, 0, 4}, // load 4
+        Instruction{NEW_ARRAY, 0, 0}, // small, an array of 4 ints
+        Instruction{PUSH_INT, 0, 20000}, // load 20000
+        Instruction{NEW_ARRAY, 0, 0}, // large, an array too large for the nursery
+        Instruction{PUSH_CONST, 0, 0}, // load "abcdefg"
+        Instruction{PUSH_CONST, 0, 1}, // load "hijklmn"
+        Instruction{CONCAT_STRING, 0, 0}, // text, a string of the heap
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 1}, // load small
+        Instruction{PUSH_INT, 0, 3}, // load 3
+        Instruction{PUSH_INT, 0, 333}, // load 333
+        Instruction{ARRAY_STORE_INT, 0, 0}, // small[3] = 333
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 2}, // load large
+        Instruction{PUSH_INT, 0, 19999}, // load 19999
+        Instruction{PUSH_INT, 0, 444}, // load 444
+        Instruction{ARRAY_STORE_INT, 0, 0}, // large[19999] = 444
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load i
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, -2}, // load iterations
+        Instruction{COMP_INT_LT, 0, 0}, // i < iterations
+        Instruction{JUMP_BY_IF_ZERO, 0, 7}, // leave the loop
+        Instruction{CALL, 0, int16_t(GARBAGE_ENTRY - 20)}, // garbage()
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load i
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT, 0, 0}, // i + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // i = i + 1
+        Instruction{JUMP_BY, 0, -9}, // back to the condition
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 1}, // load small
+        Instruction{PUSH_INT, 0, 3}, // load 3
+        Instruction{ARRAY_LOAD_INT, 0, 0}, // small[3]
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 2}, // load large
+        Instruction{PUSH_INT, 0, 19999}, // load 19999
+        Instruction{ARRAY_LOAD_INT, 0, 0}, // large[19999]
+        Instruction{ADD_INT64, 0, 0}, // small[3] + large[19999]
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 3}, // load text
+        Instruction{PUSH_CONST, 0, 2}, // load "abcdefghijklmn"
+        Instruction{EQUAL_STRING, 0, 0}, // text == "abcdefghijklmn"
+        Instruction{ADD_INT64, 0, 0}, // small[3] + large[19999] + (text == "abcdefghijklmn")
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, -3}, // return it
+        Instruction{POP_INT_N, 0, 4}, // delete i, small, large and text
+        Instruction{RETURN, 0, 0},
+        // garbage(), at GARBAGE_ENTRY
+        Instruction{PUSH_INT, 0, 0}, // x
+        Instruction{PUSH_INT, 0, 0}, // the array
+        Instruction{PUSH_INT, 0, 20000}, // load 20000
+        Instruction{NEW_ARRAY, 0, 0}, // a large array
+        Instruction{POP_INT, 0, 0}, // dropped right away
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 64}, // load 64
+        Instruction{COMP_INT_LT, 0, 0}, // x < 64
+        Instruction{JUMP_BY_IF_ZERO, 0, 9}, // leave the loop
+        Instruction{PUSH_INT, 0, 1000}, // load 1000
+        Instruction{NEW_ARRAY, 0, 0}, // an array of 1000 ints
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 1}, // the array = it
+        Instruction{LOAD_INT_BASEPOINTER_RELATIVE, 0, 0}, // load x
+        Instruction{PUSH_INT, 0, 1}, // load 1
+        Instruction{ADD_INT, 0, 0}, // x + 1
+        Instruction{STORE_INT_BASEPOINTER_RELATIVE, 0, 0}, // x = x + 1
+        Instruction{JUMP_BY, 0, -11}, // back to the condition
+        Instruction{POP_INT_N, 0, 2}, // delete x and the array
+        Instruction{RETURN, 0, 0}
+};
+
+static constexpr int16_t ITERATIONS = 30000;
+static constexpr int REPETITIONS = 200;
+
+static constexpr int CALLS = 1000000;
+
+// Hardware counters of every timed loop, printed at the end.
+static PerfCounters gPerf;
+
+static void MeasureCalls(const char* name, const function<int16_t(int16_t)>& call) {
+    int16_t result = call(77); // warm up
+    auto start = chrono::steady_clock::now();
+    {
+        auto phase = gPerf.Measure(name);
+        for(int x = 0; x < CALLS; ++x)
+            result = call(int16_t(x));
+    }
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+
+    cout << name << ": " << elapsed.count() / CALLS << " ns per call (result " << result << ")" << endl;
+}
+
+static void Measure(const char* name, const function<int16_t()>& run) {
+    int16_t result = run(); // warm up
+    auto start = chrono::steady_clock::now();
+    {
+        auto phase = gPerf.Measure(name);
+        for(int x = 0; x < REPETITIONS; ++x)
+            result = run();
+    }
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+
+    cout << name << ": " << elapsed.count() / (double(REPETITIONS) * ITERATIONS)
+         << " ns per loop iteration (result " << result << ")" << endl;
+}
+
+// Runs gCollectingCalls peephole optimized, with its stack maps moved along,
+// and fails unless what it keeps survived collections of both kinds.
+static bool CheckCollections() {
+    vector<Instruction> code = gCollectingCalls;
+    StackMaps maps;
+    map<size_t, CalleeShape> callees{{GARBAGE_ENTRY, CalleeShape{0, false, SlotKind::VALUE}}};
+    maps.AddFunction(code.data(), code.size(), 0, {SlotKind::VALUE}, callees);
+    maps.AddFunction(code.data(), code.size(), GARBAGE_ENTRY, {}, callees);
+    vector<size_t> newOffsets;
+    vector<Instruction> optimized = OptimizePeephole(code, &newOffsets);
+    maps.Relocate(newOffsets);
+
+    StringPool strings;
+    ConstantPool constants;
+    constants.Add(strings.Add("abcdefg"));
+    constants.Add(strings.Add("hijklmn"));
+    constants.Add(strings.Add("abcdefghijklmn"));
+    VM vm;
+    vm.SetConstants(&constants);
+    vm.SetStrings(&strings);
+    vm.SetStackMaps(&maps, optimized.data());
+    int64_t iterations = 200;
+    int64_t result = vm.Call(optimized.data(), span<const int64_t>(&iterations, 1));
+
+    const HeapStatistics& statistics = vm.Heap().Statistics();
+    bool passed = result == 778 && statistics._minorCollections > 0 && statistics._majorCollections > 0;
+    cout << "Collections keep what is referenced: " << (passed ? "OK" : "FAILED") << " (result " << result
+         << ", " << statistics._minorCollections << " minor and " << statistics._majorCollections
+         << " major collections)" << endl;
+    return passed;
+}
+
+int main() {
+    if(!CheckCollections())
+        return 1;
+
+    vector<Instruction> code = gCountingLoop;
+    ThreadedCode threaded(code.data(), code.size());
+    ThreadedCode cached(code.data(), code.size(), StackCaching::TOP_OF_STACK);
+    RegisterCode registers(code.data(), code.size());
+    vector<Instruction> optimized = OptimizePeephole(code);
+    ThreadedCode fused(optimized.data(), optimized.size());
+    JitCode jit(optimized.data(), optimized.size());
+    TracingJit tracing(optimized.data(), optimized.size());
+    TieredExecution tiered(code.data(), code.size(), {0});
+
+    Measure("Interpreter::Run", [&] {
+        int16_t result = 0;
+        Interpreter::Run(code.data(), {ITERATIONS}, &result);
+        return result;
+    });
+    Measure("ThreadedInterpreter", [&] {
+        int16_t result = 0;
+        ThreadedInterpreter::Run(threaded, 0, {ITERATIONS}, &result);
+        return result;
+    });
+    Measure("ThreadedInterpreter, top of stack cached", [&] {
+        int16_t result = 0;
+        ThreadedInterpreter::Run(cached, 0, {ITERATIONS}, &result);
+        return result;
+    });
+    Measure("ThreadedInterpreter, peephole optimized", [&] {
+        int16_t result = 0;
+        ThreadedInterpreter::Run(fused, 0, {ITERATIONS}, &result);
+        return result;
+    });
+    Measure("RegisterInterpreter", [&] {
+        int16_t result = 0;
+        RegisterInterpreter::Run(registers, 0, {ITERATIONS}, &result);
+        return result;
+    });
+    Measure("JitExecutor, peephole optimized", [&] {
+        int16_t result = 0;
+        JitExecutor::Run(jit, 0, {ITERATIONS}, &result);
+        return result;
+    });
+    Measure("TracingJit, peephole optimized", [&] {
+        int16_t result = 0;
+        tracing.Run(0, {ITERATIONS}, &result);
+        return result;
+    });
+    Measure("TieredExecution", [&] {
+        int16_t result = 0;
+        tiered.Run(0, {ITERATIONS}, &result);
+        return result;
+    });
+
+    // Per element, a scalar loop dispatches ten instructions where ARRAY_SUM runs a vector kernel.
+    vector<Instruction> arraySumLoop = gArraySumLoop;
+    vector<Instruction> arraySumBulk = gArraySumBulk;
+    VM arrayVm;
+    int16_t arrayLength = ITERATIONS;
+    Measure("VM, array summed in a loop", [&] {
+        return arrayVm.Call(arraySumLoop.data(), span<const int16_t>(&arrayLength, 1));
+    });
+    Measure(kernels::UsesAvx2() ? "VM, array summed by ARRAY_SUM (AVX2)" : "VM, array summed by ARRAY_SUM", [&] {
+        return arrayVm.Call(arraySumBulk.data(), span<const int16_t>(&arrayLength, 1));
+    });
+
+    // Without stack maps the heap grows until the next run clears it, with them the
+    // nursery is collected at the loop's back-edge whenever it fills up.
+    vector<Instruction> allocationLoop = gAllocationLoop;
+    StackMaps allocationMaps;
+    allocationMaps.AddFunction(allocationLoop.data(), allocationLoop.size(), 0, {SlotKind::VALUE}, {});
+    VM allocatingVm;
+    Measure("VM, an array per iteration, no collection", [&] {
+        return allocatingVm.Call(allocationLoop.data(), span<const int16_t>(&arrayLength, 1));
+    });
+    allocatingVm.SetStackMaps(&allocationMaps, allocationLoop.data());
+    Measure("VM, an array per iteration, collected at safepoints", [&] {
+        return allocatingVm.Call(allocationLoop.data(), span<const int16_t>(&arrayLength, 1));
+    });
+    allocatingVm.Heap().Statistics().Print(cout);
+
+    // Per-invocation overhead of calling a trivial script function from C++.
+    vector<Instruction> foo = gFoo;
+    ThreadedCode threadedFoo(foo.data(), foo.size());
+    VM vm;
+    MeasureCalls("Interpreter::Run, foo", [&](int16_t x) {
+        int16_t result = 0;
+        Interpreter::Run(foo.data(), {x}, &result);
+        return result;
+    });
+    MeasureCalls("VM, foo", [&](int16_t x) {
+        return vm.Call(foo.data(), span<const int16_t>(&x, 1));
+    });
+    MeasureCalls("ThreadedInterpreter::Run, foo", [&](int16_t x) {
+        int16_t result = 0;
+        ThreadedInterpreter::Run(threadedFoo, 0, {x}, &result);
+        return result;
+    });
+    MeasureCalls("VM, threaded foo", [&](int16_t x) {
+        return vm.Call(threadedFoo, 0, span<const int16_t>(&x, 1));
+    });
+
+    // A batch of runs with different arguments, on one worker and on all of them.
+    vector<vector<int16_t>> argumentSets;
+    for(int x = 0; x < 2000; ++x)
+        argumentSets.push_back({int16_t(x * 15)});
+    for(size_t numWorkers : {size_t(1), size_t(0)}) {
+        WorkStealingPool pool(numWorkers);
+        RunBatch(threaded, 0, argumentSets, pool); // warm up
+        auto start = chrono::steady_clock::now();
+        vector<int16_t> results = RunBatch(threaded, 0, argumentSets, pool);
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        cout << "RunBatch, " << pool.NumWorkers() << " workers: " << elapsed.count() << " ms for "
+             << argumentSets.size() << " runs (last result " << results.back() << ")" << endl;
+    }
+
+    LockstepInterpreter lockstep(optimized.data(), optimized.size(), 0);
+    lockstep.Run(argumentSets); // warm up
+    auto lockstepStart = chrono::steady_clock::now();
+    vector<int16_t> lockstepResults = lockstep.Run(argumentSets);
+    chrono::duration<double, milli> lockstepElapsed = chrono::steady_clock::now() - lockstepStart;
+    cout << "LockstepInterpreter, peephole optimized" << (lockstep.Vectorized() ? "" : " (not vectorized)") << ": "
+         << lockstepElapsed.count() << " ms for " << argumentSets.size() << " runs (last result "
+         << lockstepResults.back() << ")" << endl;
+
+    // Printing to /dev/null measures formatting and write calls, not the terminal.
+    ofstream devNull("/dev/null");
+    ThreadedCode printing(gPrintingLoop.data(), gPrintingLoop.size());
+    auto measurePrinting = [&](const char* name, OutputSink& sink) {
+        OutputSink* previous = SetOutputSink(&sink);
+        Measure(name, [&] {
+            int16_t result = 0;
+            ThreadedInterpreter::Run(printing, 0, {ITERATIONS}, &result);
+            sink.Flush();
+            return result;
+        });
+        SetOutputSink(previous);
+    };
+
+    BufferedOutput unbuffered(devNull, FlushPolicy::EVERY_PRINT);
+    measurePrinting("ThreadedInterpreter printing, flush every print", unbuffered);
+    BufferedOutput buffered(devNull);
+    measurePrinting("ThreadedInterpreter printing, buffered", buffered);
+    vector<int64_t> values;
+    CollectingOutput collecting(values);
+    measurePrinting("ThreadedInterpreter printing, collected", collecting);
+
+    // Every line a write of its own, so printNum costs a dispatch and a write per number.
+    vector<Instruction> printNumLoop = gPrintNumLoop;
+    vector<Instruction> printLoop = gPrintLoop;
+    VM printingVm;
+    int16_t printIterations = ITERATIONS;
+    SetOutputSink(&unbuffered);
+    Measure("VM, three printNum a line, flush every print", [&] {
+        return printingVm.Call(printNumLoop.data(), span<const int16_t>(&printIterations, 1));
+    });
+    Measure("VM, one print of three values, flush every print", [&] {
+        return printingVm.Call(printLoop.data(), span<const int16_t>(&printIterations, 1));
+    });
+    SetOutputSink(nullptr);
+
+    cout << "\nHardware counters:\n";
+    gPerf.Print(cout);
+
+    return 0;
+}
@@ -2,6 +2,13 @@
 #include <vector>
 #include "../include/Instruction.h"
 #include "../include/Interpreter.h"
+#include "../include/ThreadedCode.h"
+#include "../include/RegisterCode.h"
+#include "../include/Peephole.h"
+#include "../include/OpcodeNgrams.h"
+#include "../include/JitCode.h"
+#include "../include/TracingJit.h"
+#include "../include/TieredExecution.h"
 
 using namespace std;
 using namespace interpreter;
@@ -50,7 +57,53 @@ int main() {
     int16_t result = 0;
     Interpreter::Run(code, {3}, &result);
 
-    cout << "\nResult: " << result << "\ndone" << endl;
+    cout << "\nResult: " << result << endl;
+
+    ThreadedCode threadedCode(code, sizeof(code) / sizeof(code[0]));
+    ThreadedInterpreter::Run(threadedCode, 0, {3}, &result);
+
+    cout << "\nThreaded result: " << result << endl;
+
+    ThreadedCode cachedCode(code, sizeof(code) / sizeof(code[0]), StackCaching::TOP_OF_STACK);
+    ThreadedInterpreter::Run(cachedCode, 0, {3}, &result);
+
+    cout << "\nTop of stack cached result: " << result << endl;
+
+    RegisterCode registerCode(code, sizeof(code) / sizeof(code[0]));
+    RegisterInterpreter::Run(registerCode, 0, {3}, &result);
+
+    cout << "\nRegister machine result: " << result << endl;
+
+    vector<Instruction> optimized = OptimizePeephole(vector<Instruction>(begin(code), end(code)));
+    ThreadedCode optimizedCode(optimized.data(), optimized.size());
+    ThreadedInterpreter::Run(optimizedCode, 0, {3}, &result);
+
+    cout << "\nPeephole optimized result: " << result << endl;
+
+    JitCode jitCode(code, sizeof(code) / sizeof(code[0]));
+    JitExecutor::Run(jitCode, 0, {3}, &result);
+
+    cout << "\nJIT result: " << result << endl;
+
+    TracingJit tracingJit(code, sizeof(code) / sizeof(code[0]), 2);
+    tracingJit.Run(0, {3}, &result);
+
+    cout << "\nTracing JIT result: " << result << " (" << tracingJit.NumTraces() << " traces)" << endl;
+
+    TieringPolicy policy;
+    policy._nativeThreshold = 3;
+    TieredExecution tieredExecution(code, sizeof(code) / sizeof(code[0]), {0}, policy);
+    tieredExecution.Run(0, {3}, &result);
+
+    cout << "\nTiered result: " << result << " (tier " << int(tieredExecution.TierOf(0)) << ", "
+         << tieredExecution.Deoptimizations(0) << " deoptimizations)" << endl;
+
+    OpcodeNgrams ngrams;
+    ngrams.Record(code, sizeof(code) / sizeof(code[0]), 0, {3}, &result);
+
+    cout << "\nMost frequent opcode sequences:\n";
+    ngrams.Print(cout, 8);
+    cout << "done" << endl;
 
     return 0;
 }
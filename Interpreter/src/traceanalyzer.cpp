@@ -0,0 +1,28 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "../include/ExecutionTrace.h"
+
+using namespace std;
+using namespace interpreter;
+
+// Prints hot paths, branch bias and the call graph of a trace TraceRecorder wrote.
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        cerr << "Usage: " << argv[0] << " <trace> [entries]" << endl;
+        return 1;
+    }
+
+    try {
+        ifstream trace(argv[1], ios::binary);
+        if(!trace)
+            throw runtime_error(string("Can't open ") + argv[1]);
+
+        TraceAnalysis analysis(trace);
+        analysis.Print(cout, argc > 2 ? stoul(argv[2]) : 10);
+    } catch(exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,52 +1,513 @@
 #include <iostream>
 #include <cassert>
+#include <sstream>
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include "Parser/include/Tokenizer.hpp"
 #include "Parser/include/Parser.h"
 #include "Interpreter/include/Interpreter.h"
 #include "Interpreter/include/Instruction.h"
+#include "Interpreter/include/ThreadedCode.h"
+#include "Interpreter/include/Peephole.h"
+#include "Interpreter/include/OpcodeNgrams.h"
+#include "Interpreter/include/JitCode.h"
+#include "Interpreter/include/TracingJit.h"
+#include "Interpreter/include/TieredExecution.h"
+#include "Interpreter/include/OutputSink.h"
+#include "Interpreter/include/BatchExecution.h"
+#include "Interpreter/include/LockstepInterpreter.h"
+#include "Interpreter/include/ExecutionCounters.h"
+#include "Interpreter/include/PerfCounters.h"
+#include "Interpreter/include/VM.h"
+#include "Interpreter/include/SourceLineTable.h"
+#include "Interpreter/include/SamplingProfiler.h"
+#include "Interpreter/include/JitSymbols.h"
+#include "Interpreter/include/ExecutionTrace.h"
+#include "Interpreter/include/ConstantPool.h"
+#include "Interpreter/include/Arrays.h"
+#include "Interpreter/include/Strings.h"
+#include "Interpreter/include/StackMaps.h"
+#include <fstream>
 
 using namespace std;
 using namespace simpleparser;
 using namespace interpreter;
 
+// The parser's builtin types, and the types it has none for: strings, the type
+// named "string" and literals of that type, and arrays, the type named "array".
+// Compiling, they get a value of their own, arrays because the garbage
+// collector has to tell them from integers.
+enum class ValueType: uint8_t {
+    INT8,
+    UINT8,
+    INT32,
+    UINT32,
+    DOUBLE,
+    STRUCT,
+    VOID,
+    STRING,
+    ARRAY
+};
+
+// A value inside a struct, nested structs flattened. The path is relative to
+// the struct, like ".position.x".
+struct Field {
+    string _path;
+    ValueType _type;
+};
+
+// Structs are flattened into consecutive slots, one per field, and every
+// field is registered by its path, like "p.x", next to the struct itself.
 struct Parameter {
     string _name;
-    size_t _index;
+    size_t _index; // of the slot
+    ValueType _type;
+    vector<Field> _fields;
+};
+
+// An array of structs is a single handle slot whose elements interleave the
+// fields, so its fields have a stride. With --soa it is one array per field.
+struct Variable {
+    int16_t _offset;
+    ValueType _type;
+    vector<Field> _fields;
+    uint8_t _stride = 0;      // elements per struct of an interleaved array
+    int16_t _fieldOffset = 0; // of the field within a struct of the array
 };
 
 struct CompiledFunction {
     size_t _instructionOffset;
     size_t _numArguments;
     bool _returnSmth;
+    vector<ValueType> _parameterTypes;
+    ValueType _returnType;
+    vector<vector<Field>> _parameterFields; // empty for all but struct parameters
+    size_t _numParameterSlots;
+};
+
+map<size_t, string> functionNamesOf(const map<string, CompiledFunction>& functionToInstruction) {
+    map<size_t, string> functionNames;
+    for(auto& [name, func] : functionToInstruction)
+        functionNames[func._instructionOffset] = name;
+    return functionNames;
+}
+
+// The lines of a function's statements in the order code is generated for them:
+// the function itself, its statements with the bodies of loops right after
+// the loop, and the closing brace.
+struct StatementLines {
+    SourceLineTable* _table;
+    vector<uint32_t> _lines;
+    uint32_t _endLine = 0;
+    size_t _next = 0;
+
+    void MarkNext(size_t offset) {
+        if(_next < _lines.size())
+            _table->Mark(offset, _lines[_next++]);
+    }
+};
+
+// Statements don't keep their position, so it is recovered from the tokens: a statement
+// starts with the first token after the "{" of a body, after a ";" or after a "}".
+StatementLines statementLinesOf(const vector<Token>& allTokens, const string& functionName,
+                                SourceLineTable& table) {
+    StatementLines lines{&table, {}};
+    vector<const Token*> tokens;
+    for(auto& currToken : allTokens) {
+        if(currToken._type != WHITESPACE && currToken._type != COMMENT)
+            tokens.push_back(&currToken);
+    }
+
+    // A definition is the return type, the name and "(", a call has no identifier before its name.
+    size_t x = 1;
+    while(x + 1 < tokens.size() && !(tokens[x - 1]->_type == IDENTIFIER && tokens[x]->_type == IDENTIFIER
+                                     && tokens[x]->_text == functionName && tokens[x + 1]->_text == "("))
+        ++x;
+    if(x + 1 >= tokens.size())
+        return lines;
+    lines._lines.push_back(uint32_t(tokens[x]->_lineNumber));
+
+    while(x < tokens.size() && tokens[x]->_text != "{")
+        ++x;
+
+    size_t depth = 0;
+    bool statementStarts = false;
+    for(; x < tokens.size(); ++x) {
+        const Token& currToken = *tokens[x];
+        bool isOperator = currToken._type == OPERATOR;
+        if(statementStarts && !(isOperator && (currToken._text == ";" || currToken._text == "}"))) {
+            lines._lines.push_back(uint32_t(currToken._lineNumber));
+            statementStarts = false;
+        }
+
+        if(isOperator && currToken._text == "{") {
+            ++depth;
+            statementStarts = true;
+        } else if(isOperator && currToken._text == "}") {
+            if(--depth == 0) {
+                lines._endLine = uint32_t(currToken._lineNumber);
+                break;
+            }
+            statementStarts = true;
+        } else if(isOperator && currToken._text == ";") {
+            statementStarts = true;
+        }
+    }
+    return lines;
+}
+
+ValueType declaredType(const Type& type) {
+    if(type._name == "string")
+        return ValueType::STRING;
+    if(type._name == "array")
+        return ValueType::ARRAY;
+    switch(type._type) {
+        case INT8:
+            return ValueType::INT8;
+        case UINT8:
+            return ValueType::UINT8;
+        case INT32:
+            return ValueType::INT32;
+        case UINT32:
+            return ValueType::UINT32;
+        case DOUBLE:
+            return ValueType::DOUBLE;
+        case STRUCT:
+            return ValueType::STRUCT;
+        case VOID:
+            return ValueType::VOID;
+    }
+    throw runtime_error("Type " + type._name + " is unknown");
+}
+
+// Every value is a double, a string, an array or an integer, which all other numeric types are compiled as.
+ValueType valueType(ValueType type) {
+    return type == ValueType::DOUBLE || type == ValueType::STRING || type == ValueType::ARRAY ? type : ValueType::INT32;
+}
+
+SlotKind slotKindOf(ValueType type) {
+    if(type == ValueType::STRING)
+        return SlotKind::STRING;
+    return type == ValueType::ARRAY ? SlotKind::ARRAY : SlotKind::VALUE;
+}
+
+// What code generation needs besides the statement. Narrow code keeps INT32
+// values to the 16-bit instructions every engine runs, wide code uses the
+// 32-bit ones. Doubles and wide literals go through the constant pool, and
+// only the reference interpreter runs them, like strings, whose literals the
+// constant pool holds the values of.
+struct CodeContext {
+    ConstantPool& _constants;
+    StringPool& _strings;
+    bool _wideIntegers;
+    bool _structOfArrays = false;
+    ValueType _returnType = ValueType::VOID; // of the function being compiled
+    size_t _numParameterSlots = 0;   // of the function being compiled
+    StackMaps* _stackMaps = nullptr; // receives the maps of every function compiled
+};
+
+// The parser doesn't name fields apart from their type, so a field's type
+// name is taken as the field name.
+void flattenFields(const Type& type, const string& prefix, vector<Field>& fields) {
+    for(auto& currField : type._field) {
+        string path = prefix + "." + currField._name;
+        if(currField._type == STRUCT)
+            flattenFields(currField, path, fields);
+        else
+            fields.push_back(Field{path, valueType(declaredType(currField))});
+    }
+}
+
+vector<Field> fieldsOf(const Type& type) {
+    vector<Field> fields;
+    flattenFields(type, "", fields);
+    if(fields.empty())
+        throw runtime_error("Struct " + type._name + " has no fields");
+    return fields;
+}
+
+// Names a variable, parameter or field, however deep: "p" or "p.position.x".
+string pathOf(const Statement& value) {
+    if(value._kind == StatementKind::OPERATOR_CALL && value._name == "." && value._parameters.size() == 2)
+        return pathOf(value._parameters[0]) + "." + pathOf(value._parameters[1]);
+    return value._name;
+}
+
+bool isPath(const Statement& value) {
+    return value._kind == StatementKind::VARIABLE_NAME
+           || (value._kind == StatementKind::OPERATOR_CALL && value._name == ".");
+}
+
+bool isNewStructArray(const Statement& declaration) {
+    return !declaration._parameters.empty() && declaration._parameters[0]._kind == StatementKind::FUNCTION_CALL
+           && declaration._parameters[0]._name == "newArray";
+}
+
+Instruction pushIntLiteral(long long value, CodeContext& context) {
+    if(value < INT32_MIN || value > INT32_MAX)
+        throw runtime_error("Literal " + to_string(value) + " doesn't fit 32 bits");
+    if(value >= INT16_MIN && value <= INT16_MAX)
+        return Instruction{interpreter::PUSH_INT, 0, int16_t(value)};
+    if(!context._wideIntegers)
+        throw runtime_error("Literal " + to_string(value) + " doesn't fit 16 bits, compile with --int32");
+    return Instruction{interpreter::PUSH_CONST, 0, int16_t(context._constants.Add(value))};
+}
+
+// The literal converted to type when compiling, not when running.
+Instruction pushLiteral(const Statement& literal, ValueType type, CodeContext& context) {
+    if(type == ValueType::ARRAY)
+        throw runtime_error("\"" + literal._name + "\" is a literal where an array is expected");
+    if((type == ValueType::STRING) != (declaredType(literal._type) == ValueType::STRING))
+        throw runtime_error("\"" + literal._name + "\" is a string where a number is expected, or the reverse");
+    if(type == ValueType::STRING)
+        return Instruction{interpreter::PUSH_CONST, 0, int16_t(context._constants.Add(context._strings.Add(literal._name)))};
+    if(type == ValueType::DOUBLE)
+        return Instruction{interpreter::PUSH_CONST, 0, int16_t(context._constants.AddDouble(stod(literal._name)))};
+    if(literal._type._type != DOUBLE)
+        return pushIntLiteral(stoll(literal._name), context);
+
+    double value = trunc(stod(literal._name));
+    if(!(value >= INT32_MIN && value <= INT32_MAX))
+        throw runtime_error("Literal " + literal._name + " doesn't fit 32 bits");
+    return pushIntLiteral((long long)value, context);
+}
+
+// Functions scripts call without defining them, each compiled to one instruction
+// after its arguments. A VOID parameter takes the argument as it is.
+struct Builtin {
+    Opcode _opcode;
+    uint8_t _p1;
+    vector<ValueType> _parameterTypes;
+    ValueType _returnType;
 };
 
+// Reductions of arrays return doubles.
+const map<string, Builtin> gBuiltins = {
+    {"newIntArray", {interpreter::NEW_ARRAY, uint8_t(ElementType::INT32), {ValueType::INT32}, ValueType::ARRAY}},
+    {"newDoubleArray", {interpreter::NEW_ARRAY, uint8_t(ElementType::DOUBLE), {ValueType::INT32}, ValueType::ARRAY}},
+    {"length", {interpreter::ARRAY_LENGTH, 0, {ValueType::ARRAY}, ValueType::INT32}},
+    {"getInt", {interpreter::ARRAY_LOAD_INT, 0, {ValueType::ARRAY, ValueType::INT32}, ValueType::INT32}},
+    {"getDouble", {interpreter::ARRAY_LOAD_DOUBLE, 0, {ValueType::ARRAY, ValueType::INT32}, ValueType::DOUBLE}},
+    // ARRAY_STORE_DOUBLE for a double
+    {"set", {interpreter::ARRAY_STORE_INT, 0, {ValueType::ARRAY, ValueType::INT32, ValueType::VOID}, ValueType::VOID}},
+    {"addArrays", {interpreter::ARRAY_ADD, 0, {ValueType::ARRAY, ValueType::ARRAY, ValueType::ARRAY}, ValueType::VOID}},
+    {"mulArrays", {interpreter::ARRAY_MUL, 0, {ValueType::ARRAY, ValueType::ARRAY, ValueType::ARRAY}, ValueType::VOID}},
+    {"sum", {interpreter::ARRAY_SUM, 0, {ValueType::ARRAY}, ValueType::DOUBLE}},
+    {"min", {interpreter::ARRAY_MIN, 0, {ValueType::ARRAY}, ValueType::DOUBLE}},
+    {"max", {interpreter::ARRAY_MAX, 0, {ValueType::ARRAY}, ValueType::DOUBLE}},
+    {"dot", {interpreter::ARRAY_DOT, 0, {ValueType::ARRAY, ValueType::ARRAY}, ValueType::DOUBLE}},
+    {"equals", {interpreter::EQUAL_STRING, 0, {ValueType::STRING, ValueType::STRING}, ValueType::INT32}},
+};
+
+ValueType typeOf(const Statement& value, const map<string, Variable>& variables,
+                    const map<string, Parameter>& parameters,
+                    const map<string, CompiledFunction>& functionToInstruction) {
+    if(isPath(value)) {
+        auto foundVar = variables.find(pathOf(value));
+        if(foundVar != variables.end())
+            return foundVar->second._type;
+        auto foundParam = parameters.find(pathOf(value));
+        if(foundParam != parameters.end())
+            return foundParam->second._type;
+        return ValueType::INT32;
+    }
+
+    switch(value._kind) {
+        case StatementKind::LITERAL:
+            return valueType(declaredType(value._type));
+        case StatementKind::OPERATOR_CALL:
+            if(value._name == "-" || value._name == "*" || value._name == "/")
+                return ValueType::DOUBLE;
+            if(value._name == "+") {
+                ValueType type = ValueType::INT32;
+                for(auto& operand : value._parameters) {
+                    ValueType operandType = typeOf(operand, variables, parameters, functionToInstruction);
+                    if(operandType == ValueType::STRING
+                       || (operandType == ValueType::DOUBLE && type == ValueType::INT32))
+                        type = operandType;
+                }
+                return type;
+            }
+            return value._name == "<" ? ValueType::INT32 : ValueType::VOID;
+        case StatementKind::FUNCTION_CALL: {
+            auto foundBuiltin = gBuiltins.find(value._name);
+            if(foundBuiltin != gBuiltins.end())
+                return foundBuiltin->second._returnType;
+            auto foundFunction = functionToInstruction.find(value._name);
+            if(foundFunction == functionToInstruction.end() || !foundFunction->second._returnSmth)
+                return ValueType::VOID;
+            return foundFunction->second._returnType;
+        }
+        default:
+            return ValueType::VOID;
+    }
+}
+
+// Narrow code compares and adds ints as 16 bits, so the 32-bit results of
+// wide instructions are saturated, not truncated, to fit.
+void narrowIntResult(Opcode op, const CodeContext& context, vector<Instruction>& compiledCode) {
+    bool int32Result = op == interpreter::DOUBLE_TO_INT || op == interpreter::ARRAY_LOAD_INT
+                       || op == interpreter::ARRAY_LENGTH;
+    if(int32Result && !context._wideIntegers)
+        compiledCode.push_back(Instruction{interpreter::SATURATE_INT16, 0, 0});
+}
+
+void convertValue(ValueType from, ValueType to, vector<Instruction>& compiledCode, const CodeContext& context) {
+    if((from == ValueType::STRING) != (to == ValueType::STRING))
+        throw runtime_error(from == ValueType::STRING ? "A string is used as a number"
+                                                      : "A number is used as a string");
+    if((from == ValueType::ARRAY) != (to == ValueType::ARRAY))
+        throw runtime_error(from == ValueType::ARRAY ? "An array is used as a number" : "A number is used as an array");
+    if(from == ValueType::DOUBLE && to != ValueType::DOUBLE) {
+        compiledCode.push_back(Instruction{interpreter::DOUBLE_TO_INT, 0, 0});
+        narrowIntResult(interpreter::DOUBLE_TO_INT, context, compiledCode);
+    } else if(from != ValueType::DOUBLE && to == ValueType::DOUBLE) {
+        compiledCode.push_back(Instruction{interpreter::INT_TO_DOUBLE, 0, 0});
+    }
+}
+
 void generateCodeForStatement(const Statement& currStatement,
-                              const map<string, int16_t>& variableOffset,
+                              const map<string, Variable>& variableOffset,
                               map<string, Parameter> parameters,
                               vector<int16_t>& returnCmdJmpInstructions,
                               vector<Instruction>& compiledCode,
-                              map<string, CompiledFunction>& functionToInstruction) {
+                              map<string, CompiledFunction>& functionToInstruction,
+                              StatementLines& lines,
+                              CodeContext& context) {
+    // Generates a value and converts it to type.
+    auto generateValue = [&](const Statement& value, ValueType type) {
+        generateCodeForStatement(value, variableOffset,
+                                 parameters, returnCmdJmpInstructions,
+                                 compiledCode, functionToInstruction, lines, context);
+        convertValue(typeOf(value, variableOffset, parameters, functionToInstruction), type, compiledCode, context);
+    };
+
+    // A variable, parameter or field that holds a single value, in one instruction.
+    auto loadPath = [&](const string& path) {
+        auto foundVar = variableOffset.find(path);
+        if(foundVar != variableOffset.end()) {
+            if(foundVar->second._type == ValueType::STRUCT || foundVar->second._stride > 0)
+                throw runtime_error(string("\"") + path + "\" isn't a single value");
+            compiledCode.push_back(Instruction{interpreter::LOAD_INT_BASEPOINTER_RELATIVE,
+                                               0, foundVar->second._offset});
+            return;
+        }
+
+        auto foundParam = parameters.find(path);
+        if(foundParam != parameters.end()) {
+            if(foundParam->second._type == ValueType::STRUCT)
+                throw runtime_error(string("\"") + path + "\" isn't a single value");
+            compiledCode.push_back(Instruction{interpreter::LOAD_INT_BASEPOINTER_RELATIVE, 0,
+                                               int16_t(-1 - context._numParameterSlots + foundParam->second._index)});
+            return;
+        }
+        throw runtime_error(string("Unknown variable \"") + path + "\"");
+    };
+
+    auto structFieldsOf = [&](const Statement& value) -> const vector<Field>& {
+        string path = pathOf(value);
+        auto foundVar = variableOffset.find(path);
+        if(isPath(value) && foundVar != variableOffset.end() && foundVar->second._type == ValueType::STRUCT)
+            return foundVar->second._fields;
+        auto foundParam = parameters.find(path);
+        if(isPath(value) && foundParam != parameters.end() && foundParam->second._type == ValueType::STRUCT)
+            return foundParam->second._fields;
+        throw runtime_error(string("\"") + path + "\" isn't a struct");
+    };
+
+    // Pushes every field of a struct, converted to the types of fields.
+    auto pushFields = [&](const Statement& value, const vector<Field>& fields) {
+        const vector<Field>& valueFields = structFieldsOf(value);
+        if(valueFields.size() != fields.size())
+            throw runtime_error(string("\"") + pathOf(value) + "\" is a different struct");
+        for(size_t x = 0; x < fields.size(); ++x) {
+            loadPath(pathOf(value) + valueFields[x]._path);
+            convertValue(valueFields[x]._type, fields[x]._type, compiledCode, context);
+        }
+    };
+
+    auto copyStruct = [&](const Statement& value, const Variable& target) {
+        pushFields(value, target._fields);
+        for(size_t x = target._fields.size(); x > 0; --x)
+            compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE,
+                                               0, int16_t(target._offset + x - 1)});
+    };
+
+    // The prologue pushes literal initial values, others are stored where they're declared.
+    auto initializeVariable = [&]() {
+        if (currStatement._parameters.empty() || currStatement._parameters[0]._kind == StatementKind::LITERAL)
+            return;
+        auto foundVar = variableOffset.find(currStatement._name);
+        if (foundVar == variableOffset.end())
+            throw runtime_error(string("Unknown variable \"") + currStatement._name + "\"");
+
+        generateValue(currStatement._parameters[0], foundVar->second._type);
+        compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE, 0,
+                                           foundVar->second._offset});
+    };
+
+    auto interleavedArrayOf = [&](const Statement& value) -> const Variable* {
+        auto foundVar = variableOffset.find(pathOf(value));
+        if(!isPath(value) || foundVar == variableOffset.end() || foundVar->second._stride == 0)
+            return nullptr;
+        return &foundVar->second;
+    };
+
     switch (currStatement._kind) {
         case StatementKind::VARIABLE_DECLARATION:
+            if (declaredType(currStatement._type) == ValueType::STRING
+                || declaredType(currStatement._type) == ValueType::ARRAY) {
+                initializeVariable();
+                break;
+            }
             switch (currStatement._type._type) {
-                case simpleparser::INT32: {
-                    if (!currStatement._parameters.empty()) {
-                        const auto &initialValueParsed = currStatement._parameters[0];
-
-                        if (initialValueParsed._kind != StatementKind::LITERAL) {
-                            auto foundVar = variableOffset.find(currStatement._name);
-                            if (foundVar == variableOffset.end())
-                                throw runtime_error(string("Unknown variable \"") + currStatement._name + "\"");
-
-                            generateCodeForStatement(initialValueParsed, variableOffset,
-                                                     parameters, returnCmdJmpInstructions,
-                                                     compiledCode, functionToInstruction);
-                            compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE, 0,
-                                                               foundVar->second});
-                        }
+                case simpleparser::INT32:
+                case simpleparser::DOUBLE:
+                    initializeVariable();
+                    break;
+                case simpleparser::STRUCT: {
+                    if (currStatement._parameters.empty())
+                        break;
+                    const Variable& structVariable = variableOffset.at(currStatement._name);
+                    const auto &initialValueParsed = currStatement._parameters[0];
+                    if (!isNewStructArray(currStatement)) {
+                        copyStruct(initialValueParsed, structVariable);
+                        break;
+                    }
+
+                    if (initialValueParsed._parameters.size() != 1)
+                        throw runtime_error("Function newArray requires 1 argument, but received "
+                                            + to_string(initialValueParsed._parameters.size()));
+                    const vector<Field>& fields = structVariable._fields;
+                    if (structVariable._stride > 0) {
+                        bool anyDouble = any_of(fields.begin(), fields.end(),
+                                                [](const Field& field) { return field._type == ValueType::DOUBLE; });
+                        generateValue(initialValueParsed._parameters[0], ValueType::INT32);
+                        compiledCode.push_back(Instruction{interpreter::NEW_ARRAY,
+                                                           uint8_t(anyDouble ? ElementType::DOUBLE : ElementType::INT32),
+                                                           int16_t(structVariable._stride)});
+                        compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE,
+                                                           0, structVariable._offset});
+                        break;
+                    }
+
+                    // The length goes to the slot after the fields, so it is evaluated once.
+                    int16_t lengthOffset = int16_t(structVariable._offset + fields.size());
+                    generateValue(initialValueParsed._parameters[0], ValueType::INT32);
+                    compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE, 0, lengthOffset});
+                    for (size_t x = 0; x < fields.size(); ++x) {
+                        compiledCode.push_back(Instruction{interpreter::LOAD_INT_BASEPOINTER_RELATIVE, 0, lengthOffset});
+                        compiledCode.push_back(Instruction{interpreter::NEW_ARRAY,
+                                                           uint8_t(fields[x]._type == ValueType::DOUBLE
+                                                                   ? ElementType::DOUBLE : ElementType::INT32), 0});
+                        compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE,
+                                                           0, int16_t(structVariable._offset + x)});
                     }
                     break;
                 }
+                default:
+                    break;
             }
             break;
 
@@ -54,20 +515,91 @@ void generateCodeForStatement(const Statement& currStatement,
             if (currStatement._name == "return") {
                 if (currStatement._parameters.size() != 1)
                     throw runtime_error("Function \"return\" expects a single parameter");
-                generateCodeForStatement(currStatement._parameters[0], variableOffset,
-                                         parameters, returnCmdJmpInstructions,
-                                         compiledCode, functionToInstruction);
+                generateValue(currStatement._parameters[0], context._returnType);
                 compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE,
-                                                   0, int16_t(-2 - parameters.size())});
+                                                   0, int16_t(-2 - context._numParameterSlots)});
                 returnCmdJmpInstructions.push_back(compiledCode.size());
                 compiledCode.push_back(Instruction{interpreter::JUMP_BY, 0, 0});
             } else if (currStatement._name == "printNum") {
                 if (currStatement._parameters.size() != 1)
                     throw runtime_error("Function \"printNum\" expects a single parameter");
-                generateCodeForStatement(currStatement._parameters[0], variableOffset,
-                                         parameters, returnCmdJmpInstructions,
-                                         compiledCode, functionToInstruction);
-                compiledCode.push_back(Instruction{interpreter::PRINT_INT, 0, 0});
+                ValueType type = typeOf(currStatement._parameters[0], variableOffset, parameters,
+                                           functionToInstruction);
+                if (type == ValueType::STRING)
+                    throw runtime_error("Function \"printNum\" prints numbers, strings are printed with print");
+                if (type == ValueType::ARRAY)
+                    throw runtime_error("Function \"printNum\" prints numbers, not arrays");
+                generateValue(currStatement._parameters[0], type);
+                compiledCode.push_back(Instruction{type == ValueType::DOUBLE ? interpreter::PRINT_DOUBLE
+                                                                  : interpreter::PRINT_INT, 0, 0});
+            } else if (currStatement._name == "print") {
+                // Formats all its values into one line that is written at once.
+                if (currStatement._parameters.size() > MAX_PRINTED_VALUES)
+                    throw runtime_error("Function \"print\" prints up to " + to_string(MAX_PRINTED_VALUES) + " values");
+                uint16_t kinds = 0;
+                for (size_t x = 0; x < currStatement._parameters.size(); ++x) {
+                    ValueType type = typeOf(currStatement._parameters[x], variableOffset, parameters,
+                                               functionToInstruction);
+                    if (type == ValueType::VOID || type == ValueType::ARRAY)
+                        throw runtime_error("Function \"print\" got an argument that isn't a number or a string");
+                    PrintedKind kind = type == ValueType::STRING ? PrintedKind::STRING
+                                       : type == ValueType::DOUBLE ? PrintedKind::DOUBLE : PrintedKind::INT;
+                    kinds |= uint16_t(uint16_t(kind) << (2 * x));
+                    generateValue(currStatement._parameters[x], type);
+                }
+                compiledCode.push_back(Instruction{interpreter::PRINT_VALUES,
+                                                   uint8_t(currStatement._parameters.size()), int16_t(kinds)});
+            } else if (auto foundBuiltin = gBuiltins.find(currStatement._name); foundBuiltin != gBuiltins.end()) {
+                const Builtin& builtin = foundBuiltin->second;
+                if (builtin._parameterTypes.size() != currStatement._parameters.size())
+                    throw runtime_error(string("Function ") + currStatement._name + " requires "
+                                        + to_string(builtin._parameterTypes.size()) + " arguments, but received "
+                                        + to_string(currStatement._parameters.size()));
+
+                // Fields of an interleaved array of structs are indexed with their stride and offset.
+                if (const Variable* array = interleavedArrayOf(currStatement._parameters[0])) {
+                    Opcode op = builtin._opcode;
+                    bool indexed = op == interpreter::ARRAY_LOAD_INT || op == interpreter::ARRAY_LOAD_DOUBLE
+                                   || op == interpreter::ARRAY_STORE_INT;
+                    if (op != interpreter::ARRAY_LENGTH && !indexed)
+                        throw runtime_error("The fields of \"" + pathOf(currStatement._parameters[0])
+                                            + "\" are interleaved, compile with --soa to call " + currStatement._name);
+                    if (indexed && !array->_fields.empty())
+                        throw runtime_error("Index a field of \"" + pathOf(currStatement._parameters[0]) + "\"");
+
+                    compiledCode.push_back(Instruction{interpreter::LOAD_INT_BASEPOINTER_RELATIVE, 0, array->_offset});
+                    for (size_t x = 1; x < currStatement._parameters.size(); ++x) {
+                        ValueType type = builtin._parameterTypes[x];
+                        if (type == ValueType::VOID) {
+                            type = typeOf(currStatement._parameters[x], variableOffset, parameters,
+                                          functionToInstruction);
+                            if (type == ValueType::STRING || type == ValueType::ARRAY)
+                                throw runtime_error("Arrays hold numbers only");
+                            if (type == ValueType::DOUBLE)
+                                op = interpreter::ARRAY_STORE_DOUBLE;
+                        }
+                        generateValue(currStatement._parameters[x], type);
+                    }
+                    compiledCode.push_back(Instruction{op, array->_stride, indexed ? array->_fieldOffset : int16_t(0)});
+                    narrowIntResult(op, context, compiledCode);
+                    break;
+                }
+
+                Opcode op = builtin._opcode;
+                for (size_t x = 0; x < currStatement._parameters.size(); ++x) {
+                    ValueType type = builtin._parameterTypes[x];
+                    if (type == ValueType::VOID) {
+                        type = typeOf(currStatement._parameters[x], variableOffset, parameters,
+                                      functionToInstruction);
+                        if (type == ValueType::STRING || type == ValueType::ARRAY)
+                            throw runtime_error("Arrays hold numbers only");
+                        if (op == interpreter::ARRAY_STORE_INT && type == ValueType::DOUBLE)
+                            op = interpreter::ARRAY_STORE_DOUBLE;
+                    }
+                    generateValue(currStatement._parameters[x], type);
+                }
+                compiledCode.push_back(Instruction{op, builtin._p1, 0});
+                narrowIntResult(op, context, compiledCode);
             } else {
                 auto foundFunction = functionToInstruction.find(currStatement._name);
                 if (foundFunction == functionToInstruction.end())
@@ -77,25 +609,33 @@ void generateCodeForStatement(const Statement& currStatement,
                     compiledCode.push_back(Instruction{interpreter::PUSH_INT, 0, 0});
                 }
 
-                if (foundFunction->second._numArguments != currStatement._parameters.size())
+                const CompiledFunction& callee = foundFunction->second;
+                if (callee._numArguments != currStatement._parameters.size())
                     throw runtime_error(string("Function ") + currStatement._name + " requires "
-                                        + to_string(foundFunction->second._numArguments) + " arguments, but received "
+                                        + to_string(callee._numArguments) + " arguments, but received "
                                         + to_string(currStatement._parameters.size()));
 
-                for (auto &currParam: currStatement._parameters) {
-                    generateCodeForStatement(currParam, variableOffset, parameters, returnCmdJmpInstructions,
-                                             compiledCode, functionToInstruction);
+                // Structs are passed by value, one slot per field.
+                for (size_t x = 0; x < currStatement._parameters.size(); ++x) {
+                    if (callee._parameterTypes[x] == ValueType::STRUCT)
+                        pushFields(currStatement._parameters[x], callee._parameterFields[x]);
+                    else
+                        generateValue(currStatement._parameters[x], callee._parameterTypes[x]);
                 }
 
-                size_t relativeJumpAddress = foundFunction->second._instructionOffset - compiledCode.size();
+                size_t relativeJumpAddress = callee._instructionOffset - compiledCode.size();
                 compiledCode.push_back(Instruction{interpreter::CALL, 0, int16_t(relativeJumpAddress)});
-                for (size_t x = currStatement._parameters.size(); x > 0; --x) {
+                for (size_t x = callee._numParameterSlots; x > 0; --x) {
                     compiledCode.push_back(Instruction{interpreter::POP_INT, 0, 0});
                 }
 
             }
             break;
         case StatementKind::LITERAL:
+            if (declaredType(currStatement._type) == ValueType::STRING) {
+                compiledCode.push_back(pushLiteral(currStatement, ValueType::STRING, context));
+                break;
+            }
             switch (currStatement._type._type) {
                 case VOID:
                     break;
@@ -103,15 +643,13 @@ void generateCodeForStatement(const Statement& currStatement,
                     break;
                 case UINT8:
                     break;
-                case INT32: {
-                    int32_t initialValue = stoi(currStatement._name);
-                    compiledCode.push_back(Instruction{interpreter::PUSH_INT, 0,
-                                                       int16_t(initialValue)});
+                case INT32:
+                    compiledCode.push_back(pushLiteral(currStatement, ValueType::INT32, context));
                     break;
-                }
                 case UINT32:
                     break;
                 case DOUBLE:
+                    compiledCode.push_back(pushLiteral(currStatement, ValueType::DOUBLE, context));
                     break;
                 case STRUCT:
                     break;
@@ -122,84 +660,159 @@ void generateCodeForStatement(const Statement& currStatement,
                 throw runtime_error(string("Wrong number of parameters passed to operator \"")
                                     + currStatement._name + "\"");
             if (currStatement._name == "+" || currStatement._name == "<") {
-                Opcode op = interpreter::ADD_INT;
-                if (currStatement._name == "<")
-                    op = interpreter::COMP_INT_LT;
+                // Integers are converted when the other operand is a double. Strings are
+                // concatenated and compared with strings only.
+                ValueType operandType = ValueType::INT32;
+                for (auto &currParam: currStatement._parameters) {
+                    ValueType type = typeOf(currParam, variableOffset, parameters, functionToInstruction);
+                    if (type == ValueType::STRING || (type == ValueType::DOUBLE && operandType == ValueType::INT32))
+                        operandType = type;
+                }
+
+                Opcode op = context._wideIntegers ? interpreter::ADD_INT32 : interpreter::ADD_INT;
+                if (operandType == ValueType::DOUBLE)
+                    op = interpreter::ADD_DOUBLE;
+                else if (operandType == ValueType::STRING)
+                    op = interpreter::CONCAT_STRING;
+                if (currStatement._name == "<") {
+                    op = context._wideIntegers ? interpreter::COMP_INT32_LT : interpreter::COMP_INT_LT;
+                    if (operandType == ValueType::DOUBLE)
+                        op = interpreter::COMP_DOUBLE_LT;
+                    else if (operandType == ValueType::STRING)
+                        op = interpreter::COMP_STRING_LT;
+                }
 
                 for (auto &currParam: currStatement._parameters)
-                    generateCodeForStatement(currParam, variableOffset,
-                                             parameters, returnCmdJmpInstructions,
-                                             compiledCode, functionToInstruction);
+                    generateValue(currParam, operandType);
                 compiledCode.push_back(Instruction{op, 0, 0});
+            } else if (currStatement._name == "-" || currStatement._name == "*" || currStatement._name == "/") {
+                // Only doubles have these, so a ratio of integers isn't truncated.
+                Opcode op = interpreter::SUB_DOUBLE;
+                if (currStatement._name == "*")
+                    op = interpreter::MUL_DOUBLE;
+                else if (currStatement._name == "/")
+                    op = interpreter::DIV_DOUBLE;
+
+                for (auto &currParam: currStatement._parameters)
+                    generateValue(currParam, ValueType::DOUBLE);
+                compiledCode.push_back(Instruction{op, 0, 0});
+            } else if (currStatement._name == ".") {
+                loadPath(pathOf(currStatement));
             } else if (currStatement._name == "=") {
-                auto foundVar = variableOffset.find(currStatement._parameters[0]._name);
+                string path = pathOf(currStatement._parameters[0]);
+                auto foundVar = variableOffset.find(path);
                 if(foundVar == variableOffset.end())
-                    throw runtime_error(string("Unknown variable \"") + currStatement._parameters[0]._name + "\"");
-                generateCodeForStatement(currStatement._parameters[1], variableOffset,
-                                         parameters, returnCmdJmpInstructions,
-                                         compiledCode, functionToInstruction);
+                    throw runtime_error(string("Unknown variable \"") + path + "\"");
+                if(foundVar->second._stride > 0)
+                    throw runtime_error(string("\"") + path + "\" is an array of structs, set its fields with set");
+                if(foundVar->second._type == ValueType::STRUCT) {
+                    copyStruct(currStatement._parameters[1], foundVar->second);
+                    break;
+                }
+                generateValue(currStatement._parameters[1], foundVar->second._type);
                 compiledCode.push_back(Instruction{interpreter::STORE_INT_BASEPOINTER_RELATIVE,
-                                                   0, foundVar->second});
+                                                   0, foundVar->second._offset});
             }
             break;
 
-            case StatementKind::VARIABLE_NAME: {
-            auto foundVar = variableOffset.find(currStatement._name);
-            if(foundVar != variableOffset.end()) {
-                compiledCode.push_back(Instruction{interpreter::LOAD_INT_BASEPOINTER_RELATIVE,
-                                                   0, foundVar->second});
-                break;
-            }
-
-            auto foundParam = parameters.find(currStatement._name);
-            if(foundParam != parameters.end()) {
-                compiledCode.push_back(Instruction{interpreter::LOAD_INT_BASEPOINTER_RELATIVE,
-                                                   0, int16_t(-1 - parameters.size() + foundParam->second._index)});
-                break;
-            }
-            throw runtime_error(string("Unknown variable \"") + currStatement._parameters[0]._name + "\"");
-        }
+            case StatementKind::VARIABLE_NAME:
+            loadPath(currStatement._name);
+            break;
 
         case StatementKind::WHILE_LOOP: {
+            if(typeOf(currStatement._parameters[0], variableOffset, parameters, functionToInstruction)
+               != ValueType::INT32)
+                throw runtime_error("A loop condition has to be an integer");
             size_t conditionOffset = compiledCode.size();
             generateCodeForStatement(currStatement._parameters[0], variableOffset,
                                      parameters, returnCmdJmpInstructions,
-                                     compiledCode, functionToInstruction);
+                                     compiledCode, functionToInstruction, lines, context);
             size_t conditionFalseJumpInstructionOffset = compiledCode.size();
             compiledCode.push_back(Instruction{interpreter::JUMP_BY_IF_ZERO, 0, 0});
 
             for(auto stmt = currStatement._parameters.begin() + 1; stmt != currStatement._parameters.end(); ++stmt) {
-                compiledCode.push_back(Instruction{interpreter::JUMP_BY, 0,
-                                                   int16_t(conditionOffset - compiledCode.size())});
-                compiledCode[conditionFalseJumpInstructionOffset].p2 =
-                        int16_t(compiledCode.size()- conditionFalseJumpInstructionOffset);
-                break;
+                lines.MarkNext(compiledCode.size());
+                generateCodeForStatement(*stmt, variableOffset,
+                                         parameters, returnCmdJmpInstructions,
+                                         compiledCode, functionToInstruction, lines, context);
             }
+            // Going back to the condition belongs to the loop's line.
+            lines._table->Mark(compiledCode.size(), lines._table->LineAt(conditionOffset));
+            compiledCode.push_back(Instruction{interpreter::JUMP_BY, 0,
+                                               int16_t(conditionOffset - compiledCode.size())});
+            compiledCode[conditionFalseJumpInstructionOffset].p2 =
+                    int16_t(compiledCode.size() - conditionFalseJumpInstructionOffset);
+            break;
         }
     }
 }
 
 void generateCodeForFunction(const FunctionDefinition& currFunc, vector<Instruction>& compileCode,
-                             map<string, CompiledFunction>& functionToInstruction) {
+                             map<string, CompiledFunction>& functionToInstruction, StatementLines& lines,
+                             CodeContext& context) {
     int numIntVariable = 0;
     vector<int16_t> returnCndJumpInstructions;
-    map<string, int16_t> variableOffsets;
+    map<string, Variable> variableOffsets;
     map<string, Parameter> parameters;
 
+    if(currFunc._returnsSmth && currFunc._type._type == STRUCT)
+        throw runtime_error("Function " + currFunc._name + " returns a struct, which isn't supported");
+
+    vector<ValueType> parameterTypes;
+    vector<vector<Field>> parameterFields;
+    size_t paramSlot = 0;
+    for(auto& currParamDef : currFunc._parameters) {
+        const string& name = currParamDef._parameterName;
+        if(currParamDef._parameterType._type != STRUCT) {
+            parameterTypes.push_back(valueType(declaredType(currParamDef._parameterType)));
+            parameterFields.emplace_back();
+            parameters[name] = Parameter{name, paramSlot++, parameterTypes.back(), {}};
+            continue;
+        }
+
+        parameterTypes.push_back(ValueType::STRUCT);
+        parameterFields.push_back(fieldsOf(currParamDef._parameterType));
+        parameters[name] = Parameter{name, paramSlot, ValueType::STRUCT, parameterFields.back()};
+        for(auto& currField : parameterFields.back())
+            parameters[name + currField._path] = Parameter{name + currField._path, paramSlot++, currField._type, {}};
+    }
+    context._returnType = valueType(declaredType(currFunc._type));
+    context._numParameterSlots = paramSlot;
+
     functionToInstruction[currFunc._name] = CompiledFunction{
         compileCode.size(),
         currFunc._parameters.size(),
-        currFunc._returnsSmth
+        currFunc._returnsSmth,
+        parameterTypes,
+        context._returnType,
+        parameterFields,
+        paramSlot
     };
 
-    size_t paramIdx = 0;
-    for(auto& currParamDef : currFunc._parameters) {
-        parameters[currParamDef._parameterName] = Parameter{currParamDef._parameterName, paramIdx++};
-    }
+    lines.MarkNext(compileCode.size());
+
+    // Literal initial values are pushed right away.
+    auto declareVariable = [&](const Statement& declaration, ValueType type) {
+        // Zero bits are 0.0 and the empty string as well.
+        Instruction initialValue{interpreter::PUSH_INT, 0, 0};
+        if(!declaration._parameters.empty()) {
+            const auto& initialValueParsed = declaration._parameters[0];
+            if(initialValueParsed._kind == StatementKind::LITERAL)
+                initialValue = pushLiteral(initialValueParsed, type, context);
+        }
+        variableOffsets[declaration._name] = Variable{int16_t(numIntVariable), type, {}};
+        ++numIntVariable;
+        compileCode.push_back(initialValue);
+    };
 
     for(const auto& currStatement : currFunc._statements) {
         switch(currStatement._kind) {
             case StatementKind::VARIABLE_DECLARATION:
+                if(declaredType(currStatement._type) == ValueType::STRING
+                   || declaredType(currStatement._type) == ValueType::ARRAY) {
+                    declareVariable(currStatement, declaredType(currStatement._type));
+                    break;
+                }
                 switch(currStatement._type._type) {
                     case VOID:
                         break;
@@ -207,27 +820,65 @@ void generateCodeForFunction(const FunctionDefinition& currFunc, vector<Instruct
                         break;
                     case UINT8:
                         break;
-                    case INT32: {
-                        int32_t initialValue = 0;
-                        if(!currStatement._parameters.empty()) {
-                            const auto& initialValueParsed = currStatement._parameters[0];
-                            if(initialValueParsed._kind == StatementKind::LITERAL) {
-                                assert(initialValueParsed._type._type == currStatement._type._type);
-                                initialValue = stoi(initialValueParsed._name);
-                            }
+                    case INT32:
+                        // Arrays used to be held in integer variables, which still works.
+                        if(!currStatement._parameters.empty()
+                           && typeOf(currStatement._parameters[0], variableOffsets, parameters,
+                                     functionToInstruction) == ValueType::ARRAY) {
+                            declareVariable(currStatement, ValueType::ARRAY);
+                            break;
                         }
-                        variableOffsets[currStatement._name] = numIntVariable;
-                        ++numIntVariable;
-                        compileCode.push_back(Instruction{interpreter::PUSH_INT,
-                                                          0, int16_t(initialValue)});
-                        break;
-                    }
-                    case UINT32:
+                        declareVariable(currStatement, ValueType::INT32);
                         break;
                     case DOUBLE:
+                        declareVariable(currStatement, ValueType::DOUBLE);
                         break;
-                    case STRUCT:
+                    case UINT32:
                         break;
+                    case STRUCT: {
+                        // Fields get a slot each, so accessing one is a single base-relative instruction.
+                        const string& name = currStatement._name;
+                        vector<Field> fields = fieldsOf(currStatement._type);
+                        Variable structVariable{int16_t(numIntVariable), ValueType::STRUCT, fields};
+                        bool isArray = isNewStructArray(currStatement);
+                        if(isArray && any_of(fields.begin(), fields.end(),
+                                             [](const Field& field) {
+                                                 return field._type == ValueType::STRING
+                                                        || field._type == ValueType::ARRAY;
+                                             }))
+                            throw runtime_error("Arrays hold numbers only, unlike the fields of " + name);
+                        if(isArray && !context._structOfArrays) {
+                            if(fields.size() > UINT8_MAX)
+                                throw runtime_error("Struct " + currStatement._type._name
+                                                    + " has too many fields to interleave, compile with --soa");
+                            structVariable._type = ValueType::ARRAY;
+                            structVariable._stride = uint8_t(fields.size());
+                            for(size_t x = 0; x < fields.size(); ++x) {
+                                variableOffsets[name + fields[x]._path] = Variable{
+                                        int16_t(numIntVariable), fields[x]._type, {}, structVariable._stride,
+                                        int16_t(x)};
+                            }
+                            ++numIntVariable;
+                            compileCode.push_back(Instruction{interpreter::PUSH_INT, 0, 0});
+                        } else {
+                            // An array of structs stands for the array of its first field, for length.
+                            if(isArray)
+                                structVariable._type = ValueType::ARRAY;
+                            for(auto& currField : fields) {
+                                variableOffsets[name + currField._path] = Variable{
+                                        int16_t(numIntVariable), isArray ? ValueType::ARRAY : currField._type, {}};
+                                ++numIntVariable;
+                                compileCode.push_back(Instruction{interpreter::PUSH_INT, 0, 0});
+                            }
+                            // And one for the length of its arrays while they are made.
+                            if(isArray) {
+                                ++numIntVariable;
+                                compileCode.push_back(Instruction{interpreter::PUSH_INT, 0, 0});
+                            }
+                        }
+                        variableOffsets[name] = structVariable;
+                        break;
+                    }
                 }
                 break;
             default:
@@ -236,12 +887,15 @@ void generateCodeForFunction(const FunctionDefinition& currFunc, vector<Instruct
     }
 
     for(const auto& currStmt : currFunc._statements) {
+        lines.MarkNext(compileCode.size());
         generateCodeForStatement(currStmt, variableOffsets,
                                  parameters, returnCndJumpInstructions,
-                                 compileCode, functionToInstruction);
+                                 compileCode, functionToInstruction, lines, context);
     }
 
     size_t cleanupCodeOffset = compileCode.size();
+    if(lines._endLine != 0)
+        lines._table->Mark(cleanupCodeOffset, lines._endLine);
 
     for(auto returnCmdJumpInstructionIdx : returnCndJumpInstructions) {
         compileCode[returnCmdJumpInstructionIdx].p2 = cleanupCodeOffset - returnCmdJumpInstructionIdx;
@@ -251,15 +905,88 @@ void generateCodeForFunction(const FunctionDefinition& currFunc, vector<Instruct
         compileCode.push_back(Instruction{interpreter::POP_INT, 0, 0});
 
     compileCode.push_back(Instruction{interpreter::RETURN, 0, 0});
+
+    if(context._stackMaps) {
+        vector<SlotKind> parameterKinds;
+        for(size_t x = 0; x < parameterTypes.size(); ++x) {
+            if(parameterTypes[x] != ValueType::STRUCT) {
+                parameterKinds.push_back(slotKindOf(parameterTypes[x]));
+                continue;
+            }
+            for(auto& currField : parameterFields[x])
+                parameterKinds.push_back(slotKindOf(currField._type));
+        }
+        map<size_t, CalleeShape> callees;
+        for(auto& [_, func] : functionToInstruction)
+            callees[func._instructionOffset] = CalleeShape{func._numParameterSlots, func._returnSmth,
+                                                           slotKindOf(func._returnType)};
+        context._stackMaps->AddFunction(compileCode.data(), compileCode.size(),
+                                        functionToInstruction[currFunc._name]._instructionOffset,
+                                        parameterKinds, callees);
+    }
 }
 
-int main() {
+int main(int argc, char** argv) {
     try {
         std::cout << "Compiler 01.\n" << endl;
 
-        FILE* fh = fopen("/Users/dimashestakov/Desktop/Compiler/compiler.myc", "r");
+        const char* path = "/Users/dimashestakov/Desktop/Compiler/compiler.myc";
+        bool printNgrams = false;
+        bool printCounters = false;
+        bool measurePerf = false;
+        const char* foldedStacksPath = nullptr;
+        bool sample = false;
+        bool perfMap = false;
+        bool jitdump = false;
+        const char* tracePath = nullptr;
+        bool jit = false;
+        bool tracing = false;
+        bool tiered = false;
+        bool batch = false;
+        bool lockstep = false;
+        bool int32 = false;
+        bool structOfArrays = false;
+        bool gcStats = false;
+        for(int x = 1; x < argc; ++x) {
+            if(string(argv[x]) == "--ngrams")
+                printNgrams = true;
+            else if(string(argv[x]) == "--counters")
+                printCounters = true;
+            else if(string(argv[x]) == "--perf")
+                measurePerf = true;
+            else if(string(argv[x]) == "--profile" && x + 1 < argc)
+                foldedStacksPath = argv[++x];
+            else if(string(argv[x]) == "--sample")
+                sample = true;
+            else if(string(argv[x]) == "--perf-map")
+                perfMap = true;
+            else if(string(argv[x]) == "--jitdump")
+                jitdump = true;
+            else if(string(argv[x]) == "--record" && x + 1 < argc)
+                tracePath = argv[++x];
+            else if(string(argv[x]) == "--jit")
+                jit = true;
+            else if(string(argv[x]) == "--trace")
+                tracing = true;
+            else if(string(argv[x]) == "--tiered")
+                tiered = true;
+            else if(string(argv[x]) == "--batch")
+                batch = true;
+            else if(string(argv[x]) == "--lockstep")
+                lockstep = true;
+            else if(string(argv[x]) == "--int32")
+                int32 = true;
+            else if(string(argv[x]) == "--soa")
+                structOfArrays = true;
+            else if(string(argv[x]) == "--gc-stats")
+                gcStats = true;
+            else
+                path = argv[x];
+        }
+
+        FILE* fh = fopen(path, "r");
         if(!fh)
-            cerr << "Can't find file" << endl;
+            throw runtime_error(string("Can't find file ") + path);
 
         fseek(fh, 0, SEEK_END);
         size_t fileSize = ftell(fh);
@@ -269,14 +996,24 @@ int main() {
 
         cout << fileContents << endl << endl;
 
+        // Hardware counters per compile phase and for execution, printed when main is done.
+        PerfCounters perf(measurePerf, measurePerf ? &cout : nullptr);
+
         Tokenizer tokenizer;
-        vector<Token> tokens = tokenizer.parse(fileContents);
+        vector<Token> tokens;
+        {
+            auto phase = perf.Measure("Tokenizer::parse");
+            tokens = tokenizer.parse(fileContents);
+        }
 
         for(Token currToken : tokens)
             currToken.debugPrint();
 
         Parser parser;
-        parser.parse(tokens);
+        {
+            auto phase = perf.Measure("Parser::parse");
+            parser.parse(tokens);
+        }
 
         parser.debugPrint();
 
@@ -284,19 +1021,223 @@ int main() {
 
         map<string, FunctionDefinition> functions = parser.getFunctions();
         map<string, CompiledFunction> functionToInstruction;
+        // Source lines of the unoptimized code.
+        SourceLineTable lineTable;
+        // Doubles and the literals that don't fit an instruction.
+        ConstantPool constants;
+        // The string literals, which constants refer to.
+        StringPool strings;
+        // Where the reference interpreter's garbage collector finds arrays and strings on the stack.
+        StackMaps stackMaps;
+        CodeContext context{constants, strings, int32, structOfArrays};
+        context._stackMaps = &stackMaps;
+
+        {
+            auto phase = perf.Measure("generateCodeForFunction");
+            for(auto& [_, func] : functions) {
+                StatementLines lines = statementLinesOf(tokens, func._name, lineTable);
+                generateCodeForFunction(func, compiledCode, functionToInstruction, lines, context);
+            }
+        }
+
+        // Only the reference interpreter runs code with wide integers or doubles.
+        bool wide = int32 || any_of(compiledCode.begin(), compiledCode.end(),
+                                    [](const Instruction& instruction) { return IsWideOpcode(instruction._opcode); });
 
-        for(auto& [_, func] : functions)
-            generateCodeForFunction(func, compiledCode, functionToInstruction);
+        // Names generated code for perf, it only sees anonymous addresses otherwise.
+        unique_ptr<JitSymbols> jitSymbols;
+        if(perfMap || jitdump) {
+            jitSymbols = make_unique<JitSymbols>(perfMap, jitdump);
+            SetJitSymbols(jitSymbols.get());
+            jitSymbols->AddThreadedHandlers(StackCaching::NONE);
+        }
 
         int16_t result = 0;
+        int64_t wideResult = 0; // of the reference interpreter, a double's bits if main returns one
+        string resultText;      // if main returns a string
+        // The script prints in blocks, flushing every printNum would make it bound by syscalls.
+        BufferedOutput output(cout);
+        SetOutputSink(&output);
         size_t mainFunctionOffset = SIZE_MAX;
         auto foundFunction = functionToInstruction.find("main");
-        if(foundFunction != functionToInstruction.end())
+        if(foundFunction == functionToInstruction.end())
             throw runtime_error("Couldn't find main function");
 
-        Interpreter::Run(compiledCode.data() + foundFunction->second._instructionOffset, {3}, &result);
+        if(printNgrams) {
+            OpcodeNgrams ngrams;
+            if(wide) {
+                VM vm;
+                vm.SetConstants(&constants);
+                vm.SetStrings(&strings);
+                vm.SetStackMaps(&stackMaps, compiledCode.data());
+                ngrams.Record(vm, compiledCode.data(), compiledCode.size(), foundFunction->second._instructionOffset,
+                              vector<int64_t>{3}, &wideResult);
+            } else {
+                ngrams.Record(compiledCode.data(), compiledCode.size(), foundFunction->second._instructionOffset,
+                              {3}, &result);
+            }
+            cout << "\nMost frequent opcode sequences:\n";
+            ngrams.Print(cout);
+        }
+
+        if(printCounters) {
+            // Prints when the run is over.
+            ExecutionCounters counters(&cout);
+            VM vm;
+            vm.SetConstants(&constants);
+            vm.SetStrings(&strings);
+            vm.SetStackMaps(&stackMaps, compiledCode.data());
+            vm.SetCounters(&counters);
+            vm.Run(compiledCode.data() + foundFunction->second._instructionOffset, vector<int64_t>{3}, &wideResult);
+            output.Flush();
+            cout << "\nExecution counts:\n";
+        }
+
+        if(tracePath) {
+            // For TraceAnalyzer, written completely when the recorder goes away.
+            TraceRecorder recorder(tracePath, compiledCode.data(), functionNamesOf(functionToInstruction));
+            VM vm;
+            vm.SetConstants(&constants);
+            vm.SetStrings(&strings);
+            vm.SetStackMaps(&stackMaps, compiledCode.data());
+            vm.SetRecorder(&recorder);
+            vm.Run(compiledCode.data() + foundFunction->second._instructionOffset, vector<int64_t>{3}, &wideResult);
+        }
+
+        if(foldedStacksPath) {
+            CallProfiler profiler(compiledCode.data(), functionNamesOf(functionToInstruction));
+            VM vm;
+            vm.SetConstants(&constants);
+            vm.SetStrings(&strings);
+            vm.SetStackMaps(&stackMaps, compiledCode.data());
+            vm.SetProfiler(&profiler);
+            vm.Run(compiledCode.data() + foundFunction->second._instructionOffset, vector<int64_t>{3}, &wideResult);
+            output.Flush();
+
+            cout << "\nFunction profile:\n";
+            profiler.Print(cout);
+            ofstream folded(foldedStacksPath);
+            if(!folded)
+                throw runtime_error(string("Can't write ") + foldedStacksPath);
+            profiler.PrintFolded(folded);
+        }
+
+        if(sample) {
+            SamplingProfiler sampler(compiledCode.data(), compiledCode.size());
+            VM vm;
+            vm.SetConstants(&constants);
+            vm.SetStrings(&strings);
+            vm.SetStackMaps(&stackMaps, compiledCode.data());
+            vm.SetSampler(&sampler);
+            sampler.Start();
+            vm.Run(compiledCode.data() + foundFunction->second._instructionOffset, vector<int64_t>{3}, &wideResult);
+            sampler.Stop();
+            output.Flush();
+
+            cout << "\nHot lines:\n";
+            sampler.Print(cout, lineTable, fileContents);
+        }
+
+        if(tiered) {
+            // Runs the unoptimized code, the optimized tiers do their own peephole pass.
+            vector<size_t> functionStarts;
+            for(auto& [_, func] : functionToInstruction)
+                functionStarts.push_back(func._instructionOffset);
+            TieredExecution tieredExecution(compiledCode.data(), compiledCode.size(), functionStarts,
+                                            TieringPolicy(), functionNamesOf(functionToInstruction));
+            {
+                auto phase = perf.Measure("execution");
+                tieredExecution.Run(foundFunction->second._instructionOffset, {3}, &result);
+            }
+            output.Flush();
+            cout << "\nResult: " << result << "\ndone" << endl;
+            return 0;
+        }
+
+        vector<size_t> newOffsets;
+        compiledCode = OptimizePeephole(compiledCode, &newOffsets);
+        for(auto& [_, func] : functionToInstruction)
+            func._instructionOffset = newOffsets[func._instructionOffset];
+        stackMaps.Relocate(newOffsets);
+
+        if(batch) {
+            // One argument set per line of standard input, run in parallel, reported in order.
+            vector<vector<int16_t>> argumentSets;
+            string line;
+            while(getline(cin, line)) {
+                istringstream numbers(line);
+                vector<int16_t> args;
+                int number;
+                while(numbers >> number)
+                    args.push_back(int16_t(number));
+                argumentSets.push_back(args);
+            }
+
+            vector<int16_t> results;
+            vector<vector<int64_t>> printed(argumentSets.size());
+            if(lockstep) {
+                // Lanes print as they go, in lane order.
+                LockstepInterpreter lockstepInterpreter(compiledCode.data(), compiledCode.size(),
+                                                        foundFunction->second._instructionOffset);
+                auto phase = perf.Measure("execution");
+                results = lockstepInterpreter.Run(argumentSets);
+            } else {
+                // Only this thread is counted, not the workers.
+                ThreadedCode threadedCode(compiledCode.data(), compiledCode.size());
+                WorkStealingPool pool;
+                auto phase = perf.Measure("execution");
+                results = RunBatch(threadedCode, foundFunction->second._instructionOffset, argumentSets, pool,
+                                   &printed);
+            }
+            for(size_t x = 0; x < results.size(); ++x) {
+                for(int64_t number : printed[x])
+                    output.PrintInt(number);
+                output.Flush();
+                cout << "Result " << x << ": " << results[x] << endl;
+            }
+            cout << "done" << endl;
+            return 0;
+        }
+
+        if(jit) {
+            JitCode jitCode(compiledCode.data(), compiledCode.size(), functionNamesOf(functionToInstruction));
+            auto phase = perf.Measure("execution");
+            JitExecutor::Run(jitCode, foundFunction->second._instructionOffset, {3}, &result);
+        } else if(tracing) {
+            TracingJit tracingJit(compiledCode.data(), compiledCode.size(), TracingJit::DEFAULT_HOT_LOOP_THRESHOLD,
+                                  functionNamesOf(functionToInstruction));
+            auto phase = perf.Measure("execution");
+            tracingJit.Run(foundFunction->second._instructionOffset, {3}, &result);
+        } else if(wide) {
+            VM vm;
+            vm.SetConstants(&constants);
+            vm.SetStrings(&strings);
+            vm.SetStackMaps(&stackMaps, compiledCode.data());
+            auto phase = perf.Measure("execution");
+            vm.Run(compiledCode.data() + foundFunction->second._instructionOffset, vector<int64_t>{3}, &wideResult);
+            if(foundFunction->second._returnType == ValueType::STRING)
+                resultText = vm.Strings().View(wideResult);
+            else if(foundFunction->second._returnType == ValueType::ARRAY)
+                resultText = wideResult ? "array of " + to_string(ArrayAt(vm.Heap(), wideResult).Length()) : "no array";
+            if(gcStats) {
+                output.Flush();
+                cout << "\nGarbage collection: ";
+                vm.Heap().Statistics().Print(cout);
+            }
+        } else {
+            ThreadedCode threadedCode(compiledCode.data(), compiledCode.size());
+            auto phase = perf.Measure("execution");
+            ThreadedInterpreter::Run(threadedCode, foundFunction->second._instructionOffset, {3}, &result);
+        }
 
-        cout << "\nResult: " << result << "\ndone" << endl;
+        output.Flush();
+        ValueType returnType = foundFunction->second._returnType;
+        if(returnType == ValueType::STRING || returnType == ValueType::ARRAY)
+            cout << "\nResult: " << resultText << "\ndone" << endl;
+        else if(returnType == ValueType::DOUBLE)
+            cout << "\nResult: " << bit_cast<double>(wideResult) << "\ndone" << endl;
+        else
+            cout << "\nResult: " << (wide ? wideResult : int64_t(result)) << "\ndone" << endl;
     } catch(exception& e) {
         cerr << "Error: " << e.what() << endl;
     } catch(...) {